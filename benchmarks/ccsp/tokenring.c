@@ -20,12 +20,13 @@
 #define ELEMENTS	256
 #define STACK_SIZE	256
 
-static Channel 	channel[ELEMENTS];
-static word	workspace[ELEMENTS - 1][WORKSPACE_SIZE (1, STACK_SIZE)];
+static int	elements = ELEMENTS;
+static Channel 	*channel;
+static word	*workspace;
 
 static void root (Workspace wptr, int cycles, int tokens, int this)
 {
-	int next = (this + 1) % ELEMENTS;
+	int next = (this + 1) % elements;
 	int i, sum, token;
 
 	ChanOutInt (wptr, &(channel[next]), 1);
@@ -63,7 +64,7 @@ static void root (Workspace wptr, int cycles, int tokens, int this)
 static void element (Workspace wptr)
 {
 	int this = ProcGetParam (wptr, 0, int);
-	int next = (this + 1) % ELEMENTS;
+	int next = (this + 1) % elements;
 	int token;
 
 	do {
@@ -82,13 +83,15 @@ static void proc_main (Workspace wptr)
 	int tokens = ProcGetParam (wptr, 1, int);
 	int i;
 
-	LightProcBarrierInit (wptr, &bar, ELEMENTS - 1);
+	LightProcBarrierInit (wptr, &bar, elements - 1);
 
-	for (i = 0; i < ELEMENTS; ++i)
+	for (i = 0; i < elements; ++i)
 		ChanInit (wptr, &(channel[i]));
 
-	for (i = 1; i < ELEMENTS; ++i) {
-		Workspace ws = LightProcInit (wptr, workspace[i - 1], 1, STACK_SIZE);
+	for (i = 1; i < elements; ++i) {
+		Workspace ws = LightProcInit (wptr,
+				workspace + (i - 1) * WORKSPACE_SIZE (1, STACK_SIZE),
+				1, STACK_SIZE);
 		ProcParam (wptr, ws, 0, i);
 		LightProcStart (wptr, &bar, ws, element);
 	}
@@ -110,6 +113,16 @@ int main (int argc, char *argv[])
 		cycles = atoi (argv[1]);
 	if (argc >= 3)
 		tokens = atoi (argv[2]);
+	if (argc >= 4)
+		elements = atoi (argv[3]);
+	if (elements < 2)
+		return 1;
+
+	channel = malloc (sizeof (Channel) * elements);
+	workspace = malloc (sizeof (word) * (elements - 1)
+			* WORKSPACE_SIZE (1, STACK_SIZE));
+	if (channel == NULL || workspace == NULL)
+		return 1;
 
 	if (!ccsp_init ())
 		return 1;
@@ -0,0 +1,601 @@
+/*
+ * C++20 coroutine benchmark
+ *
+ * Author: Sarah Mount <s.mount@wlv.ac.uk>
+ * License: GPL v2
+ * Date: 2014
+ *
+ * The token ring of benchmarks/pthread/tokenring.c, with the same
+ * arguments and output, where every element is a stackless C++20
+ * coroutine which co_awaits its channels.
+ *
+ *   - Channels are unbuffered, as in CCSP.  Whichever end arrives
+ *     first suspends, and the other end hands the token over and
+ *     schedules it again.  A coroutine is already suspended when
+ *     await_suspend runs, so the channel lock need only cover
+ *     publishing its handle.
+ *   - Executors are pluggable.  "inline" resumes everything from one
+ *     FIFO on the calling thread and has no locks worth the name;
+ *     "pool" runs a number of worker threads, each with its own run
+ *     queue, stealing from the others when their own is empty.
+ *   - Coroutine frames come from a pool of cache-line sized blocks,
+ *     cached per thread, rather than from the global heap.
+ *
+ * Usage: tokenring [-e inline|pool] [-w workers]
+ *                  [cycles [tokens [elements]]]
+ *
+ * The pool has $CORES workers, as for the Go ring, or 1 unless -w
+ * says otherwise.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#define ELEMENTS	256
+#define CACHE_LINE	64
+
+/* Frames of up to FRAME_CLASSES cache lines come from the pool, which
+ * grows FRAMES_PER_CHUNK blocks at a time.
+ */
+#define FRAME_CLASSES		16
+#define FRAMES_PER_CHUNK	64
+
+/* Rounds of stealing before an idle worker goes to sleep. */
+#define IDLE_SPINS	64
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax()	__builtin_ia32_pause ()
+#elif defined(__aarch64__)
+#define cpu_relax()	__asm__ __volatile__ ("yield" ::: "memory")
+#else
+#define cpu_relax()	__asm__ __volatile__ ("" ::: "memory")
+#endif
+
+class spinlock {
+public:
+	void lock ()
+	{
+		while (held.exchange (true, std::memory_order_acquire))
+			while (held.load (std::memory_order_relaxed))
+				cpu_relax ();
+	}
+
+	bool try_lock ()
+	{
+		return !held.load (std::memory_order_relaxed)
+			&& !held.exchange (true, std::memory_order_acquire);
+	}
+
+	void unlock ()
+	{
+		held.store (false, std::memory_order_release);
+	}
+
+private:
+	std::atomic<bool> held {false};
+};
+
+/*
+ * Frames
+ *
+ * Each thread keeps free lists of its own, one per size class, so
+ * neither allocation nor release takes a lock unless the pool has to
+ * grow.  A frame freed on another thread than the one which allocated
+ * it simply joins the other thread's lists.  Chunks are only returned
+ * to the heap at exit.
+ */
+class frame_pool {
+public:
+	void *allocate (std::size_t size)
+	{
+		std::size_t c = size_class (size);
+		block *b;
+
+		if (c >= FRAME_CLASSES)
+			return ::operator new (size);
+		if (local.free[c] == nullptr)
+			grow (c);
+		b = local.free[c];
+		local.free[c] = b->next;
+		return b;
+	}
+
+	void deallocate (void *p, std::size_t size)
+	{
+		std::size_t c = size_class (size);
+		block *b = static_cast<block *> (p);
+
+		if (c >= FRAME_CLASSES) {
+			::operator delete (p);
+			return;
+		}
+		b->next = local.free[c];
+		local.free[c] = b;
+	}
+
+	~frame_pool ()
+	{
+		for (void *chunk : chunks)
+			::operator delete (chunk, std::align_val_t (CACHE_LINE));
+	}
+
+private:
+	struct block {
+		block	*next;
+	};
+
+	struct cache {
+		block	*free[FRAME_CLASSES];
+	};
+
+	static std::size_t size_class (std::size_t size)
+	{
+		return (size + CACHE_LINE - 1) / CACHE_LINE - 1;
+	}
+
+	void grow (std::size_t c)
+	{
+		std::size_t size = (c + 1) * CACHE_LINE;
+		char *chunk = static_cast<char *> (::operator new (
+				size * FRAMES_PER_CHUNK,
+				std::align_val_t (CACHE_LINE)));
+		block *b;
+		int i;
+
+		{
+			std::lock_guard<std::mutex> guard (lock);
+			chunks.push_back (chunk);
+		}
+		for (i = FRAMES_PER_CHUNK - 1; i >= 0; --i) {
+			b = reinterpret_cast<block *> (chunk + i * size);
+			b->next = local.free[c];
+			local.free[c] = b;
+		}
+	}
+
+	static thread_local cache local;
+	std::mutex		lock;
+	std::vector<void *>	chunks;
+};
+
+thread_local frame_pool::cache frame_pool::local;
+
+static frame_pool frames;
+
+/*
+ * Executors
+ */
+class executor {
+public:
+	virtual ~executor () {}
+	/* Queue a suspended coroutine to be resumed. */
+	virtual void schedule (std::coroutine_handle<> h) = 0;
+	/* Resume coroutines until none are left, or until stop has been
+	 * called and the queues have drained.
+	 */
+	virtual void run () = 0;
+	virtual void stop () {}
+};
+
+static executor *exec;
+
+/* One thread, one FIFO, and no need for stop. */
+class inline_executor : public executor {
+public:
+	void schedule (std::coroutine_handle<> h) override
+	{
+		ready.push_back (h);
+	}
+
+	void run () override
+	{
+		std::coroutine_handle<> h;
+
+		while (!ready.empty ()) {
+			h = ready.front ();
+			ready.pop_front ();
+			h.resume ();
+		}
+	}
+
+private:
+	std::deque<std::coroutine_handle<>> ready;
+};
+
+/* Worker threads with a run queue each.  A coroutine scheduled on a
+ * worker goes on that worker's queue, and one scheduled from outside the
+ * pool goes on the first.  Idle workers steal from the others, then
+ * sleep until something is scheduled or the pool is stopped.
+ */
+class pool_executor : public executor {
+public:
+	explicit pool_executor (int workers) : queues (workers) {}
+
+	void schedule (std::coroutine_handle<> h) override
+	{
+		queue &q = queues[worker_id < 0 ? 0 : worker_id];
+
+		q.lock.lock ();
+		q.ready.push_back (h);
+		q.size.store (q.ready.size (), std::memory_order_relaxed);
+		q.lock.unlock ();
+		/* Pairs with the fence in idle, so that either the sleeper
+		 * sees h or this thread sees the sleeper.
+		 */
+		std::atomic_thread_fence (std::memory_order_seq_cst);
+		if (idle_workers.load (std::memory_order_relaxed) > 0) {
+			std::lock_guard<std::mutex> guard (idle_lock);
+			idle_cond.notify_one ();
+		}
+	}
+
+	void run () override
+	{
+		std::vector<std::thread> threads;
+		int i;
+
+		for (i = 0; i < (int) queues.size (); ++i)
+			threads.emplace_back (&pool_executor::work, this, i);
+		for (std::thread &t : threads)
+			t.join ();
+	}
+
+	void stop () override
+	{
+		std::lock_guard<std::mutex> guard (idle_lock);
+		done.store (true, std::memory_order_release);
+		idle_cond.notify_all ();
+	}
+
+private:
+	struct alignas (CACHE_LINE) queue {
+		spinlock				lock;
+		std::atomic<std::size_t>		size {0};
+		std::deque<std::coroutine_handle<>>	ready;
+	};
+
+	/* Take the next coroutine from q, or if try_only, give up when
+	 * another thread holds its lock.
+	 */
+	static bool take (queue &q, bool try_only,
+			std::coroutine_handle<> &h)
+	{
+		bool found = false;
+
+		if (q.size.load (std::memory_order_relaxed) == 0)
+			return false;
+		if (try_only) {
+			if (!q.lock.try_lock ())
+				return false;
+		} else {
+			q.lock.lock ();
+		}
+		if (!q.ready.empty ()) {
+			h = q.ready.front ();
+			q.ready.pop_front ();
+			q.size.store (q.ready.size (), std::memory_order_relaxed);
+			found = true;
+		}
+		q.lock.unlock ();
+		return found;
+	}
+
+	bool find (int id, std::coroutine_handle<> &h)
+	{
+		int n = (int) queues.size (), i;
+
+		if (take (queues[id], false, h))
+			return true;
+		for (i = 1; i < n; ++i)
+			if (take (queues[(id + i) % n], true, h))
+				return true;
+		return false;
+	}
+
+	bool any_ready ()
+	{
+		for (queue &q : queues)
+			if (q.size.load (std::memory_order_seq_cst) > 0)
+				return true;
+		return false;
+	}
+
+	void idle ()
+	{
+		std::unique_lock<std::mutex> guard (idle_lock);
+
+		idle_workers.fetch_add (1, std::memory_order_relaxed);
+		std::atomic_thread_fence (std::memory_order_seq_cst);
+		if (!done.load (std::memory_order_acquire) && !any_ready ())
+			idle_cond.wait (guard);
+		idle_workers.fetch_sub (1, std::memory_order_relaxed);
+	}
+
+	/* After stop, coroutines still queued are run to completion, so
+	 * that every element finishes its last send.
+	 */
+	void work (int id)
+	{
+		std::coroutine_handle<> h;
+		int spins = 0;
+
+		worker_id = id;
+		for (;;) {
+			if (find (id, h)) {
+				spins = 0;
+				h.resume ();
+			} else if (done.load (std::memory_order_acquire)) {
+				break;
+			} else if (++spins < IDLE_SPINS) {
+				cpu_relax ();
+			} else {
+				idle ();
+				spins = 0;
+			}
+		}
+		worker_id = -1;
+	}
+
+	static thread_local int	worker_id;
+	std::vector<queue>	queues;
+	std::mutex		idle_lock;
+	std::condition_variable	idle_cond;
+	std::atomic<int>	idle_workers {0};
+	std::atomic<bool>	done {false};
+};
+
+thread_local int pool_executor::worker_id = -1;
+
+/*
+ * Coroutines
+ *
+ * A task starts suspended, is started by being scheduled, and frees its
+ * frame itself when it returns.
+ */
+struct task {
+	struct promise_type {
+		task get_return_object ()
+		{
+			return task {std::coroutine_handle<promise_type>::
+				from_promise (*this)};
+		}
+
+		std::suspend_always initial_suspend () noexcept { return {}; }
+		std::suspend_never final_suspend () noexcept { return {}; }
+		void return_void () {}
+		void unhandled_exception () { std::terminate (); }
+
+		static void *operator new (std::size_t size)
+		{
+			return frames.allocate (size);
+		}
+
+		static void operator delete (void *p, std::size_t size)
+		{
+			frames.deallocate (p, size);
+		}
+	};
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+static void spawn (task t)
+{
+	exec->schedule (t.handle);
+}
+
+/*
+ * Channels
+ */
+class alignas (CACHE_LINE) channel {
+public:
+	struct send_awaiter {
+		channel	&c;
+		int	value;
+
+		bool await_ready () { return false; }
+
+		/* Hand the token to a waiting receiver and carry on, or
+		 * leave it here and wait for one.
+		 */
+		bool await_suspend (std::coroutine_handle<> h)
+		{
+			std::coroutine_handle<> r;
+
+			c.lock.lock ();
+			if (c.waiting) {
+				r = c.waiting;
+				c.waiting = nullptr;
+				*c.slot = value;
+				c.lock.unlock ();
+				exec->schedule (r);
+				return false;
+			}
+			c.data = value;
+			c.waiting = h;
+			c.lock.unlock ();
+			return true;
+		}
+
+		void await_resume () {}
+	};
+
+	struct recv_awaiter {
+		channel	&c;
+		int	value;
+
+		bool await_ready () { return false; }
+
+		/* Take the token from a waiting sender and carry on, or
+		 * leave somewhere for one to put it and wait.
+		 */
+		bool await_suspend (std::coroutine_handle<> h)
+		{
+			std::coroutine_handle<> s;
+
+			c.lock.lock ();
+			if (c.waiting) {
+				s = c.waiting;
+				c.waiting = nullptr;
+				value = c.data;
+				c.lock.unlock ();
+				exec->schedule (s);
+				return false;
+			}
+			c.slot = &value;
+			c.waiting = h;
+			c.lock.unlock ();
+			return true;
+		}
+
+		int await_resume () { return value; }
+	};
+
+	send_awaiter send (int value) { return send_awaiter {*this, value}; }
+	recv_awaiter recv () { return recv_awaiter {*this, 0}; }
+
+private:
+	spinlock		lock;
+	std::coroutine_handle<>	waiting;	/* Whichever end is first. */
+	int			data;		/* From a waiting sender. */
+	int			*slot;		/* In a waiting receiver. */
+};
+
+/*
+ * Ring
+ */
+static int		elements = ELEMENTS;
+static int		cycles;
+static int		tokens;
+static channel		*chan;
+
+static task root (int self)
+{
+	channel &in = chan[self];
+	channel &out = chan[(self + 1) % elements];
+	int i, sum, token;
+
+	co_await out.send (1);
+	token = co_await in.recv ();
+
+	fprintf (stdout, "start\n");
+	fflush (stdout);
+
+	for (i = 0; i < tokens; ++i)
+		co_await out.send (i + 1);
+
+	while (cycles > 0) {
+		for (i = 0; i < tokens; ++i) {
+			token = co_await in.recv ();
+			co_await out.send (token + 1);
+		}
+		cycles--;
+	}
+
+	sum = 0;
+	for (i = 0; i < tokens; ++i)
+		sum += co_await in.recv ();
+
+	fprintf (stdout, "end\n");
+	fflush (stdout);
+
+	fprintf (stdout, "%d\n", sum);
+
+	co_await out.send (0);
+	token = co_await in.recv ();
+
+	exec->stop ();
+}
+
+static task element (int self)
+{
+	channel &in = chan[self];
+	channel &out = chan[(self + 1) % elements];
+	int token;
+
+	do {
+		token = co_await in.recv ();
+		co_await out.send (token > 0 ? token + 1 : token);
+	} while (token);
+}
+
+static void usage (const char *name)
+{
+	fprintf (stderr, "Usage: %s [-e inline|pool] [-w workers] "
+			"[cycles [tokens [elements]]]\n", name);
+	exit (EXIT_FAILURE);
+}
+
+int main (int argc, char *argv[])
+{
+	const char *cores = getenv ("CORES");
+	int workers = 1, pool = 0, i, opt;
+
+	if (cores != NULL && atoi (cores) > 0)
+		workers = atoi (cores);
+	while ((opt = getopt (argc, argv, "e:w:")) != -1) {
+		switch (opt) {
+		case 'e':
+			if (strcmp (optarg, "inline") == 0)
+				pool = 0;
+			else if (strcmp (optarg, "pool") == 0)
+				pool = 1;
+			else
+				usage (argv[0]);
+			break;
+		case 'w':
+			workers = atoi (optarg);
+			break;
+		default:
+			usage (argv[0]);
+		}
+	}
+
+	if (argc - optind >= 1)
+		cycles = atoi (argv[optind]);
+	else
+		cycles = 0;
+	if (argc - optind >= 2)
+		tokens = atoi (argv[optind + 1]);
+	else
+		tokens = 1;
+	if (argc - optind >= 3)
+		elements = atoi (argv[optind + 2]);
+	if (elements < 2 || workers < 1)
+		usage (argv[0]);
+	/* Every element can hold one token, and the root none while it is
+	 * still sending them out.
+	 */
+	if (tokens >= elements) {
+		fprintf (stderr, "%s: unbuffered channels need fewer than %d "
+				"tokens\n", argv[0], elements);
+		exit (EXIT_FAILURE);
+	}
+
+	if (pool)
+		exec = new pool_executor (workers);
+	else
+		exec = new inline_executor ();
+	chan = new channel[elements];
+
+	for (i = elements - 1; i > 0; --i)
+		spawn (element (i));
+	spawn (root (0));
+	exec->run ();
+
+	delete[] chan;
+	delete exec;
+	return 0;
+}
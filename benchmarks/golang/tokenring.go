@@ -62,11 +62,11 @@ func root(cycles, tokens int, this, next chan int) {
 	<-this;
 }
 
-func ring(cycles, tokens int) {
+func ring(cycles, tokens, elements int) {
 	head := make(chan int);
 	this := head;
 
-	for i := 0; i < ELEMENTS - 1; i = i + 1 {
+	for i := 0; i < elements - 1; i = i + 1 {
 		next := make(chan int);
 		go element(this, next);
 		this = next
@@ -92,6 +92,14 @@ func main() {
 	if flag.NArg() >= 2 {
 		tokens, _ = strconv.Atoi(flag.Arg(1))
 	}
+	elements := ELEMENTS;
+	if flag.NArg() >= 3 {
+		elements, _ = strconv.Atoi(flag.Arg(2))
+	}
+	if elements < 2 {
+		fmt.Fprintf(os.Stderr, "Usage: %s [cycles [tokens [elements]]]\n", os.Args[0]);
+		os.Exit(1)
+	}
 
-	ring(cycles, tokens)
+	ring(cycles, tokens, elements)
 }
@@ -0,0 +1,729 @@
+/*
+ * Green-thread benchmark
+ *
+ * Author: Sarah Mount <s.mount@wlv.ac.uk>
+ * License: GPL v2
+ * Date: 2014
+ *
+ * The token ring of benchmarks/pthread/tokenring.c, with the same
+ * arguments and output, on a small user-level runtime instead of one
+ * kernel thread per element.  Elements are lightweight processes, each
+ * with a stack of its own, multiplexed over a number of worker threads.
+ *
+ * Runtime:
+ *   - contexts are switched by a few lines of assembly on x86-64, and
+ *     by ucontext elsewhere or if built with -DUSE_UCONTEXT;
+ *   - every worker has a run queue of its own.  A process made ready
+ *     goes on the queue of the worker which readied it, and a worker
+ *     with nothing to run steals from the others before it sleeps;
+ *   - channels are unbuffered, as in CCSP: whichever end arrives first
+ *     parks, and the other end makes it ready again.  With as many
+ *     tokens as elements every element would park sending, so fewer
+ *     are required.  A process parks
+ *     holding the lock of its channel, which its worker releases only
+ *     once the process has been switched out, so it can never be made
+ *     ready while it is still running.
+ *
+ * Usage: tokenring [-w workers] [-k stack_kb] [-z bytes] [-x copy|transfer]
+ *                  [cycles [tokens [elements]]]
+ *
+ * The number of workers defaults to $CORES, as for the Go ring, or 1.
+ * Stacks are not guarded, so -k must leave room for what an element
+ * does; the root gets ROOT_STACK_KB, as it also calls stdio.  -z and -x
+ * give every token a body, as in the pthread ring; see Payload below.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#if !defined(__x86_64__)
+#define USE_UCONTEXT
+#endif
+
+#ifdef USE_UCONTEXT
+#include <ucontext.h>
+#endif
+
+#define ELEMENTS	256
+#define STACK_KB	16
+#define ROOT_STACK_KB	256
+#define CACHE_LINE	64
+
+/* Rounds of stealing before an idle worker goes to sleep. */
+#define IDLE_SPINS	64
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax()	__builtin_ia32_pause ()
+#elif defined(__aarch64__)
+#define cpu_relax()	__asm__ __volatile__ ("yield" ::: "memory")
+#else
+#define cpu_relax()	__asm__ __volatile__ ("" ::: "memory")
+#endif
+
+/*
+ * Contexts
+ */
+#ifdef USE_UCONTEXT
+
+typedef ucontext_t ctx_t;
+
+static void ctx_init (ctx_t *ctx, void *stack, size_t size,
+		void (*entry) (void))
+{
+	getcontext (ctx);
+	ctx->uc_stack.ss_sp = stack;
+	ctx->uc_stack.ss_size = size;
+	ctx->uc_link = NULL;
+	makecontext (ctx, entry, 0);
+}
+
+static void ctx_switch (ctx_t *from, ctx_t *to)
+{
+	swapcontext (from, to);
+}
+
+#else
+
+typedef struct {
+	void	*sp;
+} ctx_t;
+
+/* Save the callee-saved registers on the current stack, store the stack
+ * pointer in *from, and pop the registers saved on stack to.
+ */
+void ctx_swap (void **from, void *to);
+__asm__ (
+	".text\n"
+	".globl ctx_swap\n"
+	".type ctx_swap, @function\n"
+	"ctx_swap:\n"
+	"	pushq	%rbp\n"
+	"	pushq	%rbx\n"
+	"	pushq	%r12\n"
+	"	pushq	%r13\n"
+	"	pushq	%r14\n"
+	"	pushq	%r15\n"
+	"	movq	%rsp, (%rdi)\n"
+	"	movq	%rsi, %rsp\n"
+	"	popq	%r15\n"
+	"	popq	%r14\n"
+	"	popq	%r13\n"
+	"	popq	%r12\n"
+	"	popq	%rbx\n"
+	"	popq	%rbp\n"
+	"	ret\n"
+	".size ctx_swap, .-ctx_swap\n"
+);
+
+/* Lay out a stack as ctx_swap would have left it, returning into entry
+ * as if it had just been called, with the stack aligned as the ABI
+ * requires.
+ */
+static void ctx_init (ctx_t *ctx, void *stack, size_t size,
+		void (*entry) (void))
+{
+	uintptr_t top = ((uintptr_t) stack + size) & ~(uintptr_t) 15;
+	void **sp = (void **) top;
+
+	*--sp = NULL;			/* Return address of entry. */
+	*--sp = (void *) entry;
+	sp -= 6;			/* rbp, rbx, r12 to r15. */
+	memset (sp, 0, 6 * sizeof (void *));
+	ctx->sp = sp;
+}
+
+static void ctx_switch (ctx_t *from, ctx_t *to)
+{
+	ctx_swap (&(from->sp), to->sp);
+}
+
+#endif /* USE_UCONTEXT */
+
+/*
+ * Processes and workers
+ */
+typedef struct proc {
+	ctx_t		ctx;
+	struct proc	*next;		/* In a run queue. */
+	void		(*fn) (int);
+	int		arg;
+	int		value;		/* Received while parked. */
+	int		dead;
+	void		*stack;
+} proc_t;
+
+typedef struct {
+	int		lock;
+	proc_t		*head;
+	proc_t		*tail;
+} __attribute__ ((aligned (CACHE_LINE))) queue_t;
+
+typedef struct {
+	ctx_t		sched;
+	proc_t		*current;
+	int		*unlock;	/* Released once current is out. */
+	int		id;
+	pthread_t	thread;
+} __attribute__ ((aligned (CACHE_LINE))) worker_t;
+
+typedef struct {
+	int		lock;
+	proc_t		*waiting;
+	int		data;		/* From a parked sender. */
+} __attribute__ ((aligned (CACHE_LINE))) channel_t;
+
+static worker_t		*workers;
+static queue_t		*queues;
+static int		num_workers = 1;
+
+static pthread_mutex_t	idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	idle_cond = PTHREAD_COND_INITIALIZER;
+static int		idle_workers;
+static int		done;
+
+static __thread worker_t	*self;
+
+/* A process may move to another worker whenever it switches out, so the
+ * worker is looked up afresh after every switch rather than cached.
+ */
+static __attribute__ ((noinline)) worker_t *this_worker (void)
+{
+	return self;
+}
+
+static void spin_lock (int *lock)
+{
+	while (__atomic_exchange_n (lock, 1, __ATOMIC_ACQUIRE))
+		while (__atomic_load_n (lock, __ATOMIC_RELAXED))
+			cpu_relax ();
+}
+
+static int spin_trylock (int *lock)
+{
+	return !__atomic_load_n (lock, __ATOMIC_RELAXED)
+		&& !__atomic_exchange_n (lock, 1, __ATOMIC_ACQUIRE);
+}
+
+static void spin_unlock (int *lock)
+{
+	__atomic_store_n (lock, 0, __ATOMIC_RELEASE);
+}
+
+static void push (queue_t *q, proc_t *p)
+{
+	p->next = NULL;
+	spin_lock (&(q->lock));
+	if (q->tail != NULL)
+		q->tail->next = p;
+	else
+		__atomic_store_n (&(q->head), p, __ATOMIC_RELAXED);
+	q->tail = p;
+	spin_unlock (&(q->lock));
+}
+
+static proc_t *pop (queue_t *q)
+{
+	proc_t *p;
+
+	if (__atomic_load_n (&(q->head), __ATOMIC_RELAXED) == NULL)
+		return NULL;
+	spin_lock (&(q->lock));
+	p = q->head;
+	if (p != NULL) {
+		__atomic_store_n (&(q->head), p->next, __ATOMIC_RELAXED);
+		if (p->next == NULL)
+			q->tail = NULL;
+	}
+	spin_unlock (&(q->lock));
+	return p;
+}
+
+/* Take a process from the queue of another worker, if one is free. */
+static proc_t *steal (int id)
+{
+	queue_t *q;
+	proc_t *p;
+	int i;
+
+	for (i = 1; i < num_workers; ++i) {
+		q = &(queues[(id + i) % num_workers]);
+		if (__atomic_load_n (&(q->head), __ATOMIC_RELAXED) == NULL
+				|| !spin_trylock (&(q->lock)))
+			continue;
+		p = q->head;
+		if (p != NULL) {
+			__atomic_store_n (&(q->head), p->next,
+					__ATOMIC_RELAXED);
+			if (p->next == NULL)
+				q->tail = NULL;
+		}
+		spin_unlock (&(q->lock));
+		if (p != NULL)
+			return p;
+	}
+	return NULL;
+}
+
+static int any_ready (void)
+{
+	int i;
+
+	for (i = 0; i < num_workers; ++i)
+		if (__atomic_load_n (&(queues[i].head), __ATOMIC_SEQ_CST))
+			return 1;
+	return 0;
+}
+
+/* Queue p on this worker, waking a sleeping worker to steal it.  The
+ * fence pairs with the one in idle(), so that either the sleeper sees
+ * p or this worker sees the sleeper.
+ */
+static void ready (proc_t *p)
+{
+	push (&(queues[this_worker ()->id]), p);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&idle_workers, __ATOMIC_RELAXED) > 0) {
+		pthread_mutex_lock (&idle_lock);
+		pthread_cond_signal (&idle_cond);
+		pthread_mutex_unlock (&idle_lock);
+	}
+}
+
+static void idle (void)
+{
+	pthread_mutex_lock (&idle_lock);
+	__atomic_add_fetch (&idle_workers, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n (&done, __ATOMIC_ACQUIRE) && !any_ready ())
+		pthread_cond_wait (&idle_cond, &idle_lock);
+	__atomic_sub_fetch (&idle_workers, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock (&idle_lock);
+}
+
+/* Switch out the running process, releasing lock once it is out. */
+static void park (int *lock)
+{
+	worker_t *w = this_worker ();
+	proc_t *p = w->current;
+
+	w->unlock = lock;
+	ctx_switch (&(p->ctx), &(w->sched));
+}
+
+static void proc_start (void)
+{
+	worker_t *w = this_worker ();
+	proc_t *p = w->current;
+
+	p->fn (p->arg);
+	p->dead = 1;
+	w = this_worker ();
+	ctx_switch (&(p->ctx), &(w->sched));
+}
+
+static void spawn (void (*fn) (int), int arg, size_t stack_size)
+{
+	proc_t *p = calloc (1, sizeof (proc_t));
+
+	if (p == NULL || (p->stack = malloc (stack_size)) == NULL) {
+		perror ("spawn");
+		exit (EXIT_FAILURE);
+	}
+	p->fn = fn;
+	p->arg = arg;
+	ctx_init (&(p->ctx), p->stack, stack_size, proc_start);
+	push (&(queues[arg % num_workers]), p);
+}
+
+static void *worker (void *arg)
+{
+	worker_t *w = arg;
+	proc_t *p;
+	int spins = 0;
+
+	self = w;
+	while (!__atomic_load_n (&done, __ATOMIC_ACQUIRE)) {
+		p = pop (&(queues[w->id]));
+		if (p == NULL)
+			p = steal (w->id);
+		if (p == NULL) {
+			if (++spins < IDLE_SPINS) {
+				cpu_relax ();
+			} else {
+				idle ();
+				spins = 0;
+			}
+			continue;
+		}
+		spins = 0;
+		w->current = p;
+		ctx_switch (&(w->sched), &(p->ctx));
+		w->current = NULL;
+		if (w->unlock != NULL) {
+			spin_unlock (w->unlock);
+			w->unlock = NULL;
+		}
+		if (p->dead) {
+			free (p->stack);
+			free (p);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Channels
+ */
+static channel_t	*channel;
+
+static void send_to (int i, int d)
+{
+	channel_t *c = &(channel[i]);
+	proc_t *r;
+
+	spin_lock (&(c->lock));
+	r = c->waiting;
+	if (r != NULL) {
+		c->waiting = NULL;
+		spin_unlock (&(c->lock));
+		r->value = d;
+		ready (r);
+	} else {
+		c->data = d;
+		c->waiting = this_worker ()->current;
+		park (&(c->lock));
+	}
+}
+
+static int recv_from (int i)
+{
+	channel_t *c = &(channel[i]);
+	proc_t *p, *s;
+	int d;
+
+	spin_lock (&(c->lock));
+	s = c->waiting;
+	if (s != NULL) {
+		c->waiting = NULL;
+		d = c->data;
+		spin_unlock (&(c->lock));
+		ready (s);
+		return d;
+	}
+	p = this_worker ()->current;
+	c->waiting = p;
+	park (&(c->lock));
+	return p->value;
+}
+
+/*
+ * Ring
+ */
+static int		elements = ELEMENTS;
+static int		cycles;
+static int		tokens;
+/* When the root printed "start" and "end". */
+static struct timespec	ring_time[2];
+
+/*
+ * Payload
+ *
+ * With -z n, every token carries an n-byte body, where n is at least 8,
+ * is rounded up to a multiple of 8 and may end in K or M.  -x chooses
+ * how bodies move, as in the pthread ring:
+ *
+ *   copy      each element copies the body from the slot it arrived in
+ *             into a slot of the next channel, so every hop reads and
+ *             writes n bytes
+ *   transfer  bodies come from a pool, one per token, allocated before
+ *             the ring starts.  Only a pointer is handed on, and every
+ *             receiver reads the whole of the body it was given
+ *
+ * A body travels beside its token, in one of PAYLOAD_SLOTS slots per
+ * channel, which are used in turn.  Processes move between workers, so
+ * the turns are counted per channel rather than per thread.  A channel
+ * holds no tokens, and its receiver may still be reading the body of the
+ * last one, so the other slot is always free for the sender.  Messages
+ * and bytes per second between "start" and "end" are reported on stderr.
+ */
+#define PAYLOAD_COPY		0
+#define PAYLOAD_TRANSFER	1
+
+#define PAYLOAD_SLOTS		2
+
+static const char *payload_modes[] = { "copy", "transfer" };
+
+static size_t		payload;	/* 0 for bare tokens. */
+static int		payload_mode = PAYLOAD_COPY;
+static char		*payload_body;	/* Slots of every channel, to copy. */
+static char		**payload_ptr;	/* Slots of every channel, to transfer. */
+static char		*payload_pool;	/* A body per token, to transfer. */
+static char		*payload_source; /* What the root copies out. */
+static double		payload_hops;
+static unsigned long	*payload_sent;	/* Per channel, by its sender. */
+static unsigned long	*payload_received; /* Per channel, by its receiver. */
+static volatile uint64_t	payload_sink;
+
+static void *aligned_calloc (size_t n, size_t size)
+{
+	void *p;
+
+	if (posix_memalign (&p, CACHE_LINE, n * size) != 0) {
+		perror ("ring state");
+		exit (EXIT_FAILURE);
+	}
+	memset (p, 0, n * size);
+	return p;
+}
+
+/* Bytes in s, which may end in K or M, or 0 if it is not a size. */
+static size_t parse_size (const char *s)
+{
+	char *end;
+	long n = strtol (s, &end, 10);
+
+	if (*end == 'K' || *end == 'k')
+		n <<= 10, end++;
+	else if (*end == 'M' || *end == 'm')
+		n <<= 20, end++;
+	return n > 0 && *end == '\0' ? (size_t) n : 0;
+}
+
+/* Allocate slots and bodies, and touch them all now rather than in the
+ * run.
+ */
+static void payload_init (void)
+{
+	size_t slots = (size_t) elements * PAYLOAD_SLOTS;
+
+	if (payload == 0)
+		return;
+	if (payload_mode == PAYLOAD_COPY) {
+		payload_body = aligned_calloc (slots, payload);
+		payload_source = aligned_calloc (1, payload);
+		memset (payload_source, 1, payload);
+	} else {
+		payload_ptr = aligned_calloc (slots, sizeof (char *));
+		payload_pool = aligned_calloc ((size_t) tokens + 1, payload);
+		memset (payload_pool, 1, ((size_t) tokens + 1) * payload);
+	}
+	payload_sent = aligned_calloc (elements, sizeof (unsigned long));
+	payload_received = aligned_calloc (elements, sizeof (unsigned long));
+	payload_hops = (cycles + 1.0) * tokens * elements;
+}
+
+/* Body of fresh token i, from 0 to tokens. */
+static char *payload_first (int i)
+{
+	if (payload == 0)
+		return NULL;
+	if (payload_mode == PAYLOAD_COPY)
+		return payload_source;
+	return payload_pool + (size_t) i * payload;
+}
+
+/* Pass body on with the token about to be sent on channel i. */
+static void payload_send (int i, char *body)
+{
+	size_t slot = (size_t) i * PAYLOAD_SLOTS
+		+ payload_sent[i]++ % PAYLOAD_SLOTS;
+
+	if (payload_mode == PAYLOAD_COPY)
+		memcpy (payload_body + slot * payload, body, payload);
+	else
+		payload_ptr[slot] = body;
+}
+
+/* The body of the token just received on channel i. */
+static char *payload_recv (int i)
+{
+	size_t slot = (size_t) i * PAYLOAD_SLOTS
+		+ payload_received[i]++ % PAYLOAD_SLOTS;
+	const uint64_t *word;
+	uint64_t sum = 0;
+	size_t k;
+
+	if (payload_mode == PAYLOAD_COPY)
+		return payload_body + slot * payload;
+	word = (const uint64_t *) payload_ptr[slot];
+	for (k = 0; k < payload / sizeof (uint64_t); ++k)
+		sum += word[k];
+	payload_sink += sum;
+	return payload_ptr[slot];
+}
+
+static void payload_report (void)
+{
+	double seconds, messages;
+
+	seconds = (ring_time[1].tv_sec - ring_time[0].tv_sec)
+		+ (ring_time[1].tv_nsec - ring_time[0].tv_nsec) / 1e9;
+	messages = seconds > 0 ? payload_hops / seconds : 0;
+	fprintf (stderr, "payload: %zu bytes by %s, %.0f messages per second, "
+			"%.3f GB/s\n", payload, payload_modes[payload_mode],
+			messages, messages * payload / 1e9);
+}
+
+static void send_msg (int i, int d, char *body)
+{
+	if (payload > 0)
+		payload_send (i, body);
+	send_to (i, d);
+}
+
+static int recv_msg (int i, char **body)
+{
+	int d = recv_from (i);
+
+	if (payload > 0)
+		*body = payload_recv (i);
+	return d;
+}
+
+static void root (int this)
+{
+	int next = (this + 1) % elements;
+	char *body = payload_first (tokens);
+	int i, sum, token;
+
+	send_msg (next, 1, body);
+	token = recv_msg (this, &body);
+
+	fprintf (stdout, "start\n");
+	fflush (stdout);
+	clock_gettime (CLOCK_MONOTONIC, &(ring_time[0]));
+
+	for (i = 0; i < tokens; ++i)
+		send_msg (next, i + 1, payload_first (i));
+
+	while (cycles > 0) {
+		for (i = 0; i < tokens; ++i) {
+			token = recv_msg (this, &body);
+			send_msg (next, token + 1, body);
+		}
+		cycles--;
+	}
+
+	sum = 0;
+	for (i = 0; i < tokens; ++i)
+		sum += recv_msg (this, &body);
+
+	clock_gettime (CLOCK_MONOTONIC, &(ring_time[1]));
+	fprintf (stdout, "end\n");
+	fflush (stdout);
+
+	fprintf (stdout, "%d\n", sum);
+
+	send_msg (next, 0, payload_first (tokens));
+	token = recv_msg (this, &body);
+
+	pthread_mutex_lock (&idle_lock);
+	__atomic_store_n (&done, 1, __ATOMIC_RELEASE);
+	pthread_cond_broadcast (&idle_cond);
+	pthread_mutex_unlock (&idle_lock);
+}
+
+static void element (int this)
+{
+	int next = (this + 1) % elements;
+	char *body = NULL;
+	int token;
+
+	do {
+		token = recv_msg (this, &body);
+		send_msg (next, token > 0 ? token + 1 : token, body);
+	} while (token);
+}
+
+static void usage (const char *name)
+{
+	fprintf (stderr, "Usage: %s [-w workers] [-k stack_kb] [-z bytes] "
+			"[-x copy|transfer] [cycles [tokens [elements]]]\n",
+			name);
+	exit (EXIT_FAILURE);
+}
+
+int main (int argc, char *argv[])
+{
+	size_t stack_size = STACK_KB * 1024;
+	const char *cores = getenv ("CORES");
+	int i, opt;
+
+	if (cores != NULL && atoi (cores) > 0)
+		num_workers = atoi (cores);
+	while ((opt = getopt (argc, argv, "w:k:z:x:")) != -1) {
+		switch (opt) {
+		case 'w':
+			num_workers = atoi (optarg);
+			break;
+		case 'k':
+			stack_size = (size_t) atol (optarg) * 1024;
+			break;
+		case 'z':
+			payload = (parse_size (optarg) + 7) & ~(size_t) 7;
+			if (payload == 0)
+				usage (argv[0]);
+			break;
+		case 'x':
+			if (strcmp (optarg, "copy") == 0)
+				payload_mode = PAYLOAD_COPY;
+			else if (strcmp (optarg, "transfer") == 0)
+				payload_mode = PAYLOAD_TRANSFER;
+			else
+				usage (argv[0]);
+			break;
+		default:
+			usage (argv[0]);
+		}
+	}
+
+	if (argc - optind >= 1)
+		cycles = atoi (argv[optind]);
+	else
+		cycles = 0;
+	if (argc - optind >= 2)
+		tokens = atoi (argv[optind + 1]);
+	else
+		tokens = 1;
+	if (argc - optind >= 3)
+		elements = atoi (argv[optind + 2]);
+	if (elements < 2 || num_workers < 1 || stack_size < 4096)
+		usage (argv[0]);
+	if (tokens >= elements) {
+		fprintf (stderr, "%s: unbuffered channels need fewer than "
+				"%d tokens\n", argv[0], elements);
+		exit (EXIT_FAILURE);
+	}
+
+	workers = aligned_calloc (num_workers, sizeof (worker_t));
+	queues = aligned_calloc (num_workers, sizeof (queue_t));
+	channel = aligned_calloc (elements, sizeof (channel_t));
+	payload_init ();
+
+	/* Elements are dealt out over the workers, which rebalance by
+	 * stealing once they run.
+	 */
+	for (i = elements - 1; i > 0; --i)
+		spawn (element, i, stack_size);
+	spawn (root, 0, ROOT_STACK_KB * 1024);
+
+	for (i = 0; i < num_workers; ++i) {
+		workers[i].id = i;
+		if (pthread_create (&(workers[i].thread), NULL, worker,
+					&(workers[i])) != 0) {
+			perror ("worker");
+			exit (EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < num_workers; ++i)
+		pthread_join (workers[i].thread, NULL);
+
+	if (payload > 0)
+		payload_report ();
+	return 0;
+}
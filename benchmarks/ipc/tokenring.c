@@ -0,0 +1,577 @@
+/*
+ * Multi-process IPC benchmark
+ *
+ * Author: Sarah Mount <s.mount@wlv.ac.uk>
+ * License: GPL v2
+ * Date: 2014
+ *
+ * The token ring of benchmarks/pthread/tokenring.c, with the same
+ * arguments and output, but with every element in a process of its own.
+ * The root is the process started, so timing it with src/timer covers
+ * the whole ring, and since it reaps every element, their resource use
+ * (context switches included) is counted as well.
+ *
+ * Neighbours are connected by one of these transports, chosen with -t:
+ *
+ *   pipe       an anonymous pipe, one int written per token
+ *   eventfd    an eventfd in semaphore mode, counting tokens sent but not
+ *              yet received, with the tokens themselves in slots of a
+ *              shared mapping
+ *   stream     an AF_UNIX SOCK_STREAM socketpair
+ *   seqpacket  an AF_UNIX SOCK_SEQPACKET socketpair, one packet a token
+ *
+ * -w chooses how an element waits: in a blocking read or write, or with
+ * its descriptors non-blocking, in epoll_wait.
+ *
+ * Every transport buffers, so unlike the one-slot channels of the
+ * pthread ring, a sender does not wait for its token to be taken.
+ *
+ * With -z n, every token carries an n-byte body, where n is at least 8,
+ * rounded up to a multiple of 8, and may end in K or M.  As in the
+ * pthread ring, -x chooses how a body moves:
+ *
+ *   copy      through the transport after its token, so the kernel
+ *             copies it in and out at every hop.  Over eventfd it is
+ *             copied instead into a shared slot beside the token's
+ *   transfer  only the index of a body in a shared pool, one body per
+ *             token, follows the token, and every receiver reads the
+ *             whole of the body it was given
+ *
+ * An element blocked writing a body holds it until the next element
+ * reads, so with bodies, transports other than eventfd need fewer tokens
+ * than elements.  Messages and bytes per second between "start" and
+ * "end" are reported on stderr.
+ *
+ * Usage: tokenring [-t pipe|eventfd|stream|seqpacket] [-w block|epoll]
+ *                  [-z bytes] [-x copy|transfer]
+ *                  [cycles [tokens [elements]]]
+ *
+ * Each element needs two descriptors, all of which the root holds until
+ * every element has been started, so large rings need a large
+ * RLIMIT_NOFILE (ulimit -n).
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ELEMENTS 256
+
+#define TRANSPORT_PIPE		0
+#define TRANSPORT_EVENTFD	1
+#define TRANSPORT_STREAM	2
+#define TRANSPORT_SEQPACKET	3
+
+#define WAIT_BLOCK	0
+#define WAIT_EPOLL	1
+
+#define PAYLOAD_COPY		0
+#define PAYLOAD_TRANSFER	1
+
+/* Bodies are written and read this much at a time, which keeps every
+ * SOCK_SEQPACKET packet within the socket's buffer.
+ */
+#define PAYLOAD_CHUNK	65536
+
+static const char *transport_names[] = {
+	"pipe", "eventfd", "stream", "seqpacket"
+};
+
+static const char *payload_modes[] = { "copy", "transfer" };
+
+static int		transport = TRANSPORT_PIPE;
+static int		wait_mode = WAIT_BLOCK;
+static int		elements = ELEMENTS;
+static int		cycles;
+static int		tokens;
+
+/* Channel i is read by element i and written by element i - 1.  For
+ * eventfd both ends are the same descriptor.
+ */
+static int		*read_fd;
+static int		*write_fd;
+
+/* Token slots of every eventfd channel, and how many each has. */
+static int		*slots;
+static int		slots_per_channel;
+
+/* This process's ends, and what it has moved through them. */
+static int		in_fd, out_fd;
+static int		*in_slots, *out_slots;
+static unsigned long	received, sent;
+static int		in_epoll = -1, out_epoll = -1;
+
+/* Bodies: how big, how they move, the shared pool to transfer from or
+ * this process's copy of the last one received, and for eventfd the body
+ * or pool index beside each token slot.
+ */
+static size_t		payload;
+static int		payload_mode = PAYLOAD_COPY;
+static char		*pool;
+static char		*message;
+static char		*body_slots, *in_bodies, *out_bodies;
+static int		*index_slots, *in_index, *out_index;
+static volatile uint64_t	payload_sink;
+
+static void fail (const char *what)
+{
+	perror (what);
+	exit (EXIT_FAILURE);
+}
+
+/* Wait until fd is ready for events, in epoll mode. */
+static void ready_wait (int epfd)
+{
+	struct epoll_event event;
+
+	while (epoll_wait (epfd, &event, 1, -1) < 0)
+		if (errno != EINTR)
+			fail ("epoll_wait");
+}
+
+/* Move all len bytes, or in epoll mode wait for the descriptor to be
+ * ready whenever it would block.  A stream may move fewer bytes at a
+ * time than were asked for.
+ */
+static void read_all (void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = read (in_fd, p, len);
+		if (n > 0) {
+			p += n;
+			len -= n;
+		} else if (n == 0) {
+			fprintf (stderr, "tokenring: channel closed\n");
+			exit (EXIT_FAILURE);
+		} else if (errno == EAGAIN && wait_mode == WAIT_EPOLL) {
+			ready_wait (in_epoll);
+		} else if (errno != EINTR) {
+			fail ("read");
+		}
+	}
+}
+
+static void write_all (const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write (out_fd, p, len);
+		if (n > 0) {
+			p += n;
+			len -= n;
+		} else if (n < 0 && errno == EAGAIN
+				&& wait_mode == WAIT_EPOLL) {
+			ready_wait (out_epoll);
+		} else if (n < 0 && errno != EINTR) {
+			fail ("write");
+		}
+	}
+}
+
+/* Bytes in s, which may end in K or M, or 0 if it is not a size. */
+static size_t parse_size (const char *s)
+{
+	char *end;
+	long n = strtol (s, &end, 10);
+
+	if (*end == 'K' || *end == 'k')
+		n <<= 10, end++;
+	else if (*end == 'M' || *end == 'm')
+		n <<= 20, end++;
+	return n > 0 && *end == '\0' ? (size_t) n : 0;
+}
+
+/* Read every byte of a transferred body. */
+static char *touch (char *body)
+{
+	const uint64_t *word = (const uint64_t *) body;
+	uint64_t sum = 0;
+	size_t k;
+
+	for (k = 0; k < payload / sizeof (uint64_t); ++k)
+		sum += word[k];
+	payload_sink += sum;
+	return body;
+}
+
+static void send_token (int d, char *body)
+{
+	uint64_t one = 1;
+	int msg[2];
+	size_t s, k;
+
+	if (transport == TRANSPORT_EVENTFD) {
+		s = sent++ % slots_per_channel;
+		if (payload > 0 && payload_mode == PAYLOAD_COPY)
+			memcpy (out_bodies + s * payload, body, payload);
+		else if (payload > 0)
+			out_index[s] = (body - pool) / payload;
+		__atomic_store_n (&(out_slots[s]), d, __ATOMIC_RELEASE);
+		write_all (&one, sizeof (one));
+		return;
+	}
+	msg[0] = d;
+	if (payload > 0 && payload_mode == PAYLOAD_TRANSFER) {
+		msg[1] = (body - pool) / payload;
+		write_all (msg, sizeof (msg));
+		return;
+	}
+	write_all (msg, sizeof (msg[0]));
+	for (k = 0; k < payload; k += PAYLOAD_CHUNK)
+		write_all (body + k, payload - k < PAYLOAD_CHUNK
+				? payload - k : PAYLOAD_CHUNK);
+}
+
+/* Receive a token, and in *body, the body which came with it. */
+static int recv_token (char **body)
+{
+	uint64_t count;
+	int msg[2];
+	size_t s, k;
+
+	if (transport == TRANSPORT_EVENTFD) {
+		read_all (&count, sizeof (count));
+		s = received++ % slots_per_channel;
+		msg[0] = __atomic_load_n (&(in_slots[s]), __ATOMIC_ACQUIRE);
+		if (payload > 0 && payload_mode == PAYLOAD_COPY)
+			*body = in_bodies + s * payload;
+		else if (payload > 0)
+			*body = touch (pool + (size_t) in_index[s] * payload);
+		return msg[0];
+	}
+	if (payload > 0 && payload_mode == PAYLOAD_TRANSFER) {
+		read_all (msg, sizeof (msg));
+		*body = touch (pool + (size_t) msg[1] * payload);
+		return msg[0];
+	}
+	read_all (msg, sizeof (msg[0]));
+	for (k = 0; k < payload; k += PAYLOAD_CHUNK)
+		read_all (message + k, payload - k < PAYLOAD_CHUNK
+				? payload - k : PAYLOAD_CHUNK);
+	*body = message;
+	return msg[0];
+}
+
+/* Body of fresh token i, from 0 to tokens. */
+static char *first_body (int i)
+{
+	if (payload == 0)
+		return NULL;
+	if (payload_mode == PAYLOAD_COPY)
+		return message;
+	return pool + (size_t) i * payload;
+}
+
+/* Zeroed shared memory, faulted in now rather than in the run. */
+static void *shared (size_t size)
+{
+	void *p = mmap (NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED)
+		fail ("shared memory");
+	memset (p, 0, size);
+	return p;
+}
+
+/* Allocate the pool, this process's body, and the eventfd body slots. */
+static void payload_init (void)
+{
+	size_t slots = (size_t) slots_per_channel * elements;
+
+	if (payload == 0)
+		return;
+	if (payload_mode == PAYLOAD_TRANSFER) {
+		pool = shared (((size_t) tokens + 1) * payload);
+		memset (pool, 1, ((size_t) tokens + 1) * payload);
+		if (transport == TRANSPORT_EVENTFD)
+			index_slots = shared (slots * sizeof (int));
+		return;
+	}
+	message = malloc (payload);
+	if (message == NULL)
+		fail ("payload");
+	memset (message, 1, payload);
+	if (transport == TRANSPORT_EVENTFD)
+		body_slots = shared (slots * payload);
+}
+
+/* Create every channel before any element is forked. */
+static void channels_init (void)
+{
+	int fd[2], i;
+
+	read_fd = calloc (elements, sizeof (int));
+	write_fd = calloc (elements, sizeof (int));
+	if (read_fd == NULL || write_fd == NULL)
+		fail ("channels");
+
+	if (transport == TRANSPORT_EVENTFD) {
+		/* At most every token and the one which ends the ring are in
+		 * a channel at once.
+		 */
+		slots_per_channel = tokens + 1;
+		slots = shared (sizeof (int) * slots_per_channel
+				* (size_t) elements);
+	}
+	payload_init ();
+
+	for (i = 0; i < elements; ++i) {
+		switch (transport) {
+		case TRANSPORT_PIPE:
+			if (pipe (fd) != 0)
+				fail ("pipe");
+			break;
+		case TRANSPORT_EVENTFD:
+			fd[0] = fd[1] = eventfd (0, EFD_SEMAPHORE);
+			if (fd[0] < 0)
+				fail ("eventfd");
+			break;
+		default:
+			if (socketpair (AF_UNIX,
+					transport == TRANSPORT_STREAM
+					? SOCK_STREAM : SOCK_SEQPACKET,
+					0, fd) != 0)
+				fail ("socketpair");
+		}
+		read_fd[i] = fd[0];
+		write_fd[i] = fd[1];
+	}
+}
+
+static void watch (int *epfd, int fd, unsigned int events)
+{
+	struct epoll_event event;
+
+	memset (&event, 0, sizeof (event));
+	event.events = events;
+	event.data.fd = fd;
+	*epfd = epoll_create1 (EPOLL_CLOEXEC);
+	if (*epfd < 0 || epoll_ctl (*epfd, EPOLL_CTL_ADD, fd, &event) != 0)
+		fail ("epoll");
+}
+
+/* Keep only the ends of element i's own channels. */
+static void channels_open (int i)
+{
+	int next = (i + 1) % elements, j;
+
+	for (j = 0; j < elements; ++j) {
+		if (j != i && read_fd[j] != write_fd[j])
+			close (read_fd[j]);
+		if (j != next && write_fd[j] != read_fd[j])
+			close (write_fd[j]);
+		if (j != i && j != next && read_fd[j] == write_fd[j])
+			close (read_fd[j]);
+	}
+	in_fd = read_fd[i];
+	out_fd = write_fd[next];
+	in_slots = slots + (size_t) i * slots_per_channel;
+	out_slots = slots + (size_t) next * slots_per_channel;
+	if (body_slots != NULL) {
+		in_bodies = body_slots + (size_t) i * slots_per_channel * payload;
+		out_bodies = body_slots
+			+ (size_t) next * slots_per_channel * payload;
+	}
+	if (index_slots != NULL) {
+		in_index = index_slots + (size_t) i * slots_per_channel;
+		out_index = index_slots + (size_t) next * slots_per_channel;
+	}
+
+	if (wait_mode == WAIT_EPOLL) {
+		fcntl (in_fd, F_SETFL, fcntl (in_fd, F_GETFL) | O_NONBLOCK);
+		fcntl (out_fd, F_SETFL, fcntl (out_fd, F_GETFL) | O_NONBLOCK);
+		watch (&in_epoll, in_fd, EPOLLIN);
+		watch (&out_epoll, out_fd, EPOLLOUT);
+	}
+}
+
+/* When the root printed "start" and "end". */
+static struct timespec	ring_start, ring_end;
+
+static void root (void)
+{
+	char *body = first_body (tokens);
+	int i, sum, token;
+
+	send_token (1, body);
+	token = recv_token (&body);
+
+	fprintf (stdout, "start\n");
+	fflush (stdout);
+	clock_gettime (CLOCK_MONOTONIC, &ring_start);
+
+	for (i = 0; i < tokens; ++i)
+		send_token (i + 1, first_body (i));
+
+	while (cycles > 0) {
+		for (i = 0; i < tokens; ++i) {
+			token = recv_token (&body);
+			send_token (token + 1, body);
+		}
+		cycles--;
+	}
+
+	sum = 0;
+	for (i = 0; i < tokens; ++i)
+		sum += recv_token (&body);
+
+	clock_gettime (CLOCK_MONOTONIC, &ring_end);
+	fprintf (stdout, "end\n");
+	fflush (stdout);
+
+	fprintf (stdout, "%d\n", sum);
+
+	send_token (0, first_body (tokens));
+	token = recv_token (&body);
+}
+
+static void element (void)
+{
+	char *body = NULL;
+	int token;
+
+	do {
+		token = recv_token (&body);
+		send_token (token > 0 ? token + 1 : token, body);
+	} while (token);
+}
+
+/* hops is how many times a token was handed on between start and end. */
+static void payload_report (double hops)
+{
+	double seconds, messages;
+
+	seconds = (ring_end.tv_sec - ring_start.tv_sec)
+		+ (ring_end.tv_nsec - ring_start.tv_nsec) / 1e9;
+	messages = seconds > 0 ? hops / seconds : 0;
+	fprintf (stderr, "payload: %zu bytes by %s over %s, "
+			"%.0f messages per second, %.3f GB/s\n",
+			payload, payload_modes[payload_mode],
+			transport_names[transport], messages,
+			messages * payload / 1e9);
+}
+
+static void usage (const char *name)
+{
+	fprintf (stderr, "Usage: %s [-t pipe|eventfd|stream|seqpacket] "
+			"[-w block|epoll]\n"
+			"\t[-z bytes] [-x copy|transfer] "
+			"[cycles [tokens [elements]]]\n", name);
+	exit (EXIT_FAILURE);
+}
+
+int main (int argc, char *argv[])
+{
+	pid_t *pids;
+	double hops;
+	int i, opt, status, failed = 0;
+
+	while ((opt = getopt (argc, argv, "t:w:z:x:")) != -1) {
+		switch (opt) {
+		case 't':
+			for (transport = TRANSPORT_SEQPACKET;
+					transport >= TRANSPORT_PIPE; --transport)
+				if (strcmp (optarg,
+						transport_names[transport]) == 0)
+					break;
+			if (transport < TRANSPORT_PIPE)
+				usage (argv[0]);
+			break;
+		case 'w':
+			if (strcmp (optarg, "block") == 0)
+				wait_mode = WAIT_BLOCK;
+			else if (strcmp (optarg, "epoll") == 0)
+				wait_mode = WAIT_EPOLL;
+			else
+				usage (argv[0]);
+			break;
+		case 'z':
+			payload = (parse_size (optarg) + 7) & ~(size_t) 7;
+			if (payload == 0)
+				usage (argv[0]);
+			break;
+		case 'x':
+			if (strcmp (optarg, "copy") == 0)
+				payload_mode = PAYLOAD_COPY;
+			else if (strcmp (optarg, "transfer") == 0)
+				payload_mode = PAYLOAD_TRANSFER;
+			else
+				usage (argv[0]);
+			break;
+		default:
+			usage (argv[0]);
+		}
+	}
+
+	if (argc - optind >= 1)
+		cycles = atoi (argv[optind]);
+	else
+		cycles = 0;
+	if (argc - optind >= 2)
+		tokens = atoi (argv[optind + 1]);
+	else
+		tokens = 1;
+	if (argc - optind >= 3)
+		elements = atoi (argv[optind + 2]);
+	if (elements < 2 || tokens < 1)
+		usage (argv[0]);
+	if (payload > 0 && transport != TRANSPORT_EVENTFD
+			&& tokens >= elements) {
+		fprintf (stderr, "%s: bodies over %s need fewer than %d "
+				"tokens\n", argv[0], transport_names[transport],
+				elements);
+		exit (EXIT_FAILURE);
+	}
+	hops = (cycles + 1.0) * tokens * elements;
+
+	channels_init ();
+	pids = calloc (elements, sizeof (pid_t));
+	if (pids == NULL)
+		fail ("elements");
+
+	fflush (stdout);
+	for (i = elements - 1; i > 0; --i) {
+		pids[i] = fork ();
+		if (pids[i] < 0) {
+			perror ("fork");
+			for (++i; i < elements; ++i)
+				kill (pids[i], SIGKILL);
+			exit (EXIT_FAILURE);
+		}
+		if (pids[i] == 0) {
+			channels_open (i);
+			element ();
+			_exit (EXIT_SUCCESS);
+		}
+	}
+
+	channels_open (0);
+	root ();
+
+	for (i = 1; i < elements; ++i)
+		if (waitpid (pids[i], &status, 0) < 0 || status != 0)
+			failed = 1;
+	if (payload > 0)
+		payload_report (hops);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
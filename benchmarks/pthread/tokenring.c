@@ -8,125 +8,1558 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
+/*
+ * Size
+ *
+ * The ring has ELEMENTS threads unless a third argument says otherwise,
+ * and all per-element state is allocated once the size is known.  Each
+ * thread gets the default stack unless -k gives its size in KB.
+ *
+ * Rings of tens of thousands of threads outgrow the default stacks, and
+ * with a mapping and a guard page per stack, the kernel's limit on
+ * mappings too.  -m carves every stack out of one anonymous mapping
+ * instead, with no guard pages between them, so keep -k generous.  -f
+ * faults every stack page in before the ring starts, so that first
+ * touches are not timed; it implies -m.
+ */
 #define ELEMENTS 256
 
-static pthread_t	thread[ELEMENTS];
-static pthread_mutex_t	mutex[ELEMENTS];
-static pthread_cond_t	cond[ELEMENTS];
-static volatile int	full[ELEMENTS];
-static volatile int	data[ELEMENTS];
+/* Default stack size for -m, in KB. */
+#define ARENA_STACK_KB	64
+
+#define CACHE_LINE	64
+
+static int		elements = ELEMENTS;
+
+/* Zeroed memory for n things, starting on a cache line. */
+static void *aligned_calloc (size_t n, size_t size)
+{
+	void *p;
+
+	if (posix_memalign (&p, CACHE_LINE, n * size) != 0) {
+		perror ("ring state");
+		exit (EXIT_FAILURE);
+	}
+	memset (p, 0, n * size);
+	return p;
+}
+
+/*
+ * Processes
+ *
+ * With -P every element is a process rather than a thread, forked from
+ * main, which waits for them all.  Whatever the elements share, from
+ * channels to statistics and trace buffers, is carved a cache line at a
+ * time out of one MAP_SHARED mapping, made before the first fork.  Its
+ * SHARED_ARENA_MB, plus room for any payload, are only address space
+ * until they are allocated.
+ * Mutexes and condition variables are then PTHREAD_PROCESS_SHARED and
+ * futexes are not private, but otherwise every -c channel runs the same
+ * code as it does between threads, so the two can be compared directly.
+ * The state of every channel, of whichever kind, is padded to cache lines
+ * of its own in the arena, so that no kind false-shares between
+ * processes where another does not.
+ * Stacks are the processes' own, so -k, -m and -f do not apply.
+ */
+#define SHARED_ARENA_MB	1024
+
+static int		processes;
+static pid_t		*pid;
+static char		*shared_arena;
+static size_t		shared_size;
+static size_t		shared_used;
+
+/* Reserve SHARED_ARENA_MB, and extra bytes for large buffers. */
+static void shared_init (size_t extra)
+{
+	if (!processes)
+		return;
+	shared_size = ((size_t) SHARED_ARENA_MB << 20) + extra;
+	shared_arena = mmap (NULL, shared_size,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (shared_arena == MAP_FAILED) {
+		perror ("shared memory");
+		exit (EXIT_FAILURE);
+	}
+}
+
+/* As aligned_calloc, but with -P, visible to every element.  Everything
+ * shared must be allocated before the elements are forked.
+ */
+static void *shared_calloc (size_t n, size_t size)
+{
+	size_t bytes = (n * size + CACHE_LINE - 1) & ~(size_t) (CACHE_LINE - 1);
+	void *p;
+
+	if (!processes)
+		return aligned_calloc (n, size);
+	if (bytes > shared_size - shared_used) {
+		fprintf (stderr, "shared memory: more than %zu MB needed\n",
+				shared_size >> 20);
+		exit (EXIT_FAILURE);
+	}
+	p = shared_arena + shared_used;
+	shared_used += bytes;
+	/* Faulted in now, as aligned_calloc's memory is. */
+	memset (p, 0, bytes);
+	return p;
+}
+
+/*
+ * Tracing
+ *
+ * Built with -DTRACE, every handoff is timestamped into buffers which
+ * each thread owns outright, so recording needs no locks or atomics.
+ * The buffers are allocated and touched before the ring starts, and are
+ * written out when it finishes, as described in src/ring_trace.h.
+ * src/ringtrace turns the dump into wakeup-latency histograms and
+ * per-element stall reports.
+ *
+ * Environment:
+ *   TOKENRING_TRACE         file to dump to (default tokenring.trace)
+ *   TOKENRING_TRACE_EVENTS  events each element keeps in each direction
+ */
+#ifdef TRACE
+
+#include <stdint.h>
+#include <time.h>
+
+#include "ring_trace.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_CLOCK RING_TRACE_CLOCK_TSC
+#else
+#define TRACE_CLOCK RING_TRACE_CLOCK_RAW
+#endif
+
+#define TRACE_FILE		"tokenring.trace"
+#define TRACE_EVENTS		4096
+#define TRACE_CALIBRATION	1000000
+#define TRACE_SCRATCH		1024
+
+typedef struct {
+	ring_trace_event_t	*event;
+	uint32_t		count;
+	uint32_t		capacity;
+	uint32_t		dropped;
+} __attribute__ ((aligned (64))) trace_buffer_t;
+
+static trace_buffer_t	*trace_send;
+static trace_buffer_t	*trace_recv;
+static __thread int	trace_self;
+static double		trace_ticks_per_ns = 1.0;
+static double		trace_overhead_ns;
+
+static inline uint64_t trace_now (void)
+{
+#if TRACE_CLOCK == RING_TRACE_CLOCK_TSC
+	return __rdtsc ();
+#else
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline void trace_record (trace_buffer_t *b, uint64_t begin,
+		uint64_t end)
+{
+	if (b->count < b->capacity) {
+		b->event[b->count].begin = begin;
+		b->event[b->count].end = end;
+		b->count++;
+	} else {
+		b->dropped++;
+	}
+}
+
+#define TRACE_BEGIN(t)	uint64_t t = trace_now ();
+#define TRACE_SEND(t)	trace_record (&(trace_send[trace_self]), t, trace_now ());
+#define TRACE_RECV(t)	trace_record (&(trace_recv[trace_self]), t, trace_now ());
+#define TRACE_THREAD(n)	trace_self = (n);
+
+static uint64_t raw_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void trace_alloc (trace_buffer_t *b, uint32_t capacity)
+{
+	/* Zeroed, so every page is faulted in now rather than in the run. */
+	b->event = shared_calloc (capacity, sizeof (ring_trace_event_t));
+	b->capacity = capacity;
+	b->count = b->dropped = 0;
+}
+
+static void trace_init (void)
+{
+	struct timespec pause = { 0, 20000000 };
+	ring_trace_event_t scratch[TRACE_SCRATCH];
+	trace_buffer_t b;
+	uint64_t t0, t1, c0, c1;
+	const char *env;
+	uint32_t capacity = TRACE_EVENTS;
+	int i;
+
+	env = getenv ("TOKENRING_TRACE_EVENTS");
+	if (env != NULL && atoi (env) > 0)
+		capacity = atoi (env);
+	trace_send = shared_calloc (elements, sizeof (trace_buffer_t));
+	trace_recv = shared_calloc (elements, sizeof (trace_buffer_t));
+	for (i = 0; i < elements; ++i) {
+		trace_alloc (&(trace_send[i]), capacity);
+		trace_alloc (&(trace_recv[i]), capacity);
+	}
+
+	/* How fast does the clock tick? */
+	t0 = raw_ns ();
+	c0 = trace_now ();
+	nanosleep (&pause, NULL);
+	t1 = raw_ns ();
+	c1 = trace_now ();
+	trace_ticks_per_ns = (double) (c1 - c0) / (double) (t1 - t0);
+
+	/* What does recording one event cost? */
+	b.event = scratch;
+	b.capacity = TRACE_SCRATCH;
+	b.count = b.dropped = 0;
+	t0 = raw_ns ();
+	for (i = 0; i < TRACE_CALIBRATION; ++i) {
+		TRACE_BEGIN (t)
+		if (b.count == TRACE_SCRATCH)
+			b.count = 0;
+		trace_record (&b, t, trace_now ());
+	}
+	t1 = raw_ns ();
+	trace_overhead_ns = (double) (t1 - t0) / TRACE_CALIBRATION;
+}
+
+static void trace_dump (void)
+{
+	ring_trace_header_t header;
+	ring_trace_thread_t thread;
+	const char *file = getenv ("TOKENRING_TRACE");
+	unsigned long events = 0, dropped = 0;
+	FILE *fp;
+	int i;
+
+	if (file == NULL)
+		file = TRACE_FILE;
+	fp = fopen (file, "wb");
+	if (fp == NULL) {
+		perror (file);
+		return;
+	}
+
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, RING_TRACE_MAGIC, sizeof (header.magic));
+	header.version = RING_TRACE_VERSION;
+	header.elements = elements;
+	header.clock = TRACE_CLOCK;
+	header.capacity = trace_send[0].capacity;
+	header.ticks_per_ns = trace_ticks_per_ns;
+	header.overhead_ns = trace_overhead_ns;
+	fwrite (&header, sizeof (header), 1, fp);
+
+	for (i = 0; i < elements; ++i) {
+		memset (&thread, 0, sizeof (thread));
+		thread.sends = trace_send[i].count;
+		thread.recvs = trace_recv[i].count;
+		thread.dropped = trace_send[i].dropped + trace_recv[i].dropped;
+		fwrite (&thread, sizeof (thread), 1, fp);
+		fwrite (trace_send[i].event, sizeof (ring_trace_event_t),
+				thread.sends, fp);
+		fwrite (trace_recv[i].event, sizeof (ring_trace_event_t),
+				thread.recvs, fp);
+		events += thread.sends + thread.recvs;
+		dropped += thread.dropped;
+	}
+	fclose (fp);
+
+	/* stdout belongs to the benchmark, so report on stderr. */
+	fprintf (stderr, "trace: %lu events written to %s, %lu dropped; "
+			"%.1f ns overhead per event\n",
+			events, file, dropped, trace_overhead_ns);
+}
+
+#else
+
+#define TRACE_BEGIN(t)
+#define TRACE_SEND(t)
+#define TRACE_RECV(t)
+#define TRACE_THREAD(n)
+
+#endif /* TRACE */
+
+/*
+ * Channels
+ *
+ * Element i receives on channel i, which only element i - 1 sends on.
+ * Three implementations of a channel are built in:
+ *
+ *   mutex  a mutex, condition variable and one-slot buffer, as in the
+ *          original benchmark but on cache lines of their own
+ *   spsc   a lock-free single-producer single-consumer ring buffer of
+ *          SPSC_SLOTS slots, with each end of each channel on cache
+ *          lines of its own
+ *   futex  an unbuffered rendezvous on a futex word, in which a sender
+ *          finding the receiver already waiting hands the token straight
+ *          to it with a single wake, and otherwise waits for it
+ *
+ * With one slot, the default, mutex and spsc block a sender until the
+ * previous token has been received, so they carry tokens identically.
+ * A rendezvous holds no tokens itself, so futex needs fewer tokens than
+ * elements.
+ *
+ * The default is CHANNEL, which can be changed with e.g.
+ * -DCHANNEL=CHANNEL_SPSC, and -c chooses at run time.  An spsc end which
+ * has to wait spins SPSC_SPINS times, then yields SPSC_YIELDS times,
+ * then parks on a futex until the other end wakes it; -s and -y override
+ * the spins and yields.  A futex end spins adaptively, as glibc's
+ * adaptive mutexes do: up to twice the average of its recent spins plus
+ * a little, but never more than FUTEX_SPINS or -s, then parks.  With a
+ * single CPU the other end cannot run while this one spins, so unless -s
+ * is given there are no spins.
+ */
+#define CHANNEL_MUTEX	0
+#define CHANNEL_SPSC	1
+#define CHANNEL_FUTEX	2
+
+#ifndef CHANNEL
+#define CHANNEL		CHANNEL_MUTEX
+#endif
+
+/* Must be a power of two. */
+#ifndef SPSC_SLOTS
+#define SPSC_SLOTS	1
+#endif
+
+#ifndef SPSC_SPINS
+#define SPSC_SPINS	1000
+#endif
+
+#ifndef SPSC_YIELDS
+#define SPSC_YIELDS	10
+#endif
+
+#ifndef FUTEX_SPINS
+#define FUTEX_SPINS	100
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax()	__builtin_ia32_pause ()
+#elif defined(__aarch64__)
+#define cpu_relax()	__asm__ __volatile__ ("yield" ::: "memory")
+#else
+#define cpu_relax()	__asm__ __volatile__ ("" ::: "memory")
+#endif
+
+/* The slots are written by the sender alongside the tail, so the line
+ * the receiver pulls over to see a new token carries the token too.
+ */
+typedef struct {
+	/* Written by the sender. */
+	unsigned int	tail __attribute__ ((aligned (CACHE_LINE)));
+	int		sender_parked;
+	int		slot[SPSC_SLOTS];
+	/* Written by the receiver. */
+	unsigned int	head __attribute__ ((aligned (CACHE_LINE)));
+	int		receiver_parked;
+} __attribute__ ((aligned (CACHE_LINE))) spsc_t;
+
+/* States of a rendezvous, any of which but EMPTY may have PARKED set when
+ * the end waiting for it to change is asleep.
+ */
+#define RV_EMPTY	0
+#define RV_RECEIVER	1	/* Receiver waiting for a sender. */
+#define RV_SENDER	2	/* Token waiting for a receiver. */
+#define RV_HANDED	3	/* Token handed to a waiting receiver. */
+#define RV_PARKED	4
+
+/* One end of a rendezvous: its spin budget and how its waits ended. */
+typedef struct {
+	int		budget;
+	long		immediate;	/* No wait was needed. */
+	long		spun;		/* Waited by spinning. */
+	long		parked;		/* Waited asleep. */
+} __attribute__ ((aligned (CACHE_LINE))) rv_end_t;
+
+typedef struct {
+	unsigned int	state;
+	int		data;
+	rv_end_t	sender;
+	rv_end_t	receiver;
+} __attribute__ ((aligned (CACHE_LINE))) rendezvous_t;
+
+/* Both ends lock the mutex to touch the rest, so one line is shared by
+ * design, but no channel shares a line with its neighbours.
+ */
+typedef struct {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	volatile int	full;
+	volatile int	data;
+} __attribute__ ((aligned (CACHE_LINE))) locked_t;
+
+static pthread_t	*thread;
+static locked_t		*locked;
+static spsc_t		*spsc;
+static rendezvous_t	*rendezvous;
+
+static int		channel = CHANNEL;
+static int		max_spins = -1;
+static int		spsc_yields = SPSC_YIELDS;
 
 static int		cycles;
 static int		tokens;
 
+static char		*stack_arena;
+static size_t		stack_arena_size;
+
+static void mutex_send (int i, int d)
+{
+	TRACE_BEGIN (t)
+	pthread_mutex_lock (&(locked[i].mutex));
+	while (locked[i].full)
+		pthread_cond_wait (&(locked[i].cond), &(locked[i].mutex));
+	locked[i].full = 1;
+	locked[i].data = d;
+	TRACE_SEND (t)
+	pthread_cond_signal (&(locked[i].cond));
+	pthread_mutex_unlock (&(locked[i].mutex));
+}
+
+static int mutex_recv (int i)
+{
+	int d;
+	TRACE_BEGIN (t)
+	pthread_mutex_lock (&(locked[i].mutex));
+	while (!locked[i].full)
+		pthread_cond_wait (&(locked[i].cond), &(locked[i].mutex));
+	locked[i].full = 0;
+	d = locked[i].data;
+	TRACE_RECV (t)
+	pthread_cond_signal (&(locked[i].cond));
+	pthread_mutex_unlock (&(locked[i].mutex));
+	return d;
+}
+
+/* Sleep while *word is still seen.  Without futexes, just yield. */
+static void park (unsigned int *word, unsigned int seen)
+{
+#ifdef __linux__
+	syscall (SYS_futex, word, processes ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE,
+			seen, NULL, NULL, 0);
+#else
+	sched_yield ();
+#endif
+}
+
+static void unpark (unsigned int *word)
+{
+#ifdef __linux__
+	syscall (SYS_futex, word, processes ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE,
+			1, NULL, NULL, 0);
+#endif
+}
+
+/* Wait until *word is no longer seen.  The flag parked is raised before
+ * the last look at *word, and the other end looks at the flag after it
+ * changes *word, so one of them always sees the other: either the
+ * waiter sees the change, or the other end sees the flag and wakes it.
+ */
+static void spsc_wait (unsigned int *word, unsigned int seen, int *parked)
+{
+	int i;
+
+	for (i = 0; i < max_spins; ++i) {
+		if (__atomic_load_n (word, __ATOMIC_ACQUIRE) != seen)
+			return;
+		cpu_relax ();
+	}
+	for (i = 0; i < spsc_yields; ++i) {
+		if (__atomic_load_n (word, __ATOMIC_ACQUIRE) != seen)
+			return;
+		sched_yield ();
+	}
+	for (;;) {
+		__atomic_store_n (parked, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n (word, __ATOMIC_SEQ_CST) != seen)
+			break;
+		park (word, seen);
+	}
+	__atomic_store_n (parked, 0, __ATOMIC_RELAXED);
+}
+
+/* Wake the other end if it is parked on word. */
+static inline void spsc_wake (unsigned int *word, int *parked)
+{
+	if (__atomic_load_n (parked, __ATOMIC_SEQ_CST)
+			&& __atomic_exchange_n (parked, 0, __ATOMIC_SEQ_CST))
+		unpark (word);
+}
+
+static void spsc_send (spsc_t *c, int d)
+{
+	unsigned int tail = __atomic_load_n (&(c->tail), __ATOMIC_RELAXED);
+	unsigned int head;
+	TRACE_BEGIN (t)
+
+	while (tail - (head = __atomic_load_n (&(c->head), __ATOMIC_ACQUIRE))
+			>= SPSC_SLOTS)
+		spsc_wait (&(c->head), head, &(c->sender_parked));
+	c->slot[tail & (SPSC_SLOTS - 1)] = d;
+	__atomic_store_n (&(c->tail), tail + 1, __ATOMIC_SEQ_CST);
+	TRACE_SEND (t)
+	spsc_wake (&(c->tail), &(c->receiver_parked));
+}
+
+static int spsc_recv (spsc_t *c)
+{
+	unsigned int head = __atomic_load_n (&(c->head), __ATOMIC_RELAXED);
+	unsigned int tail;
+	int d;
+	TRACE_BEGIN (t)
+
+	while ((tail = __atomic_load_n (&(c->tail), __ATOMIC_ACQUIRE)) == head)
+		spsc_wait (&(c->tail), tail, &(c->receiver_parked));
+	d = c->slot[head & (SPSC_SLOTS - 1)];
+	__atomic_store_n (&(c->head), head + 1, __ATOMIC_SEQ_CST);
+	TRACE_RECV (t)
+	spsc_wake (&(c->head), &(c->sender_parked));
+	return d;
+}
+
+/* Wait while a rendezvous is in state, spinning for as long as the
+ * budget of this end allows, then parking.  The budget moves an eighth
+ * of the way towards the spins this wait took, or would have taken.
+ */
+static void rv_wait (rendezvous_t *c, unsigned int state, rv_end_t *end)
+{
+	int limit = end->budget * 2 + 10, i;
+	unsigned int s;
+
+	if (limit > max_spins)
+		limit = max_spins;
+	for (i = 0; i < limit; ++i) {
+		s = __atomic_load_n (&(c->state), __ATOMIC_ACQUIRE);
+		if ((s & ~RV_PARKED) != state) {
+			end->spun++;
+			end->budget += (i - end->budget) / 8;
+			return;
+		}
+		cpu_relax ();
+	}
+
+	end->parked++;
+	end->budget += (limit - end->budget) / 8;
+	s = __atomic_load_n (&(c->state), __ATOMIC_ACQUIRE);
+	while ((s & ~RV_PARKED) == state) {
+		if (s & RV_PARKED
+				|| __atomic_compare_exchange_n (&(c->state), &s,
+					state | RV_PARKED, 0, __ATOMIC_ACQUIRE,
+					__ATOMIC_ACQUIRE))
+			park (&(c->state), state | RV_PARKED);
+		s = __atomic_load_n (&(c->state), __ATOMIC_ACQUIRE);
+	}
+}
+
+/* Move a rendezvous to state, waking the other end if it is asleep. */
+static inline void rv_set (rendezvous_t *c, unsigned int state)
+{
+	if (__atomic_exchange_n (&(c->state), state, __ATOMIC_ACQ_REL)
+			& RV_PARKED)
+		unpark (&(c->state));
+}
+
+static void rv_send (rendezvous_t *c, int d)
+{
+	unsigned int s = __atomic_load_n (&(c->state), __ATOMIC_ACQUIRE);
+	int waited = 0;
+	TRACE_BEGIN (t)
+
+	for (;;) {
+		/* The last token handed over has not been picked up yet. */
+		if ((s & ~RV_PARKED) == RV_HANDED) {
+			rv_wait (c, RV_HANDED, &(c->sender));
+			waited = 1;
+			s = __atomic_load_n (&(c->state), __ATOMIC_ACQUIRE);
+			continue;
+		}
+		/* Only this end moves the state on from EMPTY or RECEIVER,
+		 * so the token can be written before it is published.
+		 */
+		c->data = d;
+		if ((s & ~RV_PARKED) == RV_RECEIVER) {
+			rv_set (c, RV_HANDED);
+			break;
+		}
+		if (__atomic_compare_exchange_n (&(c->state), &s, RV_SENDER, 0,
+					__ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+			rv_wait (c, RV_SENDER, &(c->sender));
+			waited = 1;
+			break;
+		}
+	}
+	if (!waited)
+		c->sender.immediate++;
+	TRACE_SEND (t)
+}
+
+static int rv_recv (rendezvous_t *c)
+{
+	unsigned int s = __atomic_load_n (&(c->state), __ATOMIC_ACQUIRE);
+	int d;
+	TRACE_BEGIN (t)
+
+	for (;;) {
+		if ((s & ~RV_PARKED) == RV_SENDER) {
+			d = c->data;
+			c->receiver.immediate++;
+			break;
+		}
+		if (__atomic_compare_exchange_n (&(c->state), &s, RV_RECEIVER,
+					0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+			rv_wait (c, RV_RECEIVER, &(c->receiver));
+			d = c->data;
+			break;
+		}
+	}
+	rv_set (c, RV_EMPTY);
+	TRACE_RECV (t)
+	return d;
+}
+
+/* How the waits of every rendezvous ended, on stderr as stdout belongs
+ * to the benchmark.
+ */
+static void rv_report (void)
+{
+	long immediate = 0, spun = 0, parked = 0;
+	int i;
+
+	for (i = 0; i < elements; ++i) {
+		immediate += rendezvous[i].sender.immediate
+			+ rendezvous[i].receiver.immediate;
+		spun += rendezvous[i].sender.spun + rendezvous[i].receiver.spun;
+		parked += rendezvous[i].sender.parked
+			+ rendezvous[i].receiver.parked;
+	}
+	fprintf (stderr, "futex: %ld handoffs without waiting, "
+			"%ld waits ended spinning, %ld parked (%.1f%%)\n",
+			immediate, spun, parked,
+			spun + parked > 0 ? 100.0 * parked / (spun + parked) : 0);
+}
+
+/*
+ * Batching
+ *
+ * With -b n, a mutex channel holds up to n tokens instead of one.  An
+ * element takes every token waiting on its input, up to n, under one
+ * lock acquisition, and forwards them all under another with a single
+ * signal.  Tokens keep their order and the root still forwards exactly
+ * tokens tokens a cycle, so the checksum is unchanged.  The mean batch
+ * actually received and the rate of token hops between "start" and
+ * "end" are reported on stderr.  Batched handoffs are not traced.
+ */
+typedef struct {
+	long	handoffs;
+	long	tokens;
+} __attribute__ ((aligned (CACHE_LINE))) batch_stats_t;
+
+static int		max_batch;	/* 0 for one token at a time. */
+static int		*batch_buffer;
+static int		*batch_head;
+static batch_stats_t	*batch_stats;
+/* When the root printed "start" and "end", shared. */
+static struct timespec	*ring_time;
+
+static void batch_send (int i, const int *d, int n)
+{
+	int *buffer = batch_buffer + (size_t) i * max_batch;
+	int k;
+
+	pthread_mutex_lock (&(locked[i].mutex));
+	while (locked[i].full + n > max_batch)
+		pthread_cond_wait (&(locked[i].cond), &(locked[i].mutex));
+	for (k = 0; k < n; ++k)
+		buffer[(batch_head[i] + locked[i].full + k) % max_batch] = d[k];
+	locked[i].full += n;
+	pthread_cond_signal (&(locked[i].cond));
+	pthread_mutex_unlock (&(locked[i].mutex));
+}
+
+/* Receive between one and max tokens into d, returning how many. */
+static int batch_recv (int i, int *d, int max)
+{
+	int *buffer = batch_buffer + (size_t) i * max_batch;
+	int k, n;
+
+	pthread_mutex_lock (&(locked[i].mutex));
+	while (!locked[i].full)
+		pthread_cond_wait (&(locked[i].cond), &(locked[i].mutex));
+	n = locked[i].full < max ? locked[i].full : max;
+	for (k = 0; k < n; ++k)
+		d[k] = buffer[(batch_head[i] + k) % max_batch];
+	batch_head[i] = (batch_head[i] + n) % max_batch;
+	locked[i].full -= n;
+	pthread_cond_signal (&(locked[i].cond));
+	pthread_mutex_unlock (&(locked[i].mutex));
+
+	batch_stats[i].handoffs++;
+	batch_stats[i].tokens += n;
+	return n;
+}
+
+static void batch_report (void)
+{
+	long handoffs = 0, moved = 0;
+	double seconds;
+	int i;
+
+	for (i = 0; i < elements; ++i) {
+		handoffs += batch_stats[i].handoffs;
+		moved += batch_stats[i].tokens;
+	}
+	seconds = (ring_time[1].tv_sec - ring_time[0].tv_sec)
+		+ (ring_time[1].tv_nsec - ring_time[0].tv_nsec) / 1e9;
+	/* Every token makes cycles + 1 laps between start and end. */
+	fprintf (stderr, "batch: %.2f tokens per handoff (at most %d), "
+			"%.0f token hops per second\n",
+			handoffs > 0 ? (double) moved / handoffs : 0, max_batch,
+			seconds > 0 ? (cycles + 1.0) * tokens * elements / seconds
+			: 0);
+}
+
 static void send_to (int i, int d)
 {
-	pthread_mutex_lock (&(mutex[i]));
-	while (full[i])
-		pthread_cond_wait (&(cond[i]), &(mutex[i]));
-	full[i] = 1;
-	data[i] = d;
-	pthread_cond_signal (&(cond[i]));
-	pthread_mutex_unlock (&(mutex[i]));
+	if (channel == CHANNEL_SPSC)
+		spsc_send (&(spsc[i]), d);
+	else if (channel == CHANNEL_FUTEX)
+		rv_send (&(rendezvous[i]), d);
+	else
+		mutex_send (i, d);
 }
 
 static int recv_from (int i)
 {
-	int d;
-	pthread_mutex_lock (&(mutex[i]));
-	while (!full[i])
-		pthread_cond_wait (&(cond[i]), &(mutex[i]));
-	full[i] = 0;
-	d = data[i];
-	pthread_cond_signal (&(cond[i]));
-	pthread_mutex_unlock (&(mutex[i]));
+	if (channel == CHANNEL_SPSC)
+		return spsc_recv (&(spsc[i]));
+	if (channel == CHANNEL_FUTEX)
+		return rv_recv (&(rendezvous[i]));
+	return mutex_recv (i);
+}
+
+/*
+ * Payload
+ *
+ * With -z n, every token carries an n-byte body, where n is at least 8,
+ * is rounded up to a multiple of 8 and may end in K or M.  -x chooses
+ * how bodies move:
+ *
+ *   copy      each element copies the body from the slot it arrived in
+ *             into a slot of the next channel, so every hop reads and
+ *             writes n bytes
+ *   transfer  bodies come from a pool, one per token, allocated before
+ *             the ring starts.  Only a pointer is handed on, and every
+ *             receiver reads the whole of the body it was given
+ *
+ * A body travels beside its token, in one of PAYLOAD_SLOTS slots per
+ * channel, which are used in turn.  Written before the token is sent and
+ * read after it is received, it is ordered by the channel like the token
+ * is.  A channel holds at most SPSC_SLOTS tokens, and its receiver may
+ * still be reading the body of one more, so the slot after those is
+ * always free for the sender.  Messages and bytes per second between
+ * "start" and "end" are reported on stderr.  Batches carry no bodies.
+ */
+#define PAYLOAD_COPY		0
+#define PAYLOAD_TRANSFER	1
+
+#define PAYLOAD_SLOTS		(SPSC_SLOTS + 2)
+
+static const char *payload_modes[] = { "copy", "transfer" };
+
+static size_t		payload;	/* 0 for bare tokens. */
+static int		payload_mode = PAYLOAD_COPY;
+static char		*payload_body;	/* Slots of every channel, to copy. */
+static char		**payload_ptr;	/* Slots of every channel, to transfer. */
+static char		*payload_pool;	/* A body per token, to transfer. */
+static char		*payload_source; /* What the root copies out. */
+static double		payload_hops;
+static volatile uint64_t	payload_sink;
+static __thread unsigned long	payload_sent, payload_received;
+
+/* Bytes in s, which may end in K or M, or 0 if it is not a size. */
+static size_t parse_size (const char *s)
+{
+	char *end;
+	long n = strtol (s, &end, 10);
+
+	if (*end == 'K' || *end == 'k')
+		n <<= 10, end++;
+	else if (*end == 'M' || *end == 'm')
+		n <<= 20, end++;
+	return n > 0 && *end == '\0' ? (size_t) n : 0;
+}
+
+/* Allocate slots and bodies, and touch them all now rather than in the
+ * run.  Everything but the root's source is shared.
+ */
+static void payload_init (void)
+{
+	size_t slots = (size_t) elements * PAYLOAD_SLOTS;
+
+	if (payload == 0)
+		return;
+	if (payload_mode == PAYLOAD_COPY) {
+		payload_body = shared_calloc (slots, payload);
+		payload_source = aligned_calloc (1, payload);
+		memset (payload_source, 1, payload);
+	} else {
+		payload_ptr = shared_calloc (slots, sizeof (char *));
+		payload_pool = shared_calloc ((size_t) tokens + 1, payload);
+		memset (payload_pool, 1, ((size_t) tokens + 1) * payload);
+	}
+	payload_hops = (cycles + 1.0) * tokens * elements;
+}
+
+/* Shared memory wanted by payload_init. */
+static size_t payload_shared_size (void)
+{
+	size_t slots = (size_t) elements * PAYLOAD_SLOTS;
+
+	if (payload == 0)
+		return 0;
+	if (payload_mode == PAYLOAD_COPY)
+		return slots * payload + CACHE_LINE;
+	return slots * sizeof (char *) + ((size_t) tokens + 1) * payload
+		+ 2 * CACHE_LINE;
+}
+
+/* Body of fresh token i, from 0 to tokens. */
+static char *payload_first (int i)
+{
+	if (payload == 0)
+		return NULL;
+	if (payload_mode == PAYLOAD_COPY)
+		return payload_source;
+	return payload_pool + (size_t) i * payload;
+}
+
+/* Pass body on with the token about to be sent on channel i. */
+static void payload_send (int i, char *body)
+{
+	size_t slot = (size_t) i * PAYLOAD_SLOTS
+		+ payload_sent++ % PAYLOAD_SLOTS;
+
+	if (payload_mode == PAYLOAD_COPY)
+		memcpy (payload_body + slot * payload, body, payload);
+	else
+		payload_ptr[slot] = body;
+}
+
+/* The body of the token just received on channel i. */
+static char *payload_recv (int i)
+{
+	size_t slot = (size_t) i * PAYLOAD_SLOTS
+		+ payload_received++ % PAYLOAD_SLOTS;
+	const uint64_t *word;
+	uint64_t sum = 0;
+	size_t k;
+
+	if (payload_mode == PAYLOAD_COPY)
+		return payload_body + slot * payload;
+	word = (const uint64_t *) payload_ptr[slot];
+	for (k = 0; k < payload / sizeof (uint64_t); ++k)
+		sum += word[k];
+	payload_sink += sum;
+	return payload_ptr[slot];
+}
+
+static void payload_report (void)
+{
+	double seconds, messages;
+
+	seconds = (ring_time[1].tv_sec - ring_time[0].tv_sec)
+		+ (ring_time[1].tv_nsec - ring_time[0].tv_nsec) / 1e9;
+	messages = seconds > 0 ? payload_hops / seconds : 0;
+	fprintf (stderr, "payload: %zu bytes by %s, %.0f messages per second, "
+			"%.3f GB/s\n", payload, payload_modes[payload_mode],
+			messages, messages * payload / 1e9);
+}
+
+static void send_msg (int i, int d, char *body)
+{
+	if (payload > 0)
+		payload_send (i, body);
+	send_to (i, d);
+}
+
+static int recv_msg (int i, char **body)
+{
+	int d = recv_from (i);
+
+	if (payload > 0)
+		*body = payload_recv (i);
 	return d;
 }
 
 static void *root (void *n)
 {
-	int this = (int) n;
-	int next = (this + 1) % ELEMENTS;
+	int this = (int) (intptr_t) n;
+	int next = (this + 1) % elements;
+	char *body = payload_first (tokens);
 	int i, sum, token;
 
-	send_to (next, 1);
-	token = recv_from (this);
+	TRACE_THREAD (this)
+	send_msg (next, 1, body);
+	token = recv_msg (this, &body);
 
 	fprintf (stdout, "start\n");
 	fflush (stdout);
+	clock_gettime (CLOCK_MONOTONIC, &(ring_time[0]));
 
 	for (i = 0; i < tokens; ++i)
-		send_to (next, i + 1);
+		send_msg (next, i + 1, payload_first (i));
 
 	while (cycles > 0) {
 		for (i = 0; i < tokens; ++i) {
-			token = recv_from (this);
-			send_to (next, token + 1);
+			token = recv_msg (this, &body);
+			send_msg (next, token + 1, body);
 		}
 		cycles--;
 	}
 
 	sum = 0;
 	for (i = 0; i < tokens; ++i)
-		sum += recv_from (this);
+		sum += recv_msg (this, &body);
 
+	clock_gettime (CLOCK_MONOTONIC, &(ring_time[1]));
 	fprintf (stdout, "end\n");
 	fflush (stdout);
 
 	fprintf (stdout, "%d\n", sum);
 
-	send_to (next, 0);
-	token = recv_from (this);
+	send_msg (next, 0, payload_first (tokens));
+	token = recv_msg (this, &body);
 
 	return NULL;
 }
 
 static void *element (void *n)
 {
-	int this = (int) n;
-	int next = (this + 1) % ELEMENTS;
+	int this = (int) (intptr_t) n;
+	int next = (this + 1) % elements;
+	char *body = NULL;
 	int token;
 
+	TRACE_THREAD (this)
 	do {
-		token = recv_from (this);
-		send_to (next, token > 0 ? token + 1 : token);
+		token = recv_msg (this, &body);
+		send_msg (next, token > 0 ? token + 1 : token, body);
 	} while (token);
 
 	return NULL;
 }
 
-int main (int argc, char *argv[])
+/* As root, but moving as many tokens at once as are waiting. */
+static void *batch_root (void *n)
 {
+	int this = (int) (intptr_t) n;
+	int next = (this + 1) % elements;
+	int *token = aligned_calloc (max_batch, sizeof (int));
+	long remaining;
+	int i, k, moved, sum;
+
+	token[0] = 1;
+	batch_send (next, token, 1);
+	batch_recv (this, token, 1);
+
+	fprintf (stdout, "start\n");
+	fflush (stdout);
+	clock_gettime (CLOCK_MONOTONIC, &(ring_time[0]));
+
+	for (i = 0; i < tokens; i += moved) {
+		moved = tokens - i < max_batch ? tokens - i : max_batch;
+		for (k = 0; k < moved; ++k)
+			token[k] = i + k + 1;
+		batch_send (next, token, moved);
+	}
+
+	for (remaining = (long) cycles * tokens; remaining > 0;
+			remaining -= moved) {
+		moved = batch_recv (this, token, remaining < max_batch
+				? (int) remaining : max_batch);
+		for (k = 0; k < moved; ++k)
+			token[k]++;
+		batch_send (next, token, moved);
+	}
+
+	sum = 0;
+	for (i = 0; i < tokens; i += moved) {
+		moved = batch_recv (this, token, tokens - i < max_batch
+				? tokens - i : max_batch);
+		for (k = 0; k < moved; ++k)
+			sum += token[k];
+	}
+
+	clock_gettime (CLOCK_MONOTONIC, &(ring_time[1]));
+	fprintf (stdout, "end\n");
+	fflush (stdout);
+
+	fprintf (stdout, "%d\n", sum);
+
+	token[0] = 0;
+	batch_send (next, token, 1);
+	batch_recv (this, token, 1);
+
+	free (token);
+	return NULL;
+}
+
+static void *batch_element (void *n)
+{
+	int this = (int) (intptr_t) n;
+	int next = (this + 1) % elements;
+	int *token = aligned_calloc (max_batch, sizeof (int));
+	int k, moved, last = 0;
+
+	do {
+		moved = batch_recv (this, token, max_batch);
+		for (k = 0; k < moved; ++k)
+			if (token[k] > 0)
+				token[k]++;
+			else
+				last = 1;
+		batch_send (next, token, moved);
+	} while (!last);
+
+	free (token);
+	return NULL;
+}
+
+/*
+ * Placement
+ *
+ * Threads are left to the kernel unless -p pins each element to one of
+ * the CPUs this process may run on:
+ *   compact  elements in blocks, on CPUs ordered by package, last-level
+ *            cache, core and SMT sibling, so that neighbours share a CPU
+ *            or, across a block boundary, a core or a cache;
+ *   scatter  CPUs dealt out a cache at a time and, within each cache, a
+ *            core at a time, so that neighbours are on different caches
+ *            where there are several, and otherwise on different cores;
+ *   rr       element i on the i-th CPU in the kernel's numbering, modulo
+ *            the number of CPUs.
+ * Topology comes from /sys/devices/system/cpu.  The mapping is summarised
+ * on stderr, with how many neighbouring pairs share a CPU, a core, a
+ * last-level cache or a package, and written in full to the file named
+ * by TOKENRING_PLACEMENT, if it is set, as "element cpu core llc package"
+ * lines, where a core or cache is named by its lowest CPU.
+ */
+enum { PLACE_NONE, PLACE_COMPACT, PLACE_SCATTER, PLACE_RR };
+
+static const char *place_names[] = { "none", "compact", "scatter", "rr" };
+
+typedef struct {
+	int	cpu;
+	int	core;
+	int	llc;
+	int	package;
+	/* Positions within the cache and the core, for scatter. */
+	int	llc_index;
+	int	core_rank;
+	int	thread_rank;
+} cpu_topology_t;
+
+static int		placement = PLACE_NONE;
+static cpu_topology_t	*topology;
+static int		num_cpus;
+static int		*place;		/* Index into topology, per element. */
+
+/* First number in a sysfs file for a CPU, which for a list of CPUs is the
+ * lowest, or fallback if there is no such file.
+ */
+static int sysfs_int (int cpu, const char *file, int fallback)
+{
+	char path[256];
+	FILE *f;
+	int n;
+
+	snprintf (path, sizeof (path), "/sys/devices/system/cpu/cpu%d/%s",
+			cpu, file);
+	f = fopen (path, "r");
+	if (f == NULL)
+		return fallback;
+	if (fscanf (f, "%d", &n) != 1)
+		n = fallback;
+	fclose (f);
+	return n;
+}
+
+/* Lowest CPU sharing the highest level of cache with cpu. */
+static int sysfs_llc (int cpu)
+{
+	char file[64];
+	int i, level, best = -1, llc = -1;
+
+	for (i = 0; ; ++i) {
+		snprintf (file, sizeof (file), "cache/index%d/level", i);
+		level = sysfs_int (cpu, file, -1);
+		if (level < 0)
+			break;
+		if (level > best) {
+			snprintf (file, sizeof (file),
+					"cache/index%d/shared_cpu_list", i);
+			best = level;
+			llc = sysfs_int (cpu, file, -1);
+		}
+	}
+	return llc;
+}
+
+static int compare_compact (const void *a, const void *b)
+{
+	const cpu_topology_t *x = a, *y = b;
+
+	if (x->package != y->package)
+		return x->package - y->package;
+	if (x->llc != y->llc)
+		return x->llc - y->llc;
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+static int compare_scatter (const void *a, const void *b)
+{
+	const cpu_topology_t *x = a, *y = b;
+
+	if (x->thread_rank != y->thread_rank)
+		return x->thread_rank - y->thread_rank;
+	if (x->core_rank != y->core_rank)
+		return x->core_rank - y->core_rank;
+	return x->llc_index - y->llc_index;
+}
+
+static int compare_cpu (const void *a, const void *b)
+{
+	return ((const cpu_topology_t *) a)->cpu
+		- ((const cpu_topology_t *) b)->cpu;
+}
+
+/* Read the topology of the CPUs we may run on, order them for the policy
+ * and map every element to one.
+ */
+static void placement_init (void)
+{
+	cpu_set_t allowed;
+	cpu_topology_t *t;
+	int i, cpu, per_cpu;
+
+	if (placement == PLACE_NONE)
+		return;
+	if (sched_getaffinity (0, sizeof (allowed), &allowed) != 0) {
+		perror ("placement");
+		exit (EXIT_FAILURE);
+	}
+	num_cpus = CPU_COUNT (&allowed);
+	topology = aligned_calloc (num_cpus, sizeof (cpu_topology_t));
+	place = aligned_calloc (elements, sizeof (int));
+	for (i = 0, cpu = 0; i < num_cpus; ++cpu) {
+		if (!CPU_ISSET (cpu, &allowed))
+			continue;
+		t = &(topology[i++]);
+		t->cpu = cpu;
+		t->core = sysfs_int (cpu, "topology/thread_siblings_list", cpu);
+		t->package = sysfs_int (cpu, "topology/physical_package_id", 0);
+		t->llc = sysfs_llc (cpu);
+		if (t->llc < 0)
+			t->llc = t->package;
+	}
+
+	qsort (topology, num_cpus, sizeof (cpu_topology_t), compare_compact);
+	for (i = 0; i < num_cpus; ++i) {
+		t = &(topology[i]);
+		if (i == 0 || t->llc != t[-1].llc
+				|| t->package != t[-1].package) {
+			t->llc_index = i == 0 ? 0 : t[-1].llc_index + 1;
+			t->core_rank = 0;
+			t->thread_rank = 0;
+		} else if (t->core != t[-1].core) {
+			t->llc_index = t[-1].llc_index;
+			t->core_rank = t[-1].core_rank + 1;
+			t->thread_rank = 0;
+		} else {
+			t->llc_index = t[-1].llc_index;
+			t->core_rank = t[-1].core_rank;
+			t->thread_rank = t[-1].thread_rank + 1;
+		}
+	}
+	if (placement == PLACE_SCATTER)
+		qsort (topology, num_cpus, sizeof (cpu_topology_t),
+				compare_scatter);
+	else if (placement == PLACE_RR)
+		qsort (topology, num_cpus, sizeof (cpu_topology_t),
+				compare_cpu);
+
+	per_cpu = (elements + num_cpus - 1) / num_cpus;
+	for (i = 0; i < elements; ++i)
+		place[i] = placement == PLACE_COMPACT ? i / per_cpu
+			: i % num_cpus;
+}
+
+/* Pin the next thread created with attr, or with -P the calling process,
+ * to the CPU of element i.
+ */
+static void placement_set (pthread_attr_t *attr, int i)
+{
+	cpu_set_t set;
+	int err;
+
+	if (placement == PLACE_NONE)
+		return;
+	CPU_ZERO (&set);
+	CPU_SET (topology[place[i]].cpu, &set);
+	if (processes)
+		err = sched_setaffinity (0, sizeof (set), &set);
+	else
+		err = pthread_attr_setaffinity_np (attr, sizeof (set), &set);
+	if (err != 0) {
+		perror ("placement");
+		exit (EXIT_FAILURE);
+	}
+}
+
+static void placement_report (void)
+{
+	long cpu = 0, core = 0, llc = 0, package = 0, apart = 0;
+	const cpu_topology_t *a, *b;
+	const char *file = getenv ("TOKENRING_PLACEMENT");
+	FILE *f;
 	int i;
 
-	if (argc >= 2)
-		cycles = atoi (argv[1]);
+	if (placement == PLACE_NONE)
+		return;
+	for (i = 0; i < elements; ++i) {
+		a = &(topology[place[i]]);
+		b = &(topology[place[(i + 1) % elements]]);
+		if (a->cpu == b->cpu)
+			cpu++;
+		else if (a->core == b->core)
+			core++;
+		else if (a->llc == b->llc)
+			llc++;
+		else if (a->package == b->package)
+			package++;
+		else
+			apart++;
+	}
+	fprintf (stderr, "placement: %s on %d CPUs, order", place_names[placement],
+			num_cpus);
+	for (i = 0; i < num_cpus; ++i)
+		fprintf (stderr, "%c%d", i == 0 ? ' ' : ',', topology[i].cpu);
+	fprintf (stderr, "; neighbours sharing a CPU %ld, a core %ld, "
+			"a cache %ld, a package %ld, nothing %ld\n",
+			cpu, core, llc, package, apart);
+
+	if (file == NULL)
+		return;
+	f = fopen (file, "w");
+	if (f == NULL) {
+		perror (file);
+		return;
+	}
+	for (i = 0; i < elements; ++i) {
+		a = &(topology[place[i]]);
+		fprintf (f, "%d %d %d %d %d\n", i, a->cpu, a->core, a->llc,
+				a->package);
+	}
+	fclose (f);
+}
+
+static void usage (const char *name)
+{
+	fprintf (stderr, "Usage: %s [-c mutex|spsc|futex] [-s spins] [-y yields] "
+			"[-k stack_kb] [-m] [-f]\n"
+			"\t[-p compact|scatter|rr|none] [-b batch] [-P] "
+			"[-z bytes] [-x copy|transfer]\n\t"
+			"[cycles [tokens [elements]]]\n", name);
+	exit (EXIT_FAILURE);
+}
+
+/* Give every thread a stack of stack_size bytes, all from one mapping if
+ * arena is set, and touched now if prefault is set.
+ */
+static void stacks_init (pthread_attr_t *attr, size_t stack_size, int arena,
+		int prefault)
+{
+	long page = sysconf (_SC_PAGESIZE);
+	size_t arena_size;
+
+	pthread_attr_init (attr);
+	if (stack_size == 0 && !arena)
+		return;
+	if (stack_size == 0)
+		stack_size = ARENA_STACK_KB * 1024;
+	if (stack_size < PTHREAD_STACK_MIN)
+		stack_size = PTHREAD_STACK_MIN;
+	stack_size = (stack_size + page - 1) / page * page;
+	if (!arena) {
+		if (pthread_attr_setstacksize (attr, stack_size) != 0) {
+			perror ("stack size");
+			exit (EXIT_FAILURE);
+		}
+		return;
+	}
+
+	arena_size = stack_size * (size_t) elements;
+	stack_arena = mmap (NULL, arena_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE
+#ifdef MAP_STACK
+			| MAP_STACK
+#endif
+			, -1, 0);
+	if (stack_arena == MAP_FAILED) {
+		perror ("stack arena");
+		exit (EXIT_FAILURE);
+	}
+	if (prefault)
+		memset (stack_arena, 0, arena_size);
+	stack_arena_size = stack_size;
+}
+
+/* Start one thread of the ring. */
+static void start (int i, pthread_attr_t *attr)
+{
+	void *(*body) (void *);
+	int err, j;
+
+	if (max_batch > 0)
+		body = i == 0 ? batch_root : batch_element;
+	else
+		body = i == 0 ? root : element;
+
+	if (processes) {
+		pid[i] = fork ();
+		if (pid[i] == 0) {
+			placement_set (NULL, i);
+			body ((void *) (intptr_t) i);
+			fflush (stdout);
+			_exit (EXIT_SUCCESS);
+		}
+		if (pid[i] < 0) {
+			perror ("fork");
+			for (j = i + 1; j < elements; ++j)
+				kill (pid[j], SIGKILL);
+			exit (EXIT_FAILURE);
+		}
+		return;
+	}
+
+	if (stack_arena != NULL)
+		pthread_attr_setstack (attr, stack_arena
+				+ (size_t) i * stack_arena_size,
+				stack_arena_size);
+	placement_set (attr, i);
+	err = pthread_create (&(thread[i]), attr, body, (void *) (intptr_t) i);
+	if (err != 0) {
+		fprintf (stderr, "element %d: %s\n", i, strerror (err));
+		exit (EXIT_FAILURE);
+	}
+}
+
+int main (int argc, char *argv[])
+{
+	pthread_attr_t attr;
+	pthread_mutexattr_t mutex_attr;
+	pthread_condattr_t cond_attr;
+	size_t stack_size = 0;
+	int arena = 0, prefault = 0, failed = 0;
+	int i, opt, status;
+
+	while ((opt = getopt (argc, argv, "c:s:y:k:mfp:b:Pz:x:")) != -1) {
+		switch (opt) {
+		case 'c':
+			if (strcmp (optarg, "mutex") == 0)
+				channel = CHANNEL_MUTEX;
+			else if (strcmp (optarg, "spsc") == 0)
+				channel = CHANNEL_SPSC;
+			else if (strcmp (optarg, "futex") == 0)
+				channel = CHANNEL_FUTEX;
+			else
+				usage (argv[0]);
+			break;
+		case 's':
+			max_spins = atoi (optarg);
+			break;
+		case 'y':
+			spsc_yields = atoi (optarg);
+			break;
+		case 'k':
+			stack_size = (size_t) atol (optarg) * 1024;
+			break;
+		case 'm':
+			arena = 1;
+			break;
+		case 'f':
+			arena = prefault = 1;
+			break;
+		case 'p':
+			for (placement = PLACE_RR; placement >= PLACE_NONE;
+					--placement)
+				if (strcmp (optarg, place_names[placement]) == 0)
+					break;
+			if (placement < PLACE_NONE)
+				usage (argv[0]);
+			break;
+		case 'b':
+			max_batch = atoi (optarg);
+			if (max_batch < 1)
+				usage (argv[0]);
+			break;
+		case 'P':
+			processes = 1;
+			break;
+		case 'z':
+			payload = (parse_size (optarg) + 7) & ~(size_t) 7;
+			if (payload == 0)
+				usage (argv[0]);
+			break;
+		case 'x':
+			if (strcmp (optarg, "copy") == 0)
+				payload_mode = PAYLOAD_COPY;
+			else if (strcmp (optarg, "transfer") == 0)
+				payload_mode = PAYLOAD_TRANSFER;
+			else
+				usage (argv[0]);
+			break;
+		default:
+			usage (argv[0]);
+		}
+	}
+	if (max_spins < 0 && sysconf (_SC_NPROCESSORS_ONLN) == 1)
+		max_spins = 0;
+	else if (max_spins < 0)
+		max_spins = channel == CHANNEL_FUTEX ? FUTEX_SPINS : SPSC_SPINS;
+
+	if (argc - optind >= 1)
+		cycles = atoi (argv[optind]);
 	else
 		cycles = 0;
-	if (argc >= 3)
-		tokens = atoi (argv[2]);
+	if (argc - optind >= 2)
+		tokens = atoi (argv[optind + 1]);
 	else
 		tokens = 1;
+	if (argc - optind >= 3)
+		elements = atoi (argv[optind + 2]);
+	if (elements < 2)
+		usage (argv[0]);
+	if (channel == CHANNEL_FUTEX && tokens >= elements) {
+		fprintf (stderr, "%s: futex channels need fewer than %d tokens\n",
+				argv[0], elements);
+		exit (EXIT_FAILURE);
+	}
+	if (max_batch > 0 && channel != CHANNEL_MUTEX) {
+		fprintf (stderr, "%s: only mutex channels batch\n", argv[0]);
+		exit (EXIT_FAILURE);
+	}
+	if (max_batch > 0 && payload > 0) {
+		fprintf (stderr, "%s: batches carry no payload\n", argv[0]);
+		exit (EXIT_FAILURE);
+	}
+	if (processes && (stack_size != 0 || arena)) {
+		fprintf (stderr, "%s: -k, -m and -f need threads, not -P\n",
+				argv[0]);
+		exit (EXIT_FAILURE);
+	}
 
-	for (i = 0; i < ELEMENTS; ++i)
-		full[i] = data[i] = 0;
+	/* Zeroed, which is the initial state of every kind of channel. */
+	shared_init (payload_shared_size ());
+	thread = aligned_calloc (elements, sizeof (pthread_t));
+	pid = aligned_calloc (elements, sizeof (pid_t));
+	locked = shared_calloc (elements, sizeof (locked_t));
+	spsc = shared_calloc (elements, sizeof (spsc_t));
+	rendezvous = shared_calloc (elements, sizeof (rendezvous_t));
+	ring_time = shared_calloc (2, sizeof (struct timespec));
+	payload_init ();
+	if (max_batch > 0) {
+		batch_buffer = shared_calloc ((size_t) elements * max_batch,
+				sizeof (int));
+		batch_head = shared_calloc (elements, sizeof (int));
+		batch_stats = shared_calloc (elements,
+				sizeof (batch_stats_t));
+	}
 
-	for (i = ELEMENTS - 1; i >= 0; --i) {
-		pthread_mutex_init (&(mutex[i]), NULL);
-		pthread_cond_init (&(cond[i]), NULL);
+#ifdef TRACE
+	trace_init ();
+#endif
 
-		if (i == 0)
-			pthread_create (&(thread[i]), NULL, root, (void *)i);
-		else
-			pthread_create (&(thread[i]), NULL, element, (void *)i);
+	placement_init ();
+	stacks_init (&attr, stack_size, arena, prefault);
+	pthread_mutexattr_init (&mutex_attr);
+	pthread_condattr_init (&cond_attr);
+	if (processes) {
+		pthread_mutexattr_setpshared (&mutex_attr,
+				PTHREAD_PROCESS_SHARED);
+		pthread_condattr_setpshared (&cond_attr,
+				PTHREAD_PROCESS_SHARED);
+	}
+	for (i = 0; i < elements; ++i) {
+		pthread_mutex_init (&(locked[i].mutex), &mutex_attr);
+		pthread_cond_init (&(locked[i].cond), &cond_attr);
+	}
+	fflush (stdout);
+	for (i = elements - 1; i >= 0; --i)
+		start (i, &attr);
 
+	if (processes) {
+		for (i = 0; i < elements; ++i)
+			if (waitpid (pid[i], &status, 0) < 0 || status != 0)
+				failed = 1;
+	} else {
+		pthread_join (thread[0], NULL);
 	}
 
-	pthread_join (thread[0], NULL);
+#ifdef TRACE
+	/* Every element has made its last handoff before the root's last
+	 * receive, so all of the buffers are complete.
+	 */
+	trace_dump ();
+#endif
+	if (channel == CHANNEL_FUTEX)
+		rv_report ();
+	if (max_batch > 0)
+		batch_report ();
+	if (payload > 0)
+		payload_report ();
+	placement_report ();
 
-	return 0;
+	return failed ? EXIT_FAILURE : 0;
 }
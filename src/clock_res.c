@@ -1,12 +1,25 @@
-/* Print a table of available timer frequencies. Linux only.
+/* Print a table of available timer frequencies, and what each clock costs
+ * to read. Linux only.
+ *
+ * For every clock this reports the resolution claimed by clock_getres(),
+ * the cost of a read through the C library (normally the vDSO) and through
+ * the system call, the smallest step actually seen between back-to-back
+ * reads, and how often a read on one CPU was earlier than a read already
+ * made on another. The time stamp counter, where there is one, is
+ * calibrated against CLOCK_MONOTONIC_RAW and measured the same way.
  *
  * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014.
  */
+#include <math.h>
 #include <stdio.h>
-#include <string.h>
 #include <sys/utsname.h>
 #include <time.h>
 
+#include "timer_clock.h"
+
+/* Time over which the time stamp counter is calibrated. */
+#define TSC_CALIBRATION_MS 100
+
 
 /* Print a horizontal rule. */
 void hrule();
@@ -14,73 +27,94 @@ void hrule();
 /* Print a fancy header above the table of results. */
 void print_header();
 
-/* Print resolutions of all clocks in the lookup table. */
+/* Print resolutions and costs of all clocks in the lookup table. */
 void print_resolutions();
 
-/* Lookup table containing clock IDs and readable names. */
-typedef struct lut_t { clockid_t id; const char *name; } lut_t;
-
+/* Print the cost and rate of the time stamp counter. */
+void print_tsc();
 
-/* All available clocks listed in the man page for clock_getres. */
-lut_t clocks[] = {
-    { CLOCK_REALTIME,           "CLOCK_REALTIME" },
-    { CLOCK_REALTIME_COARSE,    "CLOCK_REALTIME_COARSE" },
-    { CLOCK_MONOTONIC,          "CLOCK_MONOTONIC" },
-    { CLOCK_MONOTONIC_COARSE,   "CLOCK_MONOTONIC_COARSE" },
-    { CLOCK_MONOTONIC_RAW,      "CLOCK_MONOTONIC_RAW" },
-    { CLOCK_BOOTTIME,           "CLOCK_BOOTTIME" },
-    { CLOCK_PROCESS_CPUTIME_ID, "CLOCK_PROCESS_CPUTIME_ID" },
-    { CLOCK_THREAD_CPUTIME_ID,  "CLOCK_THREAD_CPUTIME_ID" },
-    { (clockid_t) -1,           NULL },
-};
+/* Print one row of the table. */
+void print_bench(const char *name, clock_bench_t *bench);
 
 
 int main(int argc, char** argv) {
     print_header();
     print_resolutions();
     hrule();
+    print_tsc();
     printf("\n");
     return 0;
 }
 
 
-/* Print resolutions of all clocks in the lookup table. */
+/* Print one row of the table. Blank cells were not measured. */
+void print_bench(const char *name, clock_bench_t *bench) {
+    printf(" %-24s | %-10lld | %-8.1f | ", name, bench->resolution_ns,
+           bench->call_ns);
+    if (isnan(bench->syscall_ns)) {
+        printf("%-8s | ", "");
+    } else {
+        printf("%-8.1f | ", bench->syscall_ns);
+    }
+    printf("%-9lld | ", bench->min_delta_ns);
+    if (bench->backwards < 0) {
+        printf("\n");
+    } else {
+        printf("%lld\n", bench->backwards);
+    }
+}
+
+
+/* Print resolutions and costs of all clocks in the lookup table. */
 void print_resolutions() {
-    struct timespec spec;
-    struct lut_t *p = NULL;
-    for (p = clocks; p->id != -1; ++p) {
-        if (clock_getres(p->id, &spec) != 0) {
+    clock_bench_t bench;
+    const clock_lut_t *p = NULL;
+    for (p = clock_names; p->name != NULL; ++p) {
+        if (clock_benchmark(p->id, p->system_wide, &bench) != 0) {
             printf("%s is not supported on this platform.\n", p->name);
         }
         else {
-            printf(" %-25s | %-10ld | %-10ld (%g secs)\n",
-                   p->name,
-                   spec.tv_sec,
-                   spec.tv_nsec,
-                   (double)spec.tv_nsec / (double)1000000000.0);
+            print_bench(p->name, &bench);
         }
     }
 }
 
 
+/* Print the cost and rate of the time stamp counter. */
+void print_tsc() {
+    clock_bench_t bench;
+    double ticks_per_ns = tsc_benchmark(TSC_CALIBRATION_MS, 1, &bench);
+    if (ticks_per_ns == 0) {
+        printf(" No time stamp counter on this platform.\n");
+        return;
+    }
+    print_bench("TSC", &bench);
+    hrule();
+    printf(" TSC: %.4f ticks per ns, %s.\n", ticks_per_ns,
+           tsc_invariant() ? "invariant" : "NOT invariant, so unreliable");
+}
+
+
 /* Print a fancy header above the table of results. */
 void print_header() {
     struct utsname sysinfo;
     printf("\n");
     hrule();
     if (uname(&sysinfo) == 0) {
-        printf("\t%s system clock resolutions\n",
-        strcat(sysinfo.sysname, sysinfo.release));
+        printf("\t%s%s system clock resolutions\n",
+               sysinfo.sysname, sysinfo.release);
     } else {
         printf("\tSystem clock resolutions\n");
     }
     hrule();
-    printf(" %-25s | %-10s | %-10s \n", "Clock", "Seconds", "Nanoseconds");
+    printf(" %-24s | %-10s | %-8s | %-8s | %-9s | %s\n", "Clock",
+           "Res. (ns)", "ns/call", "Syscall", "Min. step", "Backwards");
     hrule();
 }
 
 
 /* Print a horizontal rule. */
 void hrule() {
-    printf("----------------------------------------------------------------\n");
+    printf("------------------------------------------------------------"
+           "----------------------------\n");
 }
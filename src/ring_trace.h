@@ -0,0 +1,54 @@
+/* Binary format of the handoff traces written by instrumented token rings,
+ * e.g. benchmarks/pthread/tokenring-trace, and read by ringtrace.
+ *
+ * A trace is a ring_trace_header_t, then for each element in turn a
+ * ring_trace_thread_t followed by its send events and then its receive
+ * events. Element i receives on channel i and sends on channel i + 1 (mod
+ * elements), and every channel is first in first out, so the k-th send
+ * onto a channel and the k-th receive from it are the same token.
+ *
+ * All fields are in the byte order of the machine which wrote the trace.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#ifndef RING_TRACE_H
+#define RING_TRACE_H
+
+#include <stdint.h>
+
+#define RING_TRACE_MAGIC "RINGTRC1"
+#define RING_TRACE_VERSION 1
+
+/* Where timestamps came from. */
+#define RING_TRACE_CLOCK_RAW 0 /* CLOCK_MONOTONIC_RAW, in nanoseconds. */
+#define RING_TRACE_CLOCK_TSC 1 /* The time stamp counter, in ticks. */
+
+typedef struct ring_trace_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t elements;
+    uint32_t clock;
+    /* Events each element could hold in each direction. */
+    uint32_t capacity;
+    /* Timestamp ticks per nanosecond. */
+    double ticks_per_ns;
+    /* Measured cost of recording one event, in nanoseconds. */
+    double overhead_ns;
+} ring_trace_header_t;
+
+typedef struct ring_trace_thread_t {
+    uint32_t sends, recvs;
+    /* Events lost because the buffers were full. */
+    uint32_t dropped;
+    uint32_t reserved;
+} ring_trace_thread_t;
+
+/* One handoff. Begin is when send_to() or recv_from() was entered, and end
+ * is when the token was put on, or taken off, the channel.
+ */
+typedef struct ring_trace_event_t {
+    uint64_t begin, end;
+} ring_trace_event_t;
+
+#endif /* RING_TRACE_H */
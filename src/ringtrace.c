@@ -0,0 +1,398 @@
+/* Report on the handoff trace of an instrumented token ring.
+ *
+ * Usage: ringtrace options TRACE
+ * -h --help Display this usage information.
+ * -n --top Number of elements to list in the stall report (default 10).
+ * -a --all List every element in the stall report.
+ * -w --wakeups FILE Save the wakeup latency histogram as CSV.
+ * -e --elements FILE Save the stall report for every element as CSV.
+ *
+ * The wakeup latency of a hop is the time from one element putting a token
+ * on a channel to the next element taking it off. An element stalls while
+ * it waits in recv_from() for a token, or in send_to() for the next element
+ * to take the last one.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring_trace.h"
+#include "timer_histogram.h"
+
+#define DEFAULT_TOP 10
+
+/* Widest bar in the printed histogram. */
+#define BAR_WIDTH 40
+
+/* Everything recorded by one element. */
+typedef struct trace_thread_t {
+    ring_trace_thread_t counts;
+    ring_trace_event_t *sends, *recvs;
+} trace_thread_t;
+
+/* How long one element spent waiting. */
+typedef struct stall_t {
+    int element;
+    long long handoffs;
+    long double recv_ns, send_ns, max_recv_ns, max_send_ns;
+} stall_t;
+
+/* The name of this program. */
+const char *program_name;
+
+/* Print a horizontal rule. */
+void hrule();
+
+/* Prints usage information for this program exit. */
+void print_usage (FILE *stream, int exit_code);
+
+/* Read a whole trace. Returns the threads, or NULL on error. */
+trace_thread_t * read_trace(const char *filename, ring_trace_header_t *header);
+
+/* Print the distribution of wakeup latencies, and optionally save it. */
+void report_wakeups(histogram_t *hist, ring_trace_header_t *header,
+                    const char *csv_file);
+
+/* Print the elements which stalled longest, and optionally save them all. */
+void report_stalls(stall_t *stalls, int elements, int top,
+                   const char *csv_file);
+
+
+int main(int argc, char **argv) {
+    ring_trace_header_t header;
+    trace_thread_t *threads;
+    histogram_t *hist;
+    stall_t *stalls;
+    char *wakeup_file = NULL, *element_file = NULL;
+    int top = DEFAULT_TOP, all = 0, c, sender, n, k, skewed = 0;
+    long double latency, wait;
+    unsigned long long dropped = 0;
+
+    /* Valid short options. */
+    const char *short_options = "hn:aw:e:";
+    int next_opt;
+
+    /* Valid long options. */
+    const struct option long_options[] = {
+        { "help",     0, NULL, 'h' },
+        { "top",      1, NULL, 'n' },
+        { "all",      0, NULL, 'a' },
+        { "wakeups",  1, NULL, 'w' },
+        { "elements", 1, NULL, 'e' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    program_name = argv[0]; /* Global. */
+
+    do {
+        next_opt = getopt_long(argc, argv, short_options, long_options, NULL);
+        switch (next_opt) {
+            case 'h': /* -h or --help */
+               print_usage (stdout, 0);
+               break;
+            case 'n': /* -n or --top */
+               top = atoi(optarg);
+               break;
+            case 'a': /* -a or --all */
+               all = 1;
+               break;
+            case 'w': /* -w or --wakeups */
+               wakeup_file = optarg;
+               break;
+            case 'e': /* -e or --elements */
+               element_file = optarg;
+               break;
+            case -1:
+                break;
+            default:
+                print_usage (stderr, 1);
+                return 1;
+        }
+    } while (next_opt != -1);
+
+    if (optind != argc - 1) {
+        print_usage (stderr, 1);
+    }
+
+    threads = read_trace(argv[optind], &header);
+    if (threads == NULL) {
+        exit(EXIT_FAILURE);
+        return 1;
+    }
+
+    /* Pair the k-th send onto each channel with the k-th receive from it. */
+    hist = histogram_new();
+    stalls = calloc(header.elements, sizeof(stall_t));
+    for (c = 0; c < (int)header.elements; c++) {
+        sender = (c + header.elements - 1) % header.elements;
+        n = threads[sender].counts.sends < threads[c].counts.recvs ?
+            threads[sender].counts.sends : threads[c].counts.recvs;
+        for (k = 0; k < n; k++) {
+            latency = ((long double)threads[c].recvs[k].end -
+                       (long double)threads[sender].sends[k].end) /
+                header.ticks_per_ns;
+            /* Counters on different cores may disagree slightly. */
+            if (latency < 0) {
+                skewed++;
+                latency = 0;
+            }
+            histogram_record(hist, (unsigned long long)llroundl(latency));
+        }
+
+        stalls[c].element = c;
+        stalls[c].handoffs = threads[c].counts.sends + threads[c].counts.recvs;
+        for (k = 0; k < (int)threads[c].counts.recvs; k++) {
+            wait = (threads[c].recvs[k].end - threads[c].recvs[k].begin) /
+                header.ticks_per_ns;
+            stalls[c].recv_ns += wait;
+            if (wait > stalls[c].max_recv_ns) {
+                stalls[c].max_recv_ns = wait;
+            }
+        }
+        for (k = 0; k < (int)threads[c].counts.sends; k++) {
+            wait = (threads[c].sends[k].end - threads[c].sends[k].begin) /
+                header.ticks_per_ns;
+            stalls[c].send_ns += wait;
+            if (wait > stalls[c].max_send_ns) {
+                stalls[c].max_send_ns = wait;
+            }
+        }
+        dropped += threads[c].counts.dropped;
+    }
+
+    printf("\n");
+    hrule();
+    printf(" %u elements, clock %s at %.3f ticks per ns.\n",
+           header.elements,
+           header.clock == RING_TRACE_CLOCK_TSC ?
+           "TSC" : "CLOCK_MONOTONIC_RAW",
+           header.ticks_per_ns);
+    printf(" Instrumentation overhead: %.1f ns per event, "
+           "two events per hop.\n", header.overhead_ns);
+    if (dropped > 0) {
+        printf(" %llu events dropped; buffers hold %u events each. "
+               "Raise TOKENRING_TRACE_EVENTS.\n", dropped, header.capacity);
+    }
+    if (skewed > 0) {
+        printf(" %d hops appeared to take negative time, and were "
+               "counted as 0 ns.\n", skewed);
+    }
+    report_wakeups(hist, &header, wakeup_file);
+    report_stalls(stalls, header.elements, all ? (int)header.elements : top,
+                  element_file);
+
+    for (c = 0; c < (int)header.elements; c++) {
+        free(threads[c].sends);
+        free(threads[c].recvs);
+    }
+    free(threads);
+    free(stalls);
+    histogram_free(hist);
+    return 0;
+}
+
+
+/* Read count events from a trace into a new array. */
+static ring_trace_event_t * read_events(FILE *fp, uint32_t count) {
+    ring_trace_event_t *events = malloc(sizeof(ring_trace_event_t) *
+                                        (count + 1));
+    if (fread(events, sizeof(ring_trace_event_t), count, fp) != count) {
+        free(events);
+        return NULL;
+    }
+    return events;
+}
+
+
+/* Read a whole trace. Returns the threads, or NULL on error. */
+trace_thread_t * read_trace(const char *filename,
+                            ring_trace_header_t *header) {
+    trace_thread_t *threads;
+    FILE *fp;
+    unsigned int i;
+
+    fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        perror(filename);
+        return NULL;
+    }
+    if (fread(header, sizeof(*header), 1, fp) != 1 ||
+        memcmp(header->magic, RING_TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != RING_TRACE_VERSION) {
+        fprintf(stderr, "%s is not a version %d ring trace.\n",
+                filename, RING_TRACE_VERSION);
+        fclose(fp);
+        return NULL;
+    }
+
+    threads = calloc(header->elements, sizeof(trace_thread_t));
+    for (i = 0; i < header->elements; i++) {
+        if (fread(&threads[i].counts, sizeof(ring_trace_thread_t), 1,
+                  fp) != 1 ||
+            (threads[i].sends = read_events(fp, threads[i].counts.sends))
+            == NULL ||
+            (threads[i].recvs = read_events(fp, threads[i].counts.recvs))
+            == NULL) {
+            fprintf(stderr, "%s is truncated at element %u.\n", filename, i);
+            fclose(fp);
+            return NULL;
+        }
+    }
+    fclose(fp);
+    return threads;
+}
+
+
+/* Print the distribution of wakeup latencies, one row per power of two, and
+ * optionally save every non-empty bucket as CSV.
+ */
+void report_wakeups(histogram_t *hist, ring_trace_header_t *header,
+                    const char *csv_file) {
+    long long rows[65] = { 0 }, most = 0;
+    long double median;
+    int i, row, first = 65, last = -1;
+    FILE *fp;
+
+    hrule();
+    printf(" Wakeup latency of %lld hops (ns)\n", hist->total);
+    hrule();
+    if (hist->total == 0) {
+        return;
+    }
+    median = histogram_quantile(hist, 0.5);
+    printf(" Median %.0Lf, 90%% %.0Lf, 99%% %.0Lf, 99.9%% %.0Lf, "
+           "maximum %.0Lf\n",
+           median,
+           histogram_quantile(hist, 0.9),
+           histogram_quantile(hist, 0.99),
+           histogram_quantile(hist, 0.999),
+           histogram_quantile(hist, 1));
+    printf(" Recording costs about %.1Lf%% of the median hop.\n",
+           median > 0 ? 200 * header->overhead_ns / median : 0.0L);
+    hrule();
+
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (hist->counts[i] == 0) {
+            continue;
+        }
+        row = (histogram_lowest(i) == 0) ? 0 :
+            64 - __builtin_clzll(histogram_lowest(i));
+        rows[row] += hist->counts[i];
+        if (row < first) {
+            first = row;
+        }
+        if (row > last) {
+            last = row;
+        }
+    }
+    for (row = first; row <= last; row++) {
+        if (rows[row] > most) {
+            most = rows[row];
+        }
+    }
+    for (row = first; row <= last; row++) {
+        printf(" %12llu - %-12llu | %10lld | %.*s\n",
+               row == 0 ? 0ULL : 1ULL << (row - 1),
+               (1ULL << row) - 1,
+               rows[row],
+               (int)((rows[row] * BAR_WIDTH + most - 1) / most),
+               "########################################");
+    }
+
+    if (csv_file != NULL) {
+        fp = fopen(csv_file, "w+");
+        if (fp == NULL) {
+            fprintf(stderr, "Could not write to file %s\n.", csv_file);
+            return;
+        }
+        fprintf(fp, "Lowest latency (ns),Highest latency (ns),Hops\n");
+        for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            if (hist->counts[i] > 0) {
+                fprintf(fp, "%llu,%llu,%lld\n", histogram_lowest(i),
+                        histogram_lowest(i) + histogram_width(i) - 1,
+                        hist->counts[i]);
+            }
+        }
+        fclose(fp);
+    }
+}
+
+
+/* Order elements by total stall, longest first, for qsort(). */
+static int compare_stalls(const void *a, const void *b) {
+    long double x = ((const stall_t*)a)->recv_ns + ((const stall_t*)a)->send_ns;
+    long double y = ((const stall_t*)b)->recv_ns + ((const stall_t*)b)->send_ns;
+    return (x < y) - (x > y);
+}
+
+
+/* Print the elements which stalled longest, and optionally save every
+ * element as CSV in ring order.
+ */
+void report_stalls(stall_t *stalls, int elements, int top,
+                   const char *csv_file) {
+    FILE *fp = NULL;
+    int i;
+
+    if (csv_file != NULL) {
+        fp = fopen(csv_file, "w+");
+        if (fp == NULL) {
+            fprintf(stderr, "Could not write to file %s\n.", csv_file);
+        }
+    }
+    if (fp != NULL) {
+        fprintf(fp, "Element,Handoffs,Receive wait (ns),Send wait (ns),"
+                "Longest receive wait (ns),Longest send wait (ns)\n");
+        for (i = 0; i < elements; i++) {
+            fprintf(fp, "%d,%lld,%.0Lf,%.0Lf,%.0Lf,%.0Lf\n",
+                    stalls[i].element, stalls[i].handoffs,
+                    stalls[i].recv_ns, stalls[i].send_ns,
+                    stalls[i].max_recv_ns, stalls[i].max_send_ns);
+        }
+        fclose(fp);
+    }
+
+    qsort(stalls, elements, sizeof(stall_t), compare_stalls);
+    hrule();
+    printf(" %-8s | %-10s | %-14s | %-14s | %-12s\n", "Element",
+           "Handoffs", "Recv wait (ms)", "Send wait (ms)", "Longest (us)");
+    hrule();
+    for (i = 0; i < top && i < elements; i++) {
+        printf(" %-8d | %-10lld | %-14.3Lf | %-14.3Lf | %-12.1Lf\n",
+               stalls[i].element, stalls[i].handoffs,
+               stalls[i].recv_ns / 1000000, stalls[i].send_ns / 1000000,
+               (stalls[i].max_recv_ns > stalls[i].max_send_ns ?
+                stalls[i].max_recv_ns : stalls[i].max_send_ns) / 1000);
+    }
+    hrule();
+}
+
+
+/* Print a horizontal rule. */
+void hrule() {
+    printf("----------------------------------------------------------------\n");
+}
+
+
+/* Prints usage information for this program exit. */
+void print_usage (FILE *stream, int exit_code) {
+    fprintf (stream, "Usage: %s options TRACE\n", program_name);
+    fprintf (stream,
+             " -h --help Display this usage information.\n"
+             " -n --top Number of elements to list in the stall report "
+             "(default %d).\n"
+             " -a --all List every element in the stall report.\n"
+             " -w --wakeups FILE Save the wakeup latency histogram as CSV.\n"
+             " -e --elements FILE Save the stall report for every element "
+             "as CSV.\n\n"
+             "Example: Trace a ring and report on it:\n"
+             "   TOKENRING_TRACE=ring.trace tokenring-trace 1000 8\n"
+             "   ringtrace -w wakeups.csv ring.trace\n",
+             DEFAULT_TOP);
+    exit (exit_code);
+}
@@ -4,19 +4,64 @@
  * -h --help Display this usage information.
  * -i --iterations Number of iterations to run COMMAND.
  * -c --command COMMAND to be measured.
+ * -p --precision Run until the 95% CI on wall clock time is within this
+ *                fraction of the mean (e.g. 0.01), ignoring -i.
+ * -m --min-iterations Fewest measured runs in precision mode.
+ * -M --max-iterations Most measured runs in precision mode.
+ * -w --warmup Number of warm-up runs of COMMAND to discard.
+ * -L --launch How to start COMMAND: fork, vfork or spawn (default).
+ * -e --exec-start Start the clock only once COMMAND has been exec'd.
+ * -C --calibrate Measure the harness overhead by timing /bin/true.
+ * -P --perf Record performance counters for every run.
+ * -H --hops Number of token hops per run, for per-hop figures.
+ * -S --phases Time the setup, steady-state and teardown phases of COMMAND,
+ *             delimited by "start" and "end" lines on its stdout.
+ * -X --sweep NAME=VALUES Run COMMAND at every combination of parameter
+ *                        values, substituted for {NAME} in COMMAND.
+ * -J --jobs FILE of commands, one per line, to run concurrently. Cannot be
+ *           combined with -X.
+ * -k --cores-per-job Number of CPUs to pin each job to, or each copy if
+ *                    given with -N.
+ * -B --bootstrap Number of bootstrap resamples behind each confidence
+ *                interval, or 0 for intervals from Student's t.
+ * -T --threads Number of threads to bootstrap with.
+ * -Z --stream Keep constant memory: save a mergeable summary as state.csv,
+ *             and with -s, append each run to results.csv as it completes.
+ * -G --merge Combine the state files named after the options into one
+ *            summary, without running anything.
+ * -K --compare Compare the two result stores named after the options, a
+ *              baseline and a candidate, without running anything. Runs
+ *              are compared group by group, matching command and
+ *              parameters as timerstore groups them. Exits with status 2
+ *              if wall clock time of any group regressed, or 1 if a group
+ *              has no match or either store holds no wall clock times.
+ * -t --threshold Smallest relative slowdown (e.g. 0.05) counted as a
+ *                regression when comparing.
+ * -D --store Append the results of every run of COMMAND to this result store,
+ *             which can be queried, aggregated and exported with timerstore.
+ * -A --sample Every this many milliseconds (at least 1), sample the memory,
+ *             threads, context switches and run-queue delay of COMMAND
+ *             into a time series named samples.csv.
+ * -Q --clock Clock to time with, e.g. monotonic_raw, or "auto" for the
+ *            cheapest clock fine enough for the length of a warm-up run.
+ *            Only system-wide clocks are accepted, as the CPU time clocks
+ *            measure timer itself rather than COMMAND.
+ * -N --copies Run 1, 2, ... up to this many copies of COMMAND at once, or
+ *             "max" for one per CPU (or per -k CPUs), released together,
+ *             and report how throughput scales in scaling.csv.
  * -l --latex Save results as a LaTeX table named results.tex.
  * -j --json Save results as a JSON file named results.json.
  * -s --csv Save results as a CSV file named results.csv.
- * -q --quiet Run in quiet mode.
+ * -q --quiet Run in quiet mode, discarding the output of COMMAND.
  * -v --verbose Run in verbose mode.
  *
- * TODO: LaTeX output, JSON output, CSV output, confidence intervals.
- * TODO: Add number of experiments to statistics_t.
- *
  * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <malloc.h>
 #include <stdio.h>
@@ -28,13 +73,36 @@
 #include <unistd.h>
 #include <wait.h>
 
+#include "timer_bootstrap.h"
+#include "timer_clock.h"
 #include "timer_data.h"
+#include "timer_jobs.h"
+#include "timer_launch.h"
+#include "timer_perf.h"
+#include "timer_sampler.h"
+#include "timer_store.h"
+#include "timer_sweep.h"
+#include "timer_throughput.h"
 
 #define DEFAULT_ITERATIONS 10
 
+/* Bounds on the number of measured runs when running to a target precision. */
+#define DEFAULT_MIN_ITERATIONS 5
+#define DEFAULT_MAX_ITERATIONS 1000
+
 #define MAX_ARGS 64
 
-/* Which timer should we use? Options are:
+/* Command timed in calibration mode. It should do as little as possible. */
+#define CALIBRATION_COMMAND "/bin/true"
+
+/* Lines which COMMAND prints to stdout around its steady-state phase. */
+#define START_MARKER "start"
+#define END_MARKER   "end"
+
+/* Longest line of output from COMMAND that is checked for markers. */
+#define MAX_LINE 256
+
+/* Which clock should we time with by default? Options are:
  *
  * CLOCK_REALTIME
  * CLOCK_REALTIME_COARSE
@@ -45,10 +113,16 @@
  * CLOCK_PROCESS_CPUTIME_ID
  * CLOCK_THREAD_CPUTIME_ID
  *
- * The program clock_res.c can be used to determine the resolution of these
- * timers on a particular platform. COARSE timers have lower resolutions.
+ * The program clock_res.c can be used to determine the resolution and cost
+ * of these timers on a particular platform. COARSE timers have lower
+ * resolutions. Any of them can be chosen at runtime with --clock.
  */
-#define TIMER CLOCK_MONOTONIC
+#define DEFAULT_CLOCK CLOCK_MONOTONIC
+
+/* When choosing a clock automatically, the largest error allowed in timing a
+ * run, as a fraction of its length.
+ */
+#define AUTO_CLOCK_ERROR 0.001
 
 /* Filenames. */
 #define CSV_RESULTS   "results.csv"
@@ -57,6 +131,19 @@
 #define CSV_SUMMARY   "summary.csv"
 #define JSON_SUMMARY  "summary.json"
 #define LATEX_SUMMARY "summary.tex"
+#define SWEEP_SUMMARY "sweep.csv"
+#define STATE         "state.csv"
+#define MERGED_STATE  "merged-state.csv"
+#define SAMPLES       "samples.csv"
+#define COMPARISON    "comparison.csv"
+#define SCALING       "scaling.csv"
+#define COPY_RESULTS  "copies.csv"
+
+/* Default slowdown of the median wall clock time counted as a regression. */
+#define DEFAULT_THRESHOLD 0.05
+
+/* In streaming mode, save the running summary every this many runs. */
+#define STATE_INTERVAL 1000
 
 /* The name of this program. */
 const char *program_name;
@@ -64,39 +151,159 @@ const char *program_name;
 /* Run in verbose, quiet or regular mode. */
 int verbose, quiet;
 
+/* Iterations to measure, and warm-up runs to discard before measuring. */
+int iterations = DEFAULT_ITERATIONS;
+int warmup;
+
+/* Target relative CI half-width. Zero means run a fixed -i iterations. */
+double precision;
+int min_iterations = DEFAULT_MIN_ITERATIONS;
+int max_iterations = DEFAULT_MAX_ITERATIONS;
+
+/* Output types. */
+int latex, csv, json;
+
+/* Time /bin/true rather than COMMAND. */
+int calibrate;
+
+/* How to start the child, and whether process creation is timed. */
+launch_method_t launch_method = LAUNCH_SPAWN;
+int exec_start;
+
+/* Attach performance counters to each child, warning once if they cannot
+ * count everything.
+ */
+int perf, perf_warned;
+
+/* Capture the stdout of COMMAND and time its phases. */
+int phases;
+
+/* Token hops per run of COMMAND, or zero if unknown. */
+double hops;
+
+/* How to bootstrap confidence intervals. The seed is fixed, so that the
+ * same results always give the same intervals.
+ */
+bootstrap_t bootstrap = { DEFAULT_RESAMPLES, 0, 0x5eedULL };
+
+/* Stream results to disk in constant memory. */
+int stream;
+
+/* Result store which every campaign is appended to, or NULL. */
+char *store_file;
+
+/* Swept parameters of the command being run, as NAME=VALUE pairs. */
+char *parameters;
+
+/* Microseconds between samples of the child while it runs, or zero for no
+ * sampling, and the thread taking the samples.
+ */
+long sample_interval;
+sampler_t sampler;
+
+/* Clock to time with, and whether to choose it from the length of a run. */
+clockid_t timer_clock = DEFAULT_CLOCK;
+int auto_clock;
+
+/* COMMAND resolved against PATH, so that execute() need not search. */
+char *executable;
+
 /* Prints usage information for this program exit. */
 void print_usage (FILE *stream, int exit_code);
 
 /* Parse a command from the user into a format suitable for execvp. */
 void parse_command(char *line, char **argv);
 
+/* Run all experiments on one command and write out the results. */
+int run_experiments(char *command, const char *prefix, statistics_t *stats);
+
+/* Merge saved running summaries and write out the combined statistics. */
+int run_merge(char **filenames, int num_files);
+
+/* Compare a baseline and a candidate result store. */
+int run_compare(const char *baseline_file, const char *candidate_file,
+                double threshold);
+
+/* Run all experiments on one of several jobs. */
+int run_job(char *command, const char *prefix);
+
+/* Run all experiments at every point of a parameter sweep. */
+int run_sweep(sweep_t *sweep, const char *template);
+
+/* Run all experiments on 1, 2, ... max_copies copies of a command at once. */
+int run_throughput(char *command, int max_copies, int cores_per_copy, int pin);
+
+/* Choose the cheapest clock fine enough to time runs like this one. */
+void choose_clock(result_t *result);
+
 /* Execute and time the command the user wishes to measure. */
 int execute(char **argv, const int iterations, result_t *result);
 
 /* Calculate the difference between two points in time. */
 struct timespec diff(struct timespec start, struct timespec end);
 
+/* Calculate the difference between two points in time in nanoseconds. */
+long long diff_ns(struct timespec start, struct timespec end);
 
-int main(int argc, char **argv) {
-    /* Iterations to measure. */
-    int iterations = DEFAULT_ITERATIONS;
+/* Drain the stdout of COMMAND, noting when the phase markers arrive. */
+int read_markers(int fd, struct timespec *start, struct timespec *end);
 
+
+int main(int argc, char **argv) {
     /* Command (and arguments) to be measured. */
     char *command = NULL;
-    char *args[MAX_ARGS];
 
-    /* Output type. Not implemented yet. */
-    int latex = 0, csv = 0, json = 0;
+    /* File listing commands to run concurrently, and CPUs to give each. */
+    char *job_file = NULL;
+    char **jobs = NULL;
+    int num_jobs, cores_per_job = 1, failed;
+
+    /* Most copies to run at once, -1 for as many as fit, and whether to pin
+     * each to its own CPUs.
+     */
+    int copies = 0, pin = 0;
+
+    char calibration_command[] = CALIBRATION_COMMAND;
+
+    /* Combine state files or compare stores rather than running anything. */
+    int merge = 0, compare = 0;
+    double threshold = DEFAULT_THRESHOLD;
+
+    /* Parameters to sweep over. */
+    sweep_t sweep = { 0 };
 
     /* Valid short options. */
-    const char *short_options = "hc:i:ljsvq";
-    int next_opt, i;
+    const char *short_options = "hc:i:p:m:M:w:L:eCPH:SX:J:k:B:T:ZGKt:D:A:Q:N:ljsvq";
+    int next_opt;
 
     /* Valid long options. */
     const struct option long_options[] = {
         { "help",       0, NULL, 'h' },
         { "command",    1, NULL, 'c' },
         { "iterations", 1, NULL, 'i' },
+        { "precision",  1, NULL, 'p' },
+        { "min-iterations", 1, NULL, 'm' },
+        { "max-iterations", 1, NULL, 'M' },
+        { "warmup",     1, NULL, 'w' },
+        { "launch",     1, NULL, 'L' },
+        { "exec-start", 0, NULL, 'e' },
+        { "calibrate",  0, NULL, 'C' },
+        { "perf",       0, NULL, 'P' },
+        { "hops",       1, NULL, 'H' },
+        { "phases",     0, NULL, 'S' },
+        { "sweep",      1, NULL, 'X' },
+        { "jobs",       1, NULL, 'J' },
+        { "cores-per-job", 1, NULL, 'k' },
+        { "bootstrap",  1, NULL, 'B' },
+        { "threads",    1, NULL, 'T' },
+        { "stream",     0, NULL, 'Z' },
+        { "merge",      0, NULL, 'G' },
+        { "compare",    0, NULL, 'K' },
+        { "threshold",  1, NULL, 't' },
+        { "store",      1, NULL, 'D' },
+        { "sample",     1, NULL, 'A' },
+        { "clock",      1, NULL, 'Q' },
+        { "copies",     1, NULL, 'N' },
         { "latex",      0, NULL, 'l' },
         { "json",       0, NULL, 'j' },
         { "csv",        0, NULL, 's' },
@@ -117,16 +324,103 @@ int main(int argc, char **argv) {
                command = optarg;
                break;
             case 'i': /* -i or --iterations */
-               iterations = atoi(optarg);
+               iterations = atoi(optarg); /* Global. */
+               break;
+            case 'p': /* -p or --precision */
+               precision = atof(optarg); /* Global. */
+               break;
+            case 'm': /* -m or --min-iterations */
+               min_iterations = atoi(optarg); /* Global. */
+               break;
+            case 'M': /* -M or --max-iterations */
+               max_iterations = atoi(optarg); /* Global. */
+               break;
+            case 'w': /* -w or --warmup */
+               warmup = atoi(optarg); /* Global. */
+               break;
+            case 'L': /* -L or --launch */
+               if (launch_parse_method(optarg, &launch_method) != 0) {
+                   print_usage (stderr, 1);
+               }
+               break;
+            case 'e': /* -e or --exec-start */
+               exec_start = 1; /* Global. */
+               break;
+            case 'C': /* -C or --calibrate */
+               calibrate = 1; /* Global. */
+               break;
+            case 'P': /* -P or --perf */
+               perf = 1; /* Global. */
+               break;
+            case 'H': /* -H or --hops */
+               hops = atof(optarg); /* Global. */
+               break;
+            case 'S': /* -S or --phases */
+               phases = 1; /* Global. */
+               break;
+            case 'X': /* -X or --sweep */
+               if (sweep_add_axis(&sweep, optarg) != 0) {
+                   fprintf(stderr, "Invalid sweep: %s\n", optarg);
+                   print_usage (stderr, 1);
+               }
+               break;
+            case 'J': /* -J or --jobs */
+               job_file = optarg;
+               break;
+            case 'k': /* -k or --cores-per-job */
+               cores_per_job = atoi(optarg);
+               pin = 1;
+               break;
+            case 'B': /* -B or --bootstrap */
+               bootstrap.resamples = atoi(optarg); /* Global. */
+               break;
+            case 'T': /* -T or --threads */
+               bootstrap.threads = atoi(optarg); /* Global. */
+               break;
+            case 'Z': /* -Z or --stream */
+               stream = 1; /* Global. */
+               break;
+            case 'G': /* -G or --merge */
+               merge = 1;
+               break;
+            case 'K': /* -K or --compare */
+               compare = 1;
+               break;
+            case 't': /* -t or --threshold */
+               threshold = atof(optarg);
+               break;
+            case 'D': /* -D or --store */
+               store_file = optarg; /* Global. */
+               break;
+            case 'A': /* -A or --sample */
+               sample_interval = (long)(atof(optarg) * 1000); /* Global. */
+               break;
+            case 'Q': /* -Q or --clock */
+               if (strcmp(optarg, "auto") == 0) {
+                   auto_clock = 1; /* Global. */
+               } else if (clock_parse(optarg, &timer_clock) != 0) {
+                   fprintf(stderr, "Unknown clock: %s\n", optarg);
+                   print_usage (stderr, 1);
+               } else if (!clock_system_wide(timer_clock)) {
+                   fprintf(stderr, "Clock %s cannot time COMMAND, only "
+                           "this process\n", optarg);
+                   print_usage (stderr, 1);
+               }
+               break;
+            case 'N': /* -N or --copies */
+               copies = strcmp(optarg, "max") == 0 ? -1 : atoi(optarg);
+               if (copies == 0) {
+                   print_usage (stderr, 1);
+               }
                break;
             case 'l': /* -l or --latex */
-               latex = 1;
+               latex = 1; /* Global. */
                break;
             case 'j': /* -j or --json */
-               json = 1;
+               json = 1; /* Global. */
                break;
             case 's': /* -s or --csv */
-               csv = 1;
+               csv = 1; /* Global. */
                break;
             case 'v': /* -v or --verbose */
                verbose = 1; /* Global. */
@@ -156,6 +450,107 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    if (precision < 0 || warmup < 0) {
+        errno = EINVAL;
+        perror("Precision and warm-up runs must not be negative");
+        exit(EXIT_FAILURE);
+        return 1;
+    }
+
+    if (precision > 0) {
+        /* A CI needs at least two samples to estimate the variance. */
+        if (min_iterations < 2 || max_iterations < min_iterations) {
+            errno = EINVAL;
+            perror("Need 2 <= min-iterations <= max-iterations");
+            exit(EXIT_FAILURE);
+            return 1;
+        }
+    }
+
+    if (bootstrap.resamples < 0 || bootstrap.threads < 0) {
+        errno = EINVAL;
+        perror("Resamples and threads must not be negative");
+        exit(EXIT_FAILURE);
+        return 1;
+    }
+    if (bootstrap.threads == 0) {
+        bootstrap.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    if (stream && store_file != NULL) {
+        errno = EINVAL;
+        perror("Cannot store results which are streamed");
+        exit(EXIT_FAILURE);
+        return 1;
+    }
+
+    if (cores_per_job < 1) {
+        errno = EINVAL;
+        perror("Each job needs at least one core");
+        exit(EXIT_FAILURE);
+        return 1;
+    }
+
+    if (copies != 0 && (job_file != NULL || sweep.num_axes > 0 || stream ||
+                        store_file != NULL || precision > 0 || perf ||
+                        phases || sample_interval > 0 || auto_clock)) {
+        errno = EINVAL;
+        perror("Copies cannot be combined with -J, -X, -Z, -D, -p, -P, -S, "
+               "-A or -Q auto");
+        exit(EXIT_FAILURE);
+        return 1;
+    }
+
+    if (job_file != NULL && sweep.num_axes > 0) {
+        errno = EINVAL;
+        perror("Jobs cannot be combined with -X");
+        exit(EXIT_FAILURE);
+        return 1;
+    }
+
+    if (calibrate) {
+        command = calibration_command;
+    }
+
+    if (merge) {
+        if (optind >= argc) {
+            errno = EINVAL;
+            perror("Must name at least one state file to merge");
+            exit(EXIT_FAILURE);
+            return 1;
+        }
+        return run_merge(argv + optind, argc - optind);
+    }
+
+    if (compare) {
+        if (optind != argc - 2) {
+            errno = EINVAL;
+            perror("Must name a baseline and a candidate store to compare");
+            exit(EXIT_FAILURE);
+            return 1;
+        }
+        return run_compare(argv[optind], argv[optind + 1], threshold);
+    }
+
+    /* Run a whole campaign of commands side by side. */
+    if (job_file != NULL) {
+        num_jobs = jobs_read(job_file, &jobs);
+        if (num_jobs < 0) {
+            perror("Could not read job file");
+            exit(EXIT_FAILURE);
+            return 1;
+        }
+        failed = jobs_run(jobs, num_jobs, cores_per_job, run_job, verbose);
+        jobs_free(jobs, num_jobs);
+        if (failed < 0) {
+            errno = EINVAL;
+            perror("Not enough CPUs for a single job");
+            exit(EXIT_FAILURE);
+            return 1;
+        }
+        return failed == 0 ? 0 : 1;
+    }
+
     if (command == NULL) {
         errno = EINVAL;
         perror("Must specify a command to measure");
@@ -163,22 +558,619 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    /* Allocate an array of results. */
-    result_t **results = malloc(sizeof(result_t*) * (iterations + 1));
-    for (i = 0; i < iterations; i++) {
-        results[i] = result_new();
+    if (copies != 0) {
+        return run_throughput(command, copies, cores_per_job, pin);
+    }
+
+    if (sweep.num_axes > 0) {
+        failed = run_sweep(&sweep, command);
+        sweep_free(&sweep);
+        return failed;
+    }
+
+    return run_experiments(command, "", NULL);
+}
+
+
+/* Merge running summaries saved by earlier runs in streaming mode, e.g. by
+ * several shards of one soak test, and write out the combined statistics.
+ * The merged state is saved again, so merges can themselves be merged.
+ * Fails if a file is not a state file, or no wall clock times were saved.
+ */
+int run_merge(char **filenames, int num_files) {
+    statistics_t *stats = statistics_new();
+    accumulator_t acc;
+    int i;
+
+    accumulator_init(&acc);
+    for (i = 0; i < num_files; i++) {
+        if (verbose) {
+            printf("Merging %s.\n", filenames[i]);
+        }
+        if (0 != accumulator_read_csv(&acc, filenames[i])) {
+            fprintf(stderr, "Could not read file %s\n.", filenames[i]);
+            accumulator_free(&acc);
+            statistics_free(stats);
+            return 1;
+        }
+    }
+    if (acc.metric[METRIC_WALL_CLOCK].count == 0) {
+        fprintf(stderr, "No wall clock times to merge.\n");
+        accumulator_free(&acc);
+        statistics_free(stats);
+        return 1;
+    }
+    statistics_from_accumulator(stats, &acc);
+    stats->hops = hops;
+    print_statistics(stats);
+
+    if (verbose) {
+        printf("Writing merged state to %s.\n", MERGED_STATE);
+    }
+    if (0 != accumulator_write_csv(&acc, MERGED_STATE)) {
+        fprintf(stderr, "Could not write to file %s\n.", MERGED_STATE);
+    }
+    if (csv && 0 != statistics_write_csv(stats, CSV_SUMMARY,
+                                         stats->num_experiments)) {
+        fprintf(stderr, "Could not write to file %s\n.", CSV_SUMMARY);
+    }
+    if (json && 0 != statistics_write_json(stats, JSON_SUMMARY,
+                                           stats->num_experiments)) {
+        fprintf(stderr, "Could not write to file %s\n.", JSON_SUMMARY);
+    }
+    if (latex && 0 != statistics_write_latex(stats, LATEX_SUMMARY,
+                                             stats->num_experiments)) {
+        fprintf(stderr, "Could not write to file %s\n.", LATEX_SUMMARY);
+    }
+    accumulator_free(&acc);
+    statistics_free(stats);
+    return 0;
+}
+
+
+/* Non-zero if every group in a store is of the same command. */
+static int single_command(store_group_t *groups, int num_groups) {
+    int i;
+    for (i = 1; i < num_groups; i++) {
+        if (strcmp(store_command(groups[i].runs[0]),
+                   store_command(groups[0].runs[0])) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/* The index of the group with the same command and parameters as run, or
+ * with the same parameters only if by_parameters, or -1 if there is none.
+ */
+static int find_group(store_group_t *groups, int num_groups,
+                      const store_run_t *run, int by_parameters) {
+    int i;
+    for (i = 0; i < num_groups; i++) {
+        if ((by_parameters || strcmp(store_command(groups[i].runs[0]),
+                                     store_command(run)) == 0) &&
+            strcmp(store_parameters(groups[i].runs[0]),
+                   store_parameters(run)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/* Print the command and parameters of a group. */
+static void print_group(FILE *stream, const store_group_t *group) {
+    const store_run_t *first = group->runs[0];
+    fprintf(stream, "%s", store_command(first));
+    if (store_parameters(first)[0] != '\0') {
+        fprintf(stream, " [%s]", store_parameters(first));
+    }
+}
+
+
+/* Compare one baseline group with its candidate group, writing the
+ * comparison to COMPARISON prefixed by prefix. Returns 0, 2 if wall clock
+ * time regressed, or 1 if either group holds no wall clock times.
+ */
+static int compare_groups(store_group_t *base_group,
+                          store_group_t *cand_group, const char *prefix,
+                          double threshold) {
+    comparison_t *comparison;
+    results_t *baseline, *candidate;
+    char filename[64];
+    int regressed;
+
+    baseline = store_group_results(base_group);
+    candidate = store_group_results(cand_group);
+    if (baseline == NULL || candidate == NULL ||
+        results_recorded(baseline, METRIC_WALL_CLOCK) == 0 ||
+        results_recorded(candidate, METRIC_WALL_CLOCK) == 0) {
+        fprintf(stderr, "No wall clock times to compare for ");
+        print_group(stderr, base_group);
+        fprintf(stderr, ".\n");
+        if (candidate != NULL) {
+            results_free(candidate);
+        }
+        if (baseline != NULL) {
+            results_free(baseline);
+        }
+        return 1;
+    }
+
+    comparison = calloc(1, sizeof(comparison_t));
+    compare_results(baseline, candidate, comparison, &bootstrap);
+    if (verbose) {
+        printf("\nBaseline:");
+        print_statistics(&comparison->baseline);
+        printf("\nCandidate:");
+        print_statistics(&comparison->candidate);
+    }
+    print_comparison(comparison, threshold);
+
+    regressed = comparison_regressed(comparison, METRIC_WALL_CLOCK, threshold);
+    printf(" %s\n", regressed ? "Wall clock time regressed." :
+           "No wall clock time regression.");
+
+    if (csv) {
+        sprintf(filename, "%s%s", prefix, COMPARISON);
+        if (verbose) {
+            printf("Writing comparison to %s.\n", filename);
+        }
+        if (0 != comparison_write_csv(comparison, filename)) {
+            fprintf(stderr, "Could not write to file %s\n.", filename);
+        }
+    }
+    free(comparison);
+    results_free(candidate);
+    results_free(baseline);
+    return regressed ? 2 : 0;
+}
+
+
+/* Compare the runs in a baseline and a candidate store, e.g. from before
+ * and after a runtime upgrade. Runs are grouped by command and parameters,
+ * as timerstore groups them, and each baseline group is compared with the
+ * candidate group of the same command and parameters, or of the same
+ * parameters if each store holds a single command. When there is more than
+ * one group, comparisons are prefixed groupN-. Returns 2 if the median wall
+ * clock time of any group grew significantly by more than threshold, and 1
+ * if a store cannot be read, is empty, or has a group with no match or no
+ * wall clock times, so that missing results never pass as no regression.
+ */
+int run_compare(const char *baseline_file, const char *candidate_file,
+                double threshold) {
+    const char *filenames[2];
+    store_t stores[2];
+    store_group_t *groups[2] = { NULL, NULL };
+    const store_run_t *run;
+    char prefix[32] = "";
+    int num_groups[2] = { 0, 0 }, *matched, by_parameters, failed = 0,
+        regressed = 0, result, i, j;
+
+    filenames[0] = baseline_file;
+    filenames[1] = candidate_file;
+    for (i = 0; i < 2; i++) {
+        if (store_open(&stores[i], filenames[i]) != 0) {
+            fprintf(stderr, "Could not read file %s\n.", filenames[i]);
+            failed = 1;
+            continue;
+        }
+        for (run = store_next(&stores[i], NULL); run != NULL;
+             run = store_next(&stores[i], run)) {
+            store_group_add(&groups[i], &num_groups[i], run);
+        }
+        if (num_groups[i] == 0) {
+            fprintf(stderr, "No runs in %s.\n", filenames[i]);
+            failed = 1;
+        }
+    }
+
+    by_parameters = single_command(groups[0], num_groups[0]) &&
+                    single_command(groups[1], num_groups[1]);
+    matched = calloc((size_t)num_groups[1] + 1, sizeof(int));
+    for (i = 0; !failed && i < num_groups[0]; i++) {
+        j = find_group(groups[1], num_groups[1], groups[0][i].runs[0],
+                       by_parameters);
+        if (j < 0) {
+            fprintf(stderr, "No runs of ");
+            print_group(stderr, &groups[0][i]);
+            fprintf(stderr, " in %s.\n", candidate_file);
+            failed = 1;
+            continue;
+        }
+        matched[j] = 1;
+        if (num_groups[0] > 1) {
+            sprintf(prefix, "group%d-", i);
+            printf("\nGroup %d: ", i);
+            print_group(stdout, &groups[0][i]);
+            printf("\n");
+        }
+        result = compare_groups(&groups[0][i], &groups[1][j], prefix,
+                                threshold);
+        failed |= result == 1;
+        regressed |= result == 2;
+    }
+    for (j = 0; !failed && j < num_groups[1]; j++) {
+        if (!matched[j]) {
+            fprintf(stderr, "No runs of ");
+            print_group(stderr, &groups[1][j]);
+            fprintf(stderr, " in %s.\n", baseline_file);
+            failed = 1;
+        }
+    }
+    free(matched);
+
+    for (i = 0; i < 2; i++) {
+        store_groups_free(groups[i], num_groups[i]);
+        store_close(&stores[i]);
+    }
+    return failed ? 1 : regressed ? 2 : 0;
+}
+
+
+/* Run all experiments on one of several jobs. */
+int run_job(char *command, const char *prefix) {
+    return run_experiments(command, prefix, NULL);
+}
+
+
+/* Run all experiments at every point of a parameter sweep, and write a
+ * summary table with one row per point, keyed by the parameter values.
+ * Output files for point N are prefixed with "pointN-".
+ */
+int run_sweep(sweep_t *sweep, const char *template) {
+    statistics_t *stats = statistics_new();
+    char prefix[32], *command, *parsed, *p;
+    int points = sweep_num_points(sweep), point, axis, failed;
+    size_t length;
+    FILE *fp;
+
+    /* Check every parameter is used before running anything. */
+    command = sweep_command(sweep, template, 0);
+    if (command == NULL) {
+        errno = EINVAL;
+        perror("Every swept parameter must appear as {NAME} in COMMAND");
+        statistics_free(stats);
+        return 1;
+    }
+    free(command);
+
+    fp = fopen(SWEEP_SUMMARY, "w+");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not write to file %s\n.", SWEEP_SUMMARY);
+        statistics_free(stats);
+        return 1;
+    }
+
+    for (point = 0; point < points; point++) {
+        command = sweep_command(sweep, template, point);
+        if (verbose) {
+            printf("\nSweep point %d of %d: %s\n", point + 1, points, command);
+        }
+
+        /* Label the point with its values, for the result store. */
+        for (axis = 0, length = 1; axis < sweep->num_axes; axis++) {
+            length += strlen(sweep->axes[axis].name) +
+                      strlen(sweep_value(sweep, axis, point)) + 2;
+        }
+        parameters = p = malloc(length); /* Global. */
+        for (axis = 0; axis < sweep->num_axes; axis++) {
+            p += sprintf(p, "%s%s=%s", axis > 0 ? "," : "",
+                         sweep->axes[axis].name,
+                         sweep_value(sweep, axis, point));
+        }
+
+        /* run_experiments() splits its command up in place. */
+        snprintf(prefix, sizeof(prefix), "point%d-", point);
+        parsed = strdup(command);
+        failed = run_experiments(parsed, prefix, stats);
+        free(parsed);
+        free(parameters);
+        parameters = NULL;
+        if (failed != 0) {
+            free(command);
+            break;
+        }
+
+        /* The table is written as we go, so a failure loses nothing. */
+        if (point == 0) {
+            for (axis = 0; axis < sweep->num_axes; axis++) {
+                fprintf(fp, "%s,", sweep->axes[axis].name);
+            }
+            fprintf(fp, "Command,");
+            statistics_write_csv_header(fp, stats);
+        }
+        for (axis = 0; axis < sweep->num_axes; axis++) {
+            fprintf(fp, "%s,", sweep_value(sweep, axis, point));
+        }
+        fprintf(fp, "\"%s\",", command);
+        statistics_write_csv_row(fp, stats);
+        fflush(fp);
+        free(command);
+    }
+
+    if (verbose) {
+        printf("Writing sweep summary to %s.\n", SWEEP_SUMMARY);
+    }
+    fclose(fp);
+    statistics_free(stats);
+    return point == points ? 0 : 1;
+}
+
+
+/* Run all experiments on 1, 2, ... max_copies copies of a command at once,
+ * each copy released from the same gate so they all start together.
+ *
+ * Every experiment records each copy as a result of its own, timed from the
+ * release to its exit, plus the makespan until the last copy exited. Copies
+ * finishing hops each in that makespan gives the throughput, and throughput
+ * divided by copies times the throughput of one copy alone gives the scaling
+ * efficiency, which falls below one as copies contend for the scheduler,
+ * caches and memory bandwidth. One row per number of copies is written to
+ * the scaling table, and with -s every copy of every experiment is written
+ * to the copy results.
+ */
+int run_throughput(char *command, int max_copies, int cores_per_copy,
+                   int pin) {
+    char *args[MAX_ARGS];
+    throughput_t throughput;
+    statistics_t *stats = statistics_new();
+    results_t *results;
+    result_t *copy_results;
+    running_t makespan;
+    long long makespan_ns;
+    long double rate, single_rate = 0, efficiency;
+    int *cpus, num_cpus, limit, copies, failed = 0, i, j;
+    FILE *fp, *copies_fp = NULL;
+
+    parse_command(command, args);
+    executable = launch_resolve(args[0]); /* Global. */
+    if (executable == NULL) {
+        fprintf(stderr, "COMMAND ( %s ) not found.\n", args[0]);
+        exit(EXIT_FAILURE);
+        return 1;
+    }
+
+    /* Pinned copies each need cores_per_copy CPUs of their own. */
+    num_cpus = jobs_cpus(&cpus);
+    limit = pin ? num_cpus / cores_per_copy : num_cpus;
+    if (max_copies < 0) {
+        max_copies = limit;
+    }
+    if (limit < 1 || (pin && max_copies > limit)) {
+        errno = EINVAL;
+        perror("Not enough CPUs to pin every copy");
+        exit(EXIT_FAILURE);
+        return 1;
+    }
+    throughput.path = executable;
+    throughput.argv = args;
+    throughput.cpus = cpus;
+    throughput.cores_per_copy = pin ? cores_per_copy : 0;
+    throughput.quiet = quiet;
+    throughput.clock = timer_clock;
+    if (verbose) {
+        printf("Running up to %d copies of %s", max_copies, executable);
+        if (pin) {
+            printf(", each pinned to %d CPUs", cores_per_copy);
+        }
+        printf(".\n");
+    }
+
+    fp = fopen(SCALING, "w+");
+    if (fp == NULL) {
+        fprintf(stderr, "Could not write to file %s\n.", SCALING);
+        exit(EXIT_FAILURE);
+        return 1;
+    }
+    if (csv) {
+        copies_fp = fopen(COPY_RESULTS, "w+");
+        if (copies_fp == NULL) {
+            fprintf(stderr, "Could not write to file %s\n.", COPY_RESULTS);
+            exit(EXIT_FAILURE);
+            return 1;
+        }
+        fprintf(copies_fp, "Copies,Copy,First CPU,");
+        result_write_csv_header(copies_fp);
+    }
+
+    printf("%-7s | %-13s | %-11s | %-14s | %-14s | %s\n",
+           "Copies", "Makespan (s)", "Std. dev.", "Slowest copy",
+           hops > 0 ? "Messages/s" : "Runs/s", "Efficiency");
+    copy_results = malloc(sizeof(result_t) * max_copies);
+    for (copies = 1; copies <= max_copies && failed == 0; copies++) {
+        results = results_new(iterations * copies);
+        running_init(&makespan);
+        for (i = -warmup; i < iterations && failed == 0; i++) {
+            if (verbose) {
+                printf("\nRunning %s %d of %d copies.\n",
+                       i < 0 ? "warm-up with" : "experiment with",
+                       copies, max_copies);
+            }
+            failed = throughput_run(&throughput, copies, copy_results,
+                                    &makespan_ns);
+            if (failed != 0) {
+                fprintf(stderr, "%d of %d copies of COMMAND ( %s ) failed.\n",
+                        failed < 0 ? copies : failed, copies, command);
+                break;
+            }
+            if (i < 0) {
+                continue;
+            }
+            running_update(&makespan, makespan_ns / 1e9L);
+            for (j = 0; j < copies; j++) {
+                results_add(results, &copy_results[j]);
+                if (copies_fp != NULL) {
+                    fprintf(copies_fp, "%d,%d,%d,", copies, j,
+                            pin ? cpus[j * cores_per_copy] : -1);
+                    result_write_csv_row(copies_fp, &copy_results[j], i);
+                }
+            }
+        }
+        if (failed == 0) {
+            summarise_statistics(results, stats, &bootstrap);
+            stats->num_warmup = warmup;
+            stats->hops = hops;
+            rate = copies * (hops > 0 ? hops : 1) / makespan.mean;
+            if (copies == 1) {
+                single_rate = rate;
+            }
+            efficiency = rate / (copies * single_rate);
+            printf("%-7d | %-13.6Lf | %-11.6Lf | %-14.6Lf | %-14.6Lg | "
+                   "%.3Lf\n", copies, makespan.mean, running_stdev(&makespan),
+                   stats->metric[METRIC_WALL_CLOCK].max, rate, efficiency);
+
+            /* The table is written as we go, so a failure loses nothing. */
+            if (copies == 1) {
+                fprintf(fp, "Copies,Makespan (s),Makespan std. dev. (s),"
+                        "%s,Scaling efficiency,",
+                        hops > 0 ? "Messages per second" : "Runs per second");
+                statistics_write_csv_header(fp, stats);
+            }
+            fprintf(fp, "%d,%.9Lf,%.9Lf,%.6Lg,%.6Lf,", copies, makespan.mean,
+                    running_stdev(&makespan), rate, efficiency);
+            statistics_write_csv_row(fp, stats);
+            fflush(fp);
+        }
+        results_free(results);
+    }
+
+    if (verbose) {
+        printf("Writing scaling table to %s.\n", SCALING);
+    }
+    fclose(fp);
+    if (copies_fp != NULL) {
+        fclose(copies_fp);
     }
-    results[i] = (result_t*)NULL;
+    free(copy_results);
+    free(cpus);
+    free(executable);
+    statistics_free(stats);
+    return failed == 0 ? 0 : 1;
+}
+
 
-    /* Parse the command we are going to execute. */
+/* Build the name of an output file, e.g. "job3-" + "results.csv". */
+static char * output_filename(const char *prefix, const char *name) {
+    char *filename = malloc(strlen(prefix) + strlen(name) + 1);
+    sprintf(filename, "%s%s", prefix, name);
+    return filename;
+}
+
+
+/* Run all experiments on one command and write out the results.
+ *
+ * Output files are named with the given prefix, which is empty unless this
+ * command is one of several jobs or sweep points. If stats is not NULL it
+ * receives the summary statistics. Returns 0 on success.
+ *
+ * Every run is added to a running summary as it completes. In streaming
+ * mode that summary is all that is kept: a single result is reused for each
+ * run, and written to the CSV results file straight away.
+ */
+int run_experiments(char *command, const char *prefix, statistics_t *stats) {
+    /* Command (and arguments) to be measured. */
+    char *args[MAX_ARGS];
+    char *filename, *state_filename, *command_line = NULL;
+    int runs = iterations, i;
+    result_t *result = result_new();
+    results_t *results = NULL;
+    accumulator_t acc;
+    FILE *stream_fp = NULL, *samples_fp = NULL;
+
+    /* In precision mode, allocate enough results for the worst case. */
+    if (precision > 0) {
+        runs = max_iterations;
+    }
+
+    /* Allocate a buffer for every result, unless streaming. */
+    if (!stream) {
+        results = results_new(runs);
+    }
+    accumulator_init(&acc);
+
+    /* Parse the command we are going to execute, which splits it up. */
+    if (store_file != NULL) {
+        command_line = strdup(command);
+    }
     parse_command(command, args);
 
-    /* Run experiments. */
-    for (i = 0; i < iterations; i++) {
+    /* Search PATH once, rather than once per experiment. */
+    executable = launch_resolve(args[0]);
+    if (executable == NULL) {
+        fprintf(stderr, "COMMAND ( %s ) not found.\n", args[0]);
+        exit(EXIT_FAILURE);
+        return 1;
+    }
+    if (verbose) {
+        printf("Launching %s with %s.\n", executable,
+               launch_method_name(perf ? LAUNCH_FORK : launch_method));
+    }
+
+    /* Open the results file before running anything, so that it fills up
+     * as the runs complete.
+     */
+    if (stream && csv) {
+        filename = output_filename(prefix, CSV_RESULTS);
+        if (verbose) {
+            printf("Streaming results to %s.\n", filename);
+        }
+        stream_fp = fopen(filename, "w+");
+        if (stream_fp == NULL) {
+            fprintf(stderr, "Could not write to file %s\n.", filename);
+            exit(EXIT_FAILURE);
+            return 1;
+        }
+        result_write_csv_header(stream_fp);
+        free(filename);
+    }
+    if (sample_interval > 0) {
+        filename = output_filename(prefix, SAMPLES);
+        if (verbose) {
+            printf("Sampling every %ld us to %s.\n", sample_interval, filename);
+        }
+        samples_fp = fopen(filename, "w+");
+        if (samples_fp == NULL) {
+            fprintf(stderr, "Could not write to file %s\n.", filename);
+            exit(EXIT_FAILURE);
+            return 1;
+        }
+        sampler_write_csv_header(samples_fp);
+        free(filename);
+    }
+    state_filename = output_filename(prefix, STATE);
+
+    /* Warm up caches, JITs and the like. These results are thrown away.
+     * When choosing a clock, there is always at least one such run.
+     */
+    for (i = 0; i < warmup || (auto_clock && i == 0); i++) {
+        if (verbose && i < warmup) {
+            printf("\nRunning warm-up: %d.\n", i);
+        } else if (verbose) {
+            printf("\nRunning pilot run to choose a clock.\n");
+        }
+        if (execute(args, runs, result) != 0) {
+            fprintf(stderr,
+                    "COMMAND ( %s ) failed: %s\n",
+                    command,
+                    strerror(EPIPE));
+            exit(EXIT_FAILURE);
+            return 1;
+        }
+        if (auto_clock && i == 0) {
+            choose_clock(result);
+        }
+    }
+
+    /* Run experiments. In precision mode stop as soon as the wall clock
+     * estimate is tight enough, which leaves runs <= max_iterations.
+     */
+    for (i = 0; i < runs; i++) {
         if (verbose) {
             printf("\nRunning experiment: %d.\n", i);
         }
-        if (execute(args, iterations, results[i]) != 0) {
+        if (execute(args, runs, result) != 0) {
             fprintf(stderr,
                     "COMMAND ( %s ) failed: %s\n",
                     command,
@@ -186,68 +1178,171 @@ int main(int argc, char **argv) {
             exit(EXIT_FAILURE);
             return 1;
         }
+        accumulator_add(&acc, result);
+        if (results != NULL) {
+            results_add(results, result);
+        }
+        if (stream_fp != NULL) {
+            result_write_csv_row(stream_fp, result, i);
+            fflush(stream_fp);
+        }
+        if (samples_fp != NULL) {
+            sampler_write_csv_rows(samples_fp, &sampler, i);
+        }
+        /* Checkpoint the summary, so a crash loses at most an interval. */
+        if (stream && (i + 1) % STATE_INTERVAL == 0) {
+            accumulator_write_csv(&acc, state_filename);
+        }
+        if (precision > 0 && i + 1 >= min_iterations &&
+            running_precision(&acc.metric[METRIC_WALL_CLOCK]) <= precision) {
+            i++;
+            break;
+        }
+    }
+    if (precision > 0) {
+        if (i == max_iterations &&
+            running_precision(&acc.metric[METRIC_WALL_CLOCK]) > precision) {
+            fprintf(stderr,
+                    "Target precision %g not reached after %d runs.\n",
+                    precision, i);
+        }
+        if (verbose) {
+            printf("\nStopped after %d of at most %d runs.\n",
+                   i, max_iterations);
+        }
+        runs = i;
     }
 
-    /* Allocate memory for a summary of the results. */
-    statistics_t *stats = statistics_new();
+    if (stream_fp != NULL) {
+        fclose(stream_fp);
+    }
+    if (samples_fp != NULL) {
+        fclose(samples_fp);
+    }
+    if (stream) {
+        if (verbose) {
+            printf("Writing running summary to %s.\n", state_filename);
+        }
+        if (0 != accumulator_write_csv(&acc, state_filename)) {
+            fprintf(stderr, "Could not write to file %s\n.", state_filename);
+        }
+    }
+    free(state_filename);
 
-    /* Summarise results statistics. */
-    summarise_statistics(results, stats, iterations);
+    /* Allocate memory for a summary of the results, unless the caller did. */
+    int own_summary = (stats == NULL);
+    statistics_t *summary = own_summary ? statistics_new() : stats;
+    stats = summary;
+
+    /* Summarise results statistics. Percentiles are exact unless streaming,
+     * when they are estimated from histograms.
+     */
+    if (stream) {
+        statistics_from_accumulator(stats, &acc);
+    } else {
+        summarise_statistics(results, stats, &bootstrap);
+    }
+    stats->num_warmup = warmup;
+    stats->hops = hops;
     if (verbose) {
         print_statistics(stats);
     }
 
-    /* Write results and summary to disk. */
-    if (csv) {
+    /* Keep every result, alongside those of earlier campaigns. */
+    if (store_file != NULL) {
+        store_info_t info = { command_line, parameters, warmup, hops };
         if (verbose) {
-            printf("Writing results to %s.\n", CSV_RESULTS);
+            printf("Appending results to %s.\n", store_file);
         }
-        if (0 != result_write_csv(results, CSV_RESULTS, iterations)) {
-            fprintf(stderr, "Could not write to file %s\n.", CSV_RESULTS);
+        if (0 != store_append(store_file, &info, results)) {
+            fprintf(stderr, "Could not write to file %s\n.", store_file);
         }
+        free(command_line);
+    }
+    if (calibrate) {
+        printf("Harness overhead (%s%s): %.0Lf ns per run, "
+               "std. deviation %.0Lf ns.\n",
+               launch_method_name(launch_method),
+               exec_start ? ", clock started after exec" : "",
+               stats->metric[METRIC_WALL_CLOCK].mean * 1000000000,
+               stats->metric[METRIC_WALL_CLOCK].stdev * 1000000000);
+    }
+
+    /* Write results and summary to disk. When streaming, the only results
+     * file is the CSV file which was written as the runs completed.
+     */
+    if (csv) {
+        if (!stream) {
+            filename = output_filename(prefix, CSV_RESULTS);
+            if (verbose) {
+                printf("Writing results to %s.\n", filename);
+            }
+            if (0 != result_write_csv(results, filename)) {
+                fprintf(stderr, "Could not write to file %s\n.", filename);
+            }
+            free(filename);
+        }
+        filename = output_filename(prefix, CSV_SUMMARY);
         if (verbose) {
-            printf("Writing summary statistics to %s.\n", CSV_SUMMARY);
+            printf("Writing summary statistics to %s.\n", filename);
         }
-        if (0 != statistics_write_csv(stats, CSV_SUMMARY, iterations)) {
-            fprintf(stderr, "Could not write to file %s\n.", CSV_SUMMARY);
+        if (0 != statistics_write_csv(stats, filename, runs)) {
+            fprintf(stderr, "Could not write to file %s\n.", filename);
         }
+        free(filename);
     }
     if (json) {
-        if (verbose) {
-            printf("Writing results to %s.\n", JSON_RESULTS);
-        }
-        if (0 != result_write_json(results, JSON_RESULTS, iterations)) {
-            fprintf(stderr, "Could not write to file %s\n.", JSON_RESULTS);
+        if (!stream) {
+            filename = output_filename(prefix, JSON_RESULTS);
+            if (verbose) {
+                printf("Writing results to %s.\n", filename);
+            }
+            if (0 != result_write_json(results, filename)) {
+                fprintf(stderr, "Could not write to file %s\n.", filename);
+            }
+            free(filename);
         }
+        filename = output_filename(prefix, JSON_SUMMARY);
         if (verbose) {
-            printf("Writing summary statistics to %s.\n", JSON_SUMMARY);
+            printf("Writing summary statistics to %s.\n", filename);
         }
-        if (0 != statistics_write_json(stats, JSON_SUMMARY, iterations)) {
-            fprintf(stderr, "Could not write to file %s\n.", JSON_SUMMARY);
+        if (0 != statistics_write_json(stats, filename, runs)) {
+            fprintf(stderr, "Could not write to file %s\n.", filename);
         }
+        free(filename);
     }
     if (latex) {
-        if (verbose) {
-            printf("Writing results to %s.\n", LATEX_RESULTS);
-        }
-        if (0 != result_write_latex(results, LATEX_RESULTS, iterations)) {
-            fprintf(stderr, "Could not write to file %s\n.", LATEX_RESULTS);
+        if (!stream) {
+            filename = output_filename(prefix, LATEX_RESULTS);
+            if (verbose) {
+                printf("Writing results to %s.\n", filename);
+            }
+            if (0 != result_write_latex(results, filename)) {
+                fprintf(stderr, "Could not write to file %s\n.", filename);
+            }
+            free(filename);
         }
+        filename = output_filename(prefix, LATEX_SUMMARY);
         if (verbose) {
-            printf("Writing summary statistics to %s.\n", LATEX_SUMMARY);
+            printf("Writing summary statistics to %s.\n", filename);
         }
-        if (0 != statistics_write_latex(stats, LATEX_SUMMARY, iterations)) {
-            fprintf(stderr, "Could not write to file %s\n.", LATEX_SUMMARY);
+        if (0 != statistics_write_latex(stats, filename, runs)) {
+            fprintf(stderr, "Could not write to file %s\n.", filename);
         }
+        free(filename);
     }
 
-    /* Deallocate array of results. */
-    for (i = 0; i < iterations; i++) {
-        result_free(results[i]);
+    /* Deallocate results. */
+    result_free(result);
+    if (results != NULL) {
+        results_free(results);
+    }
+    accumulator_free(&acc);
+    sampler_free(&sampler);
+    free(executable);
+    if (own_summary) {
+        statistics_free(summary);
     }
-
-    free(results);
-    statistics_free(stats);
     return 0;
 }
 
@@ -259,13 +1354,87 @@ void print_usage (FILE *stream, int exit_code) {
              " -h --help Display this usage information.\n"
              " -i --iterations Number of iterations to run COMMAND.\n"
              " -c --command COMMAND to be measured.\n"
-             " -l --latex Save results as a LaTeX table named results.tex. (not implemented)\n"
-             " -j --json Save results as a JSON file named results.json. (not implemented)\n"
-             " -s --csv Save results as a CSV file named results.csv. (not implemented)\n"
-             " -q --quiet Run in quiet mode. (not implemented)\n"
+             " -p --precision Run until the 95%% CI on wall clock time is within\n"
+             "                this fraction of the mean (e.g. 0.01), ignoring -i.\n"
+             " -m --min-iterations Fewest measured runs in precision mode (default %d).\n"
+             " -M --max-iterations Most measured runs in precision mode (default %d).\n"
+             " -w --warmup Number of warm-up runs of COMMAND to discard.\n"
+             " -L --launch How to start COMMAND: fork, vfork or spawn (default).\n"
+             " -e --exec-start Start the clock only once COMMAND has been exec'd.\n"
+             " -C --calibrate Measure the harness overhead by timing %s.\n"
+             " -P --perf Record performance counters for every run. Implies -L fork.\n"
+             " -H --hops Number of token hops per run, for per-hop figures.\n"
+             " -S --phases Time the setup, steady-state and teardown phases of\n"
+             "             COMMAND, delimited by '%s' and '%s' lines on its stdout.\n"
+             " -X --sweep NAME=VALUES Run COMMAND at every combination of swept\n"
+             "           values, substituted for {NAME} in COMMAND. VALUES is a\n"
+             "           list a,b,c or a range start:stop:xFACTOR or start:stop:+STEP.\n"
+             "           A table keyed by the values is saved as %s.\n"
+             " -J --jobs FILE of commands, one per line, to run concurrently\n"
+             "           on disjoint CPUs. Output files are prefixed jobN-.\n"
+             "           Cannot be combined with -X.\n"
+             " -k --cores-per-job Number of CPUs to pin each job to (default 1).\n"
+             "                    With -N, copies are only pinned if this is given.\n"
+             " -B --bootstrap Resamples behind each confidence interval (default %d).\n"
+             "                0 gives intervals from Student's t instead.\n"
+             " -T --threads Threads to bootstrap with (default: one per CPU).\n"
+             " -Z --stream Keep constant memory however many runs there are.\n"
+             "             A mergeable running summary is saved as %s, and\n"
+             "             with -s each run is appended to results.csv as it\n"
+             "             completes.\n"
+             " -G --merge Combine the state files named after the options\n"
+             "            into one summary, saved again as %s.\n"
+             " -K --compare Compare the two result stores named after the\n"
+             "              options, a baseline then a candidate, group by\n"
+             "              group of command and parameters. Exits with\n"
+             "              status 2 if wall clock time of any group\n"
+             "              regressed, or 1 if a group has no match or\n"
+             "              either store holds no wall clock times.\n"
+             " -t --threshold Smallest significant slowdown of the median\n"
+             "                counted as a regression (default %g).\n"
+             " -D --store Append the results of every run of COMMAND to this\n"
+             "            result store, for querying and exporting with timerstore.\n"
+             " -A --sample Every this many milliseconds (at least 1), sample the\n"
+             "             memory, threads, context switches and run-queue delay\n"
+             "             of COMMAND into a time series named %s.\n"
+             " -Q --clock Clock to time with (default %s), by name as listed\n"
+             "            by clock_res, e.g. monotonic_raw. 'auto' chooses the\n"
+             "            cheapest clock which resolves a warm-up run to %g%%.\n"
+             "            Only system-wide clocks can time COMMAND.\n"
+             " -N --copies Run 1, 2, ... up to this many copies of COMMAND at once,\n"
+             "             or 'max' for one per CPU (or per -k CPUs). The copies\n"
+             "             are released together, and the throughput and scaling\n"
+             "             efficiency of each number of copies is saved as %s.\n"
+             "             With -s, every copy is saved as %s.\n"
+             " -l --latex Save results as a LaTeX table named results.tex.\n"
+             " -j --json Save results as a JSON file named results.json.\n"
+             " -s --csv Save results as a CSV file named results.csv.\n"
+             " -q --quiet Run in quiet mode, discarding the output of COMMAND.\n"
              " -v --verbose Run in verbose mode.\n\n"
              "Example: Time 100 verbose runs of the command 'sleep 2':\n"
-             "   timer -v -i 100 -c 'sleep 2'\n");
+             "   timer -v -i 100 -c 'sleep 2'\n"
+             "Example: Time 'sleep 2' to within 1%%, after 2 warm-up runs:\n"
+             "   timer -v -w 2 -p 0.01 -c 'sleep 2'\n"
+             "Example: Time every command in campaign.txt, 4 CPUs per job:\n"
+             "   timer -s -J campaign.txt -k 4\n"
+             "Example: Time a ring over a grid of cycles and tokens:\n"
+             "   timer -X cycles=1000:1000000:x10 -X tokens=1,8,64,256 \\\n"
+             "         -c 'tokenring {cycles} {tokens}'\n"
+             "Example: Soak test in two shards, then combine the summaries:\n"
+             "   timer -Z -s -i 100000 -J shards.txt\n"
+             "   timer -G job0-%s job1-%s\n"
+             "Example: Fail if a ring got over 2%% slower after an upgrade:\n"
+             "   timer -D before.store -c 'tokenring 1000 8'\n"
+             "   (upgrade)\n"
+             "   timer -D after.store -c 'tokenring 1000 8'\n"
+             "   timer -K -t 0.02 before.store after.store\n"
+             "Example: See how rings on separate CPUs share the machine:\n"
+             "   timer -N max -k 1 -H 2048000 -c 'tokenring 1000 8'\n",
+             DEFAULT_MIN_ITERATIONS, DEFAULT_MAX_ITERATIONS,
+             CALIBRATION_COMMAND, START_MARKER, END_MARKER, SWEEP_SUMMARY,
+             DEFAULT_RESAMPLES, STATE, MERGED_STATE, DEFAULT_THRESHOLD,
+             SAMPLES, clock_name(DEFAULT_CLOCK), AUTO_CLOCK_ERROR * 100,
+             SCALING, COPY_RESULTS, STATE, STATE);
     exit (exit_code);
 }
 
@@ -290,50 +1459,167 @@ void parse_command(char *line, char **argv) {
 }
 
 
-/* Execute and time the command the user wishes to measure. */
+/* Choose the cheapest clock fine enough to time runs like this one, which
+ * was timed with the clock in use so far. The choice lasts until the next
+ * campaign of experiments chooses again.
+ */
+void choose_clock(result_t *result) {
+    long double run_ns = result_wall_clock(result) * 1e9L;
+    timer_clock = clock_choose((long long)(run_ns * AUTO_CLOCK_ERROR));
+    if (verbose) {
+        printf("Timing with %s.\n", clock_name(timer_clock));
+    }
+}
+
+
+/* Execute and time the command the user wishes to measure.
+ *
+ * The clock starts before the child is created, or once it has been exec'd
+ * if exec_start is set. Either way it stops when wait4() returns.
+ *
+ * With performance counters the child is held behind a gate until the
+ * counters are attached, and the counters only run from exec onwards.
+ *
+ * When timing phases, the stdout of the child is read through a pipe and
+ * never reaches the terminal. In quiet mode it is discarded either way.
+ *
+ * When sampling, the sampler thread runs from the start of the clock until
+ * wait4() returns, and competes with the child for CPU time.
+ */
 int execute(char **argv, const int iterations, result_t *result) {
-    struct timespec time_start, time_end, time_diff;
+    struct timespec time_start, time_end, time_diff, mark_start, mark_end;
     struct rusage *ru = NULL;
-    pid_t pid = NULL;
-    int status;
+    launch_gate_t gate;
+    perf_group_t group;
+    pid_t pid = 0;
+    int status, exec_fd = -1, err, marks = 0, i;
+    int out_fds[2] = { -1, -1 }, null_fd = -1, stdout_fd, stderr_fd;
 
     if (verbose) {
-        printf("Executing %s in child process.\n", *argv);
+        printf("Executing %s in child process.\n", executable);
     }
 
+    if (perf && launch_gate_open(&gate) != 0) {
+        perror("Could not create launch gate");
+        return 1;
+    }
+
+    /* Decide where the output of the child goes. */
+    if (phases && pipe2(out_fds, O_CLOEXEC) != 0) {
+        perror("Could not create pipe for output of child process");
+        return 1;
+    }
+    if (quiet) {
+        null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    }
+    stdout_fd = phases ? out_fds[1] : null_fd;
+    stderr_fd = null_fd;
+
     /* Execute the command we are measuring. */
     ru = malloc(sizeof(struct rusage));
-    clock_gettime(TIMER, &time_start);
-    pid = fork();
+    if (!perf) {
+        clock_gettime(timer_clock, &time_start);
+    }
+    pid = launch_start(launch_method, executable, argv, stdout_fd, stderr_fd,
+                       perf ? &gate : NULL, exec_start ? &exec_fd : NULL);
+    /* Only the child writes to these now. */
+    if (out_fds[1] != -1) {
+        close(out_fds[1]);
+    }
+    if (null_fd != -1) {
+        close(null_fd);
+    }
     if (pid < 0) {
-        perror("Could not fork child process.");
+        free(ru);
+        perror("Could not start child process");
         return 1;
     }
-
-    if (pid == 0) { /* Child process. */
-        if (quiet) {
-            /* TODO: Redirect stdout and stderr. */
+    if (perf) {
+        if (perf_open(&group, pid) == 0 && !perf_warned) {
+            fprintf(stderr, "No performance counters available, "
+                    "see perf_event_paranoid.\n");
+            perf_warned = 1;
+        } else if (group.user_only && !perf_warned) {
+            fprintf(stderr, "Performance counters count user space only, "
+                    "see perf_event_paranoid.\n");
+            perf_warned = 1;
+        }
+        clock_gettime(timer_clock, &time_start);
+        launch_gate_release(&gate);
+    }
+    if (exec_start) {
+        err = launch_await_exec(exec_fd);
+        if (err != 0) {
+            free(ru);
+            waitpid(pid, &status, 0);
+            errno = err;
+            perror("Could not execute command");
+            return 1;
         }
-        execvp(*argv, argv);
-        exit(EXIT_SUCCESS);
+        clock_gettime(timer_clock, &time_start);
+    }
+    if (sample_interval > 0 &&
+        sampler_start(&sampler, pid, sample_interval, timer_clock,
+                      &time_start) != 0
+        && verbose) {
+        printf("Could not start sampler thread.\n");
+    }
+    if (phases) {
+        marks = read_markers(out_fds[0], &mark_start, &mark_end);
+        close(out_fds[0]);
     }
 
     /* Parent process. */
     wait4(pid, &status, 0, ru);
-    clock_gettime(TIMER, &time_end);
+    clock_gettime(timer_clock, &time_end);
+    sampler_stop(&sampler);
+
+    if (perf) {
+        perf_read(&group, result->perf);
+        result->perf_fallback = 0;
+        for (i = 0; i < PERF_NUM_COUNTERS; i++) {
+            if (group.fallback[i]) {
+                result->perf_fallback |= 1 << i;
+            }
+        }
+        if (group.user_only) {
+            result->perf_fallback |= 1 << PERF_USER_ONLY;
+        }
+        perf_close(&group);
+    }
 
     if (status != 0) {
         free(ru);
-        perror(strcat("Error when running ", *argv));
+        if (WIFSIGNALED(status)) {
+            fprintf(stderr, "Error when running %s: killed by signal %d "
+                    "(%s).\n", executable, WTERMSIG(status),
+                    strsignal(WTERMSIG(status)));
+        } else {
+            fprintf(stderr, "Error when running %s: exit status %d.\n",
+                    executable, WEXITSTATUS(status));
+        }
         return 1;
     }
 
+    /* Split the run into phases, if both markers were seen. */
+    for (i = 0; i < PHASE_NUM; i++) {
+        result->phase_ns[i] = PHASE_UNAVAILABLE;
+    }
+    if (marks == 2) {
+        result->phase_ns[PHASE_SETUP] = diff_ns(time_start, mark_start);
+        result->phase_ns[PHASE_STEADY] = diff_ns(mark_start, mark_end);
+        result->phase_ns[PHASE_TEARDOWN] = diff_ns(mark_end, time_end);
+    } else if (phases && verbose) {
+        printf("Did not see both '%s' and '%s' markers.\n",
+               START_MARKER, END_MARKER);
+    }
+
     /* Calculate wall clock time and copy results into a results_t. */
     time_diff = diff(time_start, time_end);
     result->seconds = time_diff.tv_sec;
     result->nanoseconds = time_diff.tv_nsec;
-    *result->user_time = ru->ru_utime;
-    *result->sys_time = ru->ru_stime;
+    result->user_time = ru->ru_utime;
+    result->sys_time = ru->ru_stime;
     result->max_set_size = ru->ru_maxrss;
     result->soft_fault = ru->ru_minflt;
     result->hard_fault = ru->ru_majflt;
@@ -367,3 +1653,55 @@ struct timespec diff(struct timespec start, struct timespec end) {
     }
     return temp;
 }
+
+
+/* Calculate the difference between two points in time in nanoseconds. */
+long long diff_ns(struct timespec start, struct timespec end) {
+    struct timespec temp = diff(start, end);
+    return (long long)temp.tv_sec * 1000000000 + temp.tv_nsec;
+}
+
+
+/* Drain the stdout of COMMAND until EOF, noting when the first start marker
+ * and the first end marker after it arrive.
+ *
+ * Returns the number of markers seen: 0, 1 (start only) or 2.
+ */
+int read_markers(int fd, struct timespec *start, struct timespec *end) {
+    char buffer[4096], line[MAX_LINE];
+    size_t len = 0;
+    ssize_t n, i;
+    int marks = 0;
+
+    for (;;) {
+        n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (buffer[i] != '\n') {
+                /* Overlong lines are not markers, so truncating is safe. */
+                if (len < sizeof(line) - 1) {
+                    line[len++] = buffer[i];
+                }
+                continue;
+            }
+            if (len > 0 && line[len - 1] == '\r') {
+                len--;
+            }
+            line[len] = '\0';
+            len = 0;
+            if (marks == 0 && strcmp(line, START_MARKER) == 0) {
+                clock_gettime(timer_clock, start);
+                marks = 1;
+            } else if (marks == 1 && strcmp(line, END_MARKER) == 0) {
+                clock_gettime(timer_clock, end);
+                marks = 2;
+            }
+        }
+    }
+    return marks;
+}
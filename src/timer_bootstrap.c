@@ -0,0 +1,297 @@
+/* Bootstrap confidence intervals, resampled in parallel threads.
+ *
+ * Each resample draws n indices into the sorted values and only counts how
+ * often each index is drawn. The mean is then a dot product of the counts
+ * with the values, and the median is found by walking the counts, so no
+ * resample is ever copied or sorted.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timer_bootstrap.h"
+
+/* The share of the resamples given to one thread. */
+typedef struct worker_t {
+    const double *sorted;
+    int n, first, last;
+    double *means, *medians;
+    unsigned long long seed;
+} worker_t;
+
+/* The share of the resamples of a difference given to one thread. */
+typedef struct change_worker_t {
+    const double *baseline, *candidate;
+    int n_baseline, n_candidate, first, last;
+    double *changes;
+    unsigned long long seed;
+} change_worker_t;
+
+
+/* Next output of the SplitMix64 generator, used to seed the streams. */
+static unsigned long long splitmix64(unsigned long long *state) {
+    unsigned long long z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+
+/* Next output of a xorshift128+ generator. */
+static unsigned long long xorshift128plus(unsigned long long *s) {
+    unsigned long long x = s[0], y = s[1];
+    s[0] = y;
+    x ^= x << 23;
+    s[1] = x ^ y ^ (x >> 17) ^ (y >> 26);
+    return s[1] + y;
+}
+
+
+/* Order doubles from smallest to largest, for qsort(). */
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+
+/* Seed the stream of resample b. Every resample has its own stream, so the
+ * intervals do not depend on how the resamples were shared out.
+ */
+static void seed_stream(unsigned long long seed, int b, unsigned long long *s) {
+    unsigned long long state = seed + (unsigned long long)b;
+    s[0] = splitmix64(&state);
+    s[1] = splitmix64(&state);
+}
+
+
+/* Draw n indices into n values, counting how often each is drawn, and
+ * return the median of the resample.
+ */
+static double resample_median(const double *sorted, int n,
+                              unsigned int *counts, unsigned long long *s) {
+    long long seen, half = (n + 1) / 2;
+    int i;
+    for (i = 0; i < n; i++) {
+        counts[((xorshift128plus(s) >> 32) * n) >> 32]++;
+    }
+    for (i = 0, seen = 0; i < n; i++) {
+        seen += counts[i];
+        if (seen >= half) {
+            break;
+        }
+    }
+    return sorted[i];
+}
+
+
+/* Run resamples [first, last) of one worker. */
+static void * resample(void *arg) {
+    worker_t *w = (worker_t*)arg;
+    unsigned int *counts = calloc(w->n, sizeof(unsigned int));
+    unsigned long long s[2];
+    double sum;
+    int b, i;
+
+    for (b = w->first; b < w->last; b++) {
+        seed_stream(w->seed, b, s);
+        w->medians[b] = resample_median(w->sorted, w->n, counts, s);
+
+        sum = 0;
+        for (i = 0; i < w->n; i++) {
+            sum += counts[i] * w->sorted[i];
+        }
+        w->means[b] = sum / w->n;
+        memset(counts, 0, sizeof(unsigned int) * w->n);
+    }
+    free(counts);
+    return NULL;
+}
+
+
+/* Run resamples [first, last) of the change in median between two sets of
+ * values. Both sets are resampled independently, from one stream.
+ */
+static void * resample_change(void *arg) {
+    change_worker_t *w = (change_worker_t*)arg;
+    unsigned int *counts_b = calloc(w->n_baseline, sizeof(unsigned int));
+    unsigned int *counts_c = calloc(w->n_candidate, sizeof(unsigned int));
+    unsigned long long s[2];
+    double baseline, candidate;
+    int b;
+
+    for (b = w->first; b < w->last; b++) {
+        seed_stream(w->seed, b, s);
+        baseline = resample_median(w->baseline, w->n_baseline, counts_b, s);
+        candidate =
+            resample_median(w->candidate, w->n_candidate, counts_c, s);
+        /* A zero median can only be drawn if many values were zero. */
+        if (baseline > 0) {
+            w->changes[b] = candidate / baseline - 1;
+        } else {
+            w->changes[b] = candidate > 0 ? INFINITY : 0;
+        }
+        memset(counts_b, 0, sizeof(unsigned int) * w->n_baseline);
+        memset(counts_c, 0, sizeof(unsigned int) * w->n_candidate);
+    }
+    free(counts_c);
+    free(counts_b);
+    return NULL;
+}
+
+
+/* Run threads workers of the given size, each with fn. The calling thread
+ * takes the first share, and any share for which no thread could be
+ * created.
+ */
+static void run_workers(void * (*fn)(void*), void *workers, size_t size,
+                        int threads) {
+    pthread_t *tids = malloc(sizeof(pthread_t) * threads);
+    int *created = calloc(threads, sizeof(int));
+    int i;
+
+    for (i = 1; i < threads; i++) {
+        created[i] = (pthread_create(&tids[i], NULL, fn,
+                                     (char*)workers + size * i) == 0);
+    }
+    fn(workers);
+    for (i = 1; i < threads; i++) {
+        if (created[i]) {
+            pthread_join(tids[i], NULL);
+        } else {
+            fn((char*)workers + size * i);
+        }
+    }
+    free(created);
+    free(tids);
+}
+
+
+/* Copy sorted long doubles to doubles, which unlike long doubles let the
+ * resampling loops be vectorised.
+ */
+static double * to_doubles(const long double *sorted, int n) {
+    double *values = malloc(sizeof(double) * n);
+    int i;
+    for (i = 0; i < n; i++) {
+        values[i] = (double)sorted[i];
+    }
+    return values;
+}
+
+
+/* Share resamples between at most threads workers. */
+static int clamp_threads(int threads, int resamples) {
+    if (threads < 1) {
+        return 1;
+    }
+    return threads > resamples ? resamples : threads;
+}
+
+
+/* The ends of the central BOOTSTRAP_CONFIDENCE of n resampled estimates. */
+static void percentile_interval(double *estimates, int n,
+                                long double interval[2]) {
+    int low = (int)floor(n * (1 - BOOTSTRAP_CONFIDENCE) / 2);
+    int high = (int)ceil(n * (1 + BOOTSTRAP_CONFIDENCE) / 2) - 1;
+    qsort(estimates, n, sizeof(double), compare_doubles);
+    interval[0] = estimates[low];
+    interval[1] = estimates[high < n ? high : n - 1];
+}
+
+
+/* Percentile bootstrap intervals on the mean and median of n sorted values.
+ * If every value is the same, no resample can differ, so the intervals are
+ * that value and nothing is resampled.
+ */
+int bootstrap_ci(const bootstrap_t *bootstrap,
+                 const long double *sorted, int n,
+                 long double mean_ci[2], long double median_ci[2]) {
+    int resamples = bootstrap->resamples, threads;
+    double *values, *means, *medians;
+    worker_t *workers;
+    int i;
+
+    if (n < 2 || resamples < 1) {
+        mean_ci[0] = mean_ci[1] = median_ci[0] = median_ci[1] = NAN;
+        return 1;
+    }
+    if (sorted[0] == sorted[n - 1]) {
+        mean_ci[0] = mean_ci[1] = median_ci[0] = median_ci[1] = sorted[0];
+        return 0;
+    }
+    threads = clamp_threads(bootstrap->threads, resamples);
+
+    values = to_doubles(sorted, n);
+    means = malloc(sizeof(double) * resamples);
+    medians = malloc(sizeof(double) * resamples);
+    workers = malloc(sizeof(worker_t) * threads);
+
+    for (i = 0; i < threads; i++) {
+        workers[i].sorted = values;
+        workers[i].n = n;
+        workers[i].first = (int)((long long)resamples * i / threads);
+        workers[i].last = (int)((long long)resamples * (i + 1) / threads);
+        workers[i].means = means;
+        workers[i].medians = medians;
+        workers[i].seed = bootstrap->seed;
+    }
+    run_workers(resample, workers, sizeof(worker_t), threads);
+
+    percentile_interval(means, resamples, mean_ci);
+    percentile_interval(medians, resamples, median_ci);
+
+    free(workers);
+    free(medians);
+    free(means);
+    free(values);
+    return 0;
+}
+
+
+/* Percentile bootstrap interval on the relative change in median from the
+ * baseline to the candidate values.
+ */
+int bootstrap_median_change(const bootstrap_t *bootstrap,
+                            const long double *baseline, int n_baseline,
+                            const long double *candidate, int n_candidate,
+                            long double change_ci[2]) {
+    int resamples = bootstrap->resamples, threads;
+    double *base_values, *cand_values, *changes;
+    change_worker_t *workers;
+    int i;
+
+    if (n_baseline < 2 || n_candidate < 2 || resamples < 1) {
+        change_ci[0] = change_ci[1] = NAN;
+        return 1;
+    }
+    threads = clamp_threads(bootstrap->threads, resamples);
+
+    base_values = to_doubles(baseline, n_baseline);
+    cand_values = to_doubles(candidate, n_candidate);
+    changes = malloc(sizeof(double) * resamples);
+    workers = malloc(sizeof(change_worker_t) * threads);
+
+    for (i = 0; i < threads; i++) {
+        workers[i].baseline = base_values;
+        workers[i].candidate = cand_values;
+        workers[i].n_baseline = n_baseline;
+        workers[i].n_candidate = n_candidate;
+        workers[i].first = (int)((long long)resamples * i / threads);
+        workers[i].last = (int)((long long)resamples * (i + 1) / threads);
+        workers[i].changes = changes;
+        workers[i].seed = bootstrap->seed;
+    }
+    run_workers(resample_change, workers, sizeof(change_worker_t), threads);
+
+    percentile_interval(changes, resamples, change_ci);
+
+    free(workers);
+    free(changes);
+    free(cand_values);
+    free(base_values);
+    return 0;
+}
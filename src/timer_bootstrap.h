@@ -0,0 +1,41 @@
+/* Bootstrap confidence intervals, resampled in parallel threads.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#ifndef TIMER_BOOTSTRAP_H
+#define TIMER_BOOTSTRAP_H
+
+/* Default number of resamples and the confidence level of every interval. */
+#define DEFAULT_RESAMPLES 10000
+#define BOOTSTRAP_CONFIDENCE 0.95
+
+/* How to bootstrap. With zero resamples no bootstrap is done. */
+typedef struct bootstrap_t {
+    int resamples;
+    int threads;
+    unsigned long long seed;
+} bootstrap_t;
+
+
+/* Percentile bootstrap intervals on the mean and median of n values, which
+ * must be sorted. Resample b always draws the same values for a given seed,
+ * however many threads share the work. Returns 0 on success.
+ */
+int bootstrap_ci(const bootstrap_t *bootstrap,
+                 const long double *sorted, int n,
+                 long double mean_ci[2], long double median_ci[2]);
+
+
+/* Percentile bootstrap interval on the relative change in median from the
+ * baseline to the candidate, i.e. candidate / baseline - 1, both of which
+ * must be sorted. Resamples whose baseline median is zero count as an
+ * infinite change, unless the candidate median is also zero. Returns 0 on
+ * success.
+ */
+int bootstrap_median_change(const bootstrap_t *bootstrap,
+                            const long double *baseline, int n_baseline,
+                            const long double *candidate, int n_candidate,
+                            long double change_ci[2]);
+
+#endif /* TIMER_BOOTSTRAP_H */
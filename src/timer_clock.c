@@ -0,0 +1,359 @@
+/* Measure what reading each clock costs and how finely it can tell two
+ * moments apart, and choose a clock to time with. Linux only.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#include "timer_clock.h"
+
+/* Reads timed to find the cost of one read, through the C library and
+ * through the system call.
+ */
+#define CALL_READS    200000
+#define SYSCALL_READS 20000
+
+/* Back-to-back reads stop once this many have differed, or after
+ * DELTA_TIME_NS, which is long enough to see a coarse clock tick.
+ */
+#define DELTA_CHANGES 10000
+#define DELTA_TIME_NS 50000000LL
+
+/* Reads made by each CPU when looking for backwards steps. */
+#define CPU_READS 200000
+
+const clock_lut_t clock_names[] = {
+    { CLOCK_REALTIME,           "CLOCK_REALTIME",           1 },
+    { CLOCK_REALTIME_COARSE,    "CLOCK_REALTIME_COARSE",    1 },
+    { CLOCK_MONOTONIC,          "CLOCK_MONOTONIC",          1 },
+    { CLOCK_MONOTONIC_COARSE,   "CLOCK_MONOTONIC_COARSE",   1 },
+    { CLOCK_MONOTONIC_RAW,      "CLOCK_MONOTONIC_RAW",      1 },
+    { CLOCK_BOOTTIME,           "CLOCK_BOOTTIME",           1 },
+    { CLOCK_PROCESS_CPUTIME_ID, "CLOCK_PROCESS_CPUTIME_ID", 0 },
+    { CLOCK_THREAD_CPUTIME_ID,  "CLOCK_THREAD_CPUTIME_ID",  0 },
+    { (clockid_t) -1,           NULL,                       0 }
+};
+
+/* Something to read the time from: a clock, or the time stamp counter. */
+typedef struct reader_t {
+    clockid_t id;
+    int tsc;
+} reader_t;
+
+/* State shared by the threads looking for backwards steps. */
+typedef struct cpu_check_t {
+    const reader_t *reader;
+    int go;
+    unsigned long long latest;
+    long long backwards;
+} cpu_check_t;
+
+/* One thread of a check, and the CPU it runs on. */
+typedef struct cpu_worker_t {
+    cpu_check_t *check;
+    int cpu;
+} cpu_worker_t;
+
+
+/* Read a clock in nanoseconds, or the time stamp counter in ticks. */
+static inline unsigned long long reader_now(const reader_t *reader) {
+    struct timespec ts;
+#if HAVE_TSC
+    if (reader->tsc) {
+        return __rdtsc();
+    }
+#endif
+    clock_gettime(reader->id, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/* CLOCK_MONOTONIC_RAW in nanoseconds, to time everything else against. */
+static long long raw_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/* Name of a clock, or NULL if it is not listed. */
+const char * clock_name(clockid_t id) {
+    const clock_lut_t *p;
+    for (p = clock_names; p->name != NULL; p++) {
+        if (p->id == id) {
+            return p->name;
+        }
+    }
+    return NULL;
+}
+
+
+/* Parse the name of a clock, with or without its CLOCK_ prefix. */
+int clock_parse(const char *name, clockid_t *id) {
+    const clock_lut_t *p;
+    for (p = clock_names; p->name != NULL; p++) {
+        if (strcasecmp(name, p->name) == 0 ||
+            strcasecmp(name, p->name + strlen("CLOCK_")) == 0) {
+            *id = p->id;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/* Non-zero if a clock is listed as system-wide. */
+int clock_system_wide(clockid_t id) {
+    const clock_lut_t *p;
+    for (p = clock_names; p->name != NULL; p++) {
+        if (p->id == id) {
+            return p->system_wide;
+        }
+    }
+    return 0;
+}
+
+
+/* Mean cost in nanoseconds of reading through the C library. */
+static double call_cost(const reader_t *reader) {
+    volatile unsigned long long sink = 0;
+    long long start;
+    int i;
+    start = raw_now();
+    for (i = 0; i < CALL_READS; i++) {
+        sink += reader_now(reader);
+    }
+    (void)sink;
+    return (double)(raw_now() - start) / CALL_READS;
+}
+
+
+/* Mean cost in nanoseconds of reading through the system call, bypassing
+ * the vDSO.
+ */
+static double syscall_cost(clockid_t id) {
+    struct timespec ts;
+    long long start;
+    int i;
+    start = raw_now();
+    for (i = 0; i < SYSCALL_READS; i++) {
+        syscall(SYS_clock_gettime, id, &ts);
+    }
+    return (double)(raw_now() - start) / SYSCALL_READS;
+}
+
+
+/* Smallest non-zero difference between back-to-back reads, in the units of
+ * the reader, or 0 if every read was the same.
+ */
+static unsigned long long min_delta(const reader_t *reader) {
+    unsigned long long previous, now, delta, smallest = 0;
+    long long start = raw_now();
+    int changes = 0, i;
+
+    previous = reader_now(reader);
+    for (i = 1; changes < DELTA_CHANGES; i++) {
+        now = reader_now(reader);
+        if (now > previous) {
+            delta = now - previous;
+            if (smallest == 0 || delta < smallest) {
+                smallest = delta;
+            }
+            changes++;
+        }
+        previous = now;
+        /* Checking the time on every read would hide the smallest steps. */
+        if ((i & 1023) == 0 && raw_now() - start > DELTA_TIME_NS) {
+            break;
+        }
+    }
+    return smallest;
+}
+
+
+/* Read the clock repeatedly on one CPU, counting reads which are earlier
+ * than the latest read by any CPU. The latest read is loaded before the
+ * clock is, so it really did happen first.
+ */
+static void * cpu_check(void *arg) {
+    cpu_worker_t *worker = (cpu_worker_t*)arg;
+    cpu_check_t *check = worker->check;
+    unsigned long long seen, now;
+    long long backwards = 0;
+    cpu_set_t cpus;
+    int i;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    while (!__atomic_load_n(&check->go, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+
+    for (i = 0; i < CPU_READS; i++) {
+        seen = __atomic_load_n(&check->latest, __ATOMIC_ACQUIRE);
+        now = reader_now(check->reader);
+        if (now < seen) {
+            backwards++;
+            continue;
+        }
+        while (now > seen &&
+               !__atomic_compare_exchange_n(&check->latest, &seen, now, 0,
+                                            __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE)) {
+        }
+    }
+    __atomic_add_fetch(&check->backwards, backwards, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+
+/* Count backwards steps between reads on every online CPU at once. */
+static long long check_cpus(const reader_t *reader) {
+    int ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN), i;
+    cpu_worker_t *workers;
+    pthread_t *tids;
+    cpu_check_t check;
+    cpu_set_t affinity;
+
+    if (ncpus < 1) {
+        ncpus = 1;
+    }
+    check.reader = reader;
+    check.go = 0;
+    check.latest = 0;
+    check.backwards = 0;
+    workers = malloc(sizeof(cpu_worker_t) * ncpus);
+    tids = malloc(sizeof(pthread_t) * ncpus);
+    for (i = 0; i < ncpus; i++) {
+        workers[i].check = &check;
+        workers[i].cpu = i;
+    }
+    /* Every thread starts reading at once, on whichever CPUs it could get. */
+    for (i = 1; i < ncpus; i++) {
+        if (pthread_create(&tids[i], NULL, cpu_check, &workers[i]) != 0) {
+            break;
+        }
+    }
+    /* The calling thread takes the first CPU, then gets its CPUs back. */
+    sched_getaffinity(0, sizeof(affinity), &affinity);
+    __atomic_store_n(&check.go, 1, __ATOMIC_RELEASE);
+    cpu_check(&workers[0]);
+    while (--i > 0) {
+        pthread_join(tids[i], NULL);
+    }
+    sched_setaffinity(0, sizeof(affinity), &affinity);
+    free(tids);
+    free(workers);
+    return check.backwards;
+}
+
+
+/* Benchmark a clock. */
+int clock_benchmark(clockid_t id, int check, clock_bench_t *bench) {
+    reader_t reader = { id, 0 };
+    struct timespec res;
+
+    if (clock_getres(id, &res) != 0) {
+        return -1;
+    }
+    bench->resolution_ns = res.tv_sec * 1000000000LL + res.tv_nsec;
+    bench->call_ns = call_cost(&reader);
+    bench->syscall_ns = syscall_cost(id);
+    bench->min_delta_ns = (long long)min_delta(&reader);
+    bench->backwards = check ? check_cpus(&reader) : -1;
+    return 0;
+}
+
+
+/* Choose the cheapest clock fine enough to time runs to within
+ * max_error_ns. Wall clocks are never chosen, since they can be stepped.
+ */
+clockid_t clock_choose(long long max_error_ns) {
+    clockid_t best = CLOCK_MONOTONIC, finest = CLOCK_MONOTONIC;
+    double best_ns = INFINITY;
+    long long granularity, finest_ns = -1;
+    const clock_lut_t *p;
+    clock_bench_t bench;
+
+    for (p = clock_names; p->name != NULL; p++) {
+        if (!p->system_wide || p->id == CLOCK_REALTIME ||
+            p->id == CLOCK_REALTIME_COARSE ||
+            clock_benchmark(p->id, 0, &bench) != 0) {
+            continue;
+        }
+        granularity = bench.min_delta_ns > bench.resolution_ns ?
+            bench.min_delta_ns : bench.resolution_ns;
+        if (granularity <= max_error_ns && bench.call_ns < best_ns) {
+            best = p->id;
+            best_ns = bench.call_ns;
+        }
+        if (finest_ns < 0 || granularity < finest_ns) {
+            finest = p->id;
+            finest_ns = granularity;
+        }
+    }
+    return isinf(best_ns) ? finest : best;
+}
+
+
+/* Non-zero if the time stamp counter is invariant. */
+int tsc_invariant() {
+#if HAVE_TSC
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+        return (edx >> 8) & 1;
+    }
+#endif
+    return 0;
+}
+
+
+/* Calibrate and benchmark the time stamp counter. */
+double tsc_benchmark(int calibrate_ms, int check, clock_bench_t *bench) {
+#if HAVE_TSC
+    reader_t reader = { CLOCK_MONOTONIC_RAW, 1 };
+    struct timespec pause = { 0, 0 };
+    unsigned long long ticks;
+    long long start;
+    double ticks_per_ns;
+
+    pause.tv_sec = calibrate_ms / 1000;
+    pause.tv_nsec = (calibrate_ms % 1000) * 1000000L;
+    start = raw_now();
+    ticks = __rdtsc();
+    nanosleep(&pause, NULL);
+    ticks = __rdtsc() - ticks;
+    ticks_per_ns = (double)ticks / (double)(raw_now() - start);
+
+    bench->resolution_ns = 0;
+    bench->call_ns = call_cost(&reader);
+    bench->syscall_ns = NAN;
+    bench->min_delta_ns = (long long)llround(min_delta(&reader) / ticks_per_ns);
+    bench->backwards = check ? check_cpus(&reader) : -1;
+    return ticks_per_ns;
+#else
+    (void)calibrate_ms;
+    (void)check;
+    (void)bench;
+    return 0;
+#endif
+}
@@ -0,0 +1,83 @@
+/* Measure what reading each clock costs and how finely it can tell two
+ * moments apart, and choose a clock to time with. Linux only.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#ifndef TIMER_CLOCK_H
+#define TIMER_CLOCK_H
+
+#include <time.h>
+
+/* A clock, by id and readable name. */
+typedef struct clock_lut_t {
+    clockid_t id;
+    const char *name;
+    /* Non-zero if readings on different CPUs can be compared, so that the
+     * clock can time a child process which may run anywhere.
+     */
+    int system_wide;
+} clock_lut_t;
+
+/* Every clock listed in the man page for clock_getres, ending in NULL. */
+extern const clock_lut_t clock_names[];
+
+/* What reading a clock costs, and how well it resolves time. */
+typedef struct clock_bench_t {
+    /* Resolution according to clock_getres(), in nanoseconds. */
+    long long resolution_ns;
+    /* Cost of one read through the C library, usually served by the vDSO,
+     * and through the system call itself.
+     */
+    double call_ns, syscall_ns;
+    /* Smallest non-zero difference between back-to-back reads. */
+    long long min_delta_ns;
+    /* Reads which were earlier than one already seen on another CPU, or -1
+     * if not tested.
+     */
+    long long backwards;
+} clock_bench_t;
+
+
+/* Name of a clock, e.g. "CLOCK_MONOTONIC", or NULL if it is not listed. */
+const char * clock_name(clockid_t id);
+
+
+/* Parse the name of a clock, with or without the CLOCK_ prefix and in any
+ * case, e.g. "monotonic_raw". Returns 0 on success.
+ */
+int clock_parse(const char *name, clockid_t *id);
+
+
+/* Non-zero if a clock is listed as system-wide, and so can time a child
+ * process rather than only the process or thread which reads it.
+ */
+int clock_system_wide(clockid_t id);
+
+
+/* Benchmark a clock. If check_cpus is set, every online CPU reads the
+ * clock at once and backwards steps between them are counted. Returns 0 on
+ * success, or -1 if the clock is not supported.
+ */
+int clock_benchmark(clockid_t id, int check_cpus, clock_bench_t *bench);
+
+
+/* Choose the cheapest system-wide monotonic clock whose granularity is at
+ * most max_error_ns. If none is fine enough, the finest is chosen.
+ */
+clockid_t clock_choose(long long max_error_ns);
+
+
+/* Non-zero if this machine has a time stamp counter which ticks at a
+ * constant rate whatever the power state of the CPU.
+ */
+int tsc_invariant();
+
+
+/* Calibrate the time stamp counter against CLOCK_MONOTONIC_RAW over the
+ * given number of milliseconds, and benchmark it as a clock. Returns ticks
+ * per nanosecond, or 0 if there is no counter.
+ */
+double tsc_benchmark(int calibrate_ms, int check_cpus, clock_bench_t *bench);
+
+#endif /* TIMER_CLOCK_H */
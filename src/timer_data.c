@@ -3,51 +3,134 @@
  * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
  */
 
+#include <ctype.h>
 #include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "timer_data.h"
 
 /* Print a horizontal rule. */
 void hrule();
 
+/* Write a number to a JSON file, or null if it is not finite. */
+static void json_number(FILE *fp, long double value);
+
+/* Gather the metrics of measurement i in a buffer into a row. */
+static void results_row(results_t *results, int i, long double *row);
+
+/* Write a row of metrics as one line of a CSV results file. */
+static void write_csv_row(FILE *fp, long double *row, int experiment);
+
+/* Fill in the summary of one metric from its n values. */
+static void summarise_values(summary_t *summary, long double *values, int n,
+                             const bootstrap_t *bootstrap);
+
+
+/* Names of the phases of a run. */
+static const char *phase_names[PHASE_NUM] = {
+    "setup", "steady-state", "teardown"
+};
+
+
+/* Readable name of a phase, e.g. "setup". */
+const char * phase_name(phase_t phase) {
+    return phase_names[phase];
+}
+
+
+/* Lookup table of readable and short names for metrics that are not
+ * performance counters.
+ */
+typedef struct metric_lut_t { const char *name, *key; } metric_lut_t;
+
+static const metric_lut_t metric_names[] = {
+    { "wall clock time (s)",              "wall_clock_s" },
+    { "user time (s)",                    "user_time_s" },
+    { "system time (s)",                  "sys_time_s" },
+    { "maximum resident set size (KB)",   "max_set_size_kb" },
+    { "page reclaims (soft page faults)", "soft_faults" },
+    { "page faults (hard page faults)",   "hard_faults" },
+    { "block input operations",           "in_block" },
+    { "block output operations",          "out_block" },
+    { "voluntary context switches",       "vol_con_switches" },
+    { "involuntary context switches",     "invol_con_switches" }
+};
+
+static const metric_lut_t phase_metric_names[PHASE_NUM] = {
+    { "setup time (ns)",        "setup_ns" },
+    { "steady-state time (ns)", "steady_state_ns" },
+    { "teardown time (ns)",     "teardown_ns" }
+};
+
+
+/* Readable name of a metric, e.g. "wall clock time (s)". */
+const char * metric_name(int metric, int perf_fallback) {
+    if (metric >= METRIC_PHASE) {
+        return phase_metric_names[metric - METRIC_PHASE].name;
+    } else if (metric == METRIC_PERF + PERF_CYCLES &&
+               (perf_fallback & (1 << PERF_CYCLES))) {
+        return "cycles (cpu-clock ns)";
+    } else if (metric >= METRIC_PERF) {
+        return perf_counter_name(metric - METRIC_PERF);
+    }
+    return metric_names[metric].name;
+}
+
+
+/* Short name of a metric for JSON keys and state files. */
+const char * metric_key(int metric) {
+    if (metric >= METRIC_PHASE) {
+        return phase_metric_names[metric - METRIC_PHASE].key;
+    } else if (metric >= METRIC_PERF) {
+        return perf_counter_name(metric - METRIC_PERF);
+    }
+    return metric_names[metric].key;
+}
+
 
 /* Allocate memory for a result_t type. */
 result_t * result_new() {
-    result_t *result = (result_t*)malloc(sizeof(result_t));
-    result->user_time = malloc(sizeof(struct timeval));
-    result->sys_time = malloc(sizeof(struct timeval));
+    int i;
+    result_t *result = (result_t*)calloc(1, sizeof(result_t));
+    for (i = 0; i < PERF_NUM_COUNTERS; i++) {
+        result->perf[i] = PERF_UNAVAILABLE;
+    }
+    result->perf_fallback = 0;
+    for (i = 0; i < PHASE_NUM; i++) {
+        result->phase_ns[i] = PHASE_UNAVAILABLE;
+    }
     return result;
 }
 
 
 /* Free the memory allocated to a result_t type. */
 void result_free (result_t *result) {
-    free(result->sys_time);
-    free(result->user_time);
     free(result);
 }
 
 
 /* Print results of a single measurement. */
 void print_result(result_t *result) {
+    int i;
     long double wc_s = ( (long double)result->seconds +
                          ((long double)result->nanoseconds /
                           (long double)1000000000) );
-    long double user_s = ( (long double)result->user_time->tv_sec +
-                           ((long double)result->user_time->tv_usec /
+    long double user_s = ( (long double)result->user_time.tv_sec +
+                           ((long double)result->user_time.tv_usec /
                             (long double)1000000) );
-    long double sys_s = ( (long double)result->sys_time->tv_sec +
-                         ((long double)result->sys_time->tv_usec /
+    long double sys_s = ( (long double)result->sys_time.tv_sec +
+                         ((long double)result->sys_time.tv_usec /
                           (long double)1000000) );
 
     printf("Wall clock time: %lld seconds %lld nanoseconds or %.9Lf seconds.\n",
            result->seconds, result->nanoseconds, wc_s);
     printf("User time: %ld second %ld microseconds or %.6Lf seconds.\n",
-           result->user_time->tv_sec, result->user_time->tv_usec, user_s);
+           result->user_time.tv_sec, result->user_time.tv_usec, user_s);
     printf("System time: %ld second %ld microseconds or %.6Lf seconds.\n",
-           result->sys_time->tv_sec, result->sys_time->tv_usec, sys_s);
+           result->sys_time.tv_sec, result->sys_time.tv_usec, sys_s);
     printf("%-10ld Maximum resident set size (Kb).\n",
            result->max_set_size);
     printf("%-10ld Page reclaims (soft page faults).\n",
@@ -62,16 +145,164 @@ void print_result(result_t *result) {
            result->vol_con_switches);
     printf("%-10ld Involuntary context switches.\n",
            result->invol_con_switches);
+    for (i = 0; i < PERF_NUM_COUNTERS; i++) {
+        if (result->perf[i] != PERF_UNAVAILABLE) {
+            printf("%-10lld %s.\n", result->perf[i],
+                   metric_name(METRIC_PERF + i, result->perf_fallback));
+        }
+    }
+    for (i = 0; i < PHASE_NUM; i++) {
+        if (result->phase_ns[i] != PHASE_UNAVAILABLE) {
+            printf("%-10lld Nanoseconds of %s.\n", result->phase_ns[i],
+                   phase_name(i));
+        }
+    }
+}
+
+
+/* Wall clock time of a single measurement in seconds. */
+long double result_wall_clock(result_t *result) {
+    return ( (long double)result->seconds +
+             ((long double)result->nanoseconds / (long double)1000000000) );
+}
+
+
+/* Value of a metric in a single measurement, or NAN if it was not recorded. */
+long double result_metric(result_t *result, int metric) {
+    long long value;
+
+    switch (metric) {
+        case METRIC_WALL_CLOCK:
+            return result_wall_clock(result);
+        case METRIC_USER_TIME:
+            return ( (long double)result->user_time.tv_sec +
+                     ((long double)result->user_time.tv_usec /
+                      (long double)1000000) );
+        case METRIC_SYS_TIME:
+            return ( (long double)result->sys_time.tv_sec +
+                     ((long double)result->sys_time.tv_usec /
+                      (long double)1000000) );
+        case METRIC_MAX_SET_SIZE:
+            return result->max_set_size;
+        case METRIC_SOFT_FAULT:
+            return result->soft_fault;
+        case METRIC_HARD_FAULT:
+            return result->hard_fault;
+        case METRIC_IN_BLOCK:
+            return result->in_block;
+        case METRIC_OUT_BLOCK:
+            return result->out_block;
+        case METRIC_VOL_CON_SWITCHES:
+            return result->vol_con_switches;
+        case METRIC_INVOL_CON_SWITCHES:
+            return result->invol_con_switches;
+    }
+
+    if (metric >= METRIC_PHASE) {
+        value = result->phase_ns[metric - METRIC_PHASE];
+    } else {
+        value = result->perf[metric - METRIC_PERF];
+    }
+    return (value < 0) ? NAN : (long double)value;
+}
+
+
+/* Multiplier which turns a metric into a whole number for histograms.
+ * Times in seconds are recorded in nanoseconds; everything else is a count.
+ */
+static long double metric_scale(int metric) {
+    switch (metric) {
+        case METRIC_WALL_CLOCK:
+        case METRIC_USER_TIME:
+        case METRIC_SYS_TIME:
+            return 1000000000;
+    }
+    return 1;
+}
+
+
+/* Allocate a buffer for capacity results. */
+results_t * results_new(int capacity) {
+    results_t *results = (results_t*)calloc(1, sizeof(results_t));
+    results->capacity = capacity;
+    results->values = malloc(sizeof(long double) * METRIC_NUM * capacity);
+    return results;
+}
+
+
+/* Free the memory allocated to a buffer of results. */
+void results_free(results_t *results) {
+    free(results->values);
+    free(results);
+}
+
+
+/* Copy the metrics of one measurement into a buffer. */
+int results_add(results_t *results, result_t *result) {
+    int i;
+    if (results->count == results->capacity) {
+        return 1;
+    }
+    for (i = 0; i < METRIC_NUM; i++) {
+        results_column(results, i)[results->count] = result_metric(result, i);
+    }
+    results->perf_fallback |= result->perf_fallback;
+    results->count++;
+    return 0;
+}
+
+
+/* Every value of one metric in a buffer, in the order they were added. */
+long double * results_column(results_t *results, int metric) {
+    return results->values + (size_t)metric * results->capacity;
+}
+
+
+/* Number of measurements in a buffer which recorded a metric. */
+int results_recorded(results_t *results, int metric) {
+    long double *column = results_column(results, metric);
+    int i, n = 0;
+    for (i = 0; i < results->count; i++) {
+        if (!isnan(column[i])) {
+            n++;
+        }
+    }
+    return n;
+}
+
+
+/* Gather the metrics of measurement i in a buffer into a row. */
+static void results_row(results_t *results, int i, long double *row) {
+    int j;
+    for (j = 0; j < METRIC_NUM; j++) {
+        row[j] = results_column(results, j)[i];
+    }
 }
 
 
-/* Write out an array of result_ts to a CSV file. */
-int result_write_csv(result_t **result, char *filename, int num_experiments) {
-    unsigned int i = 0;
+/* Write out a buffer of results to a CSV file. */
+int result_write_csv(results_t *results, char *filename) {
+    long double row[METRIC_NUM];
+    int i;
     FILE *fp;
     fp = fopen(filename,"w+");
-    /* Write header. */
-    fprintf(fp, "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n",
+    if (fp == NULL) {
+        return EXIT_FAILURE;
+    }
+    result_write_csv_header(fp);
+    for (i = 0; i < results->count; i++) {
+        results_row(results, i, row);
+        write_csv_row(fp, row, i);
+    }
+    fclose(fp);
+    return EXIT_SUCCESS;
+}
+
+
+/* Write the header line of a CSV results file to an open file. */
+void result_write_csv_header(FILE *fp) {
+    int j;
+    fprintf(fp, "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s",
             "Experiment",
             "Wall clock time (s)",
             "Wall clock time (ns)",
@@ -84,45 +315,133 @@ int result_write_csv(result_t **result, char *filename, int num_experiments) {
             "Block output operations",
             "Voluntary context switches",
             "Involuntary context switches");
-    /* Write data. */
-    for (i = 0; i < num_experiments; i++) {
+    for (j = 0; j < PERF_NUM_COUNTERS; j++) {
+        fprintf(fp, ",%s", perf_counter_name(j));
+    }
+    for (j = 0; j < PHASE_NUM; j++) {
+        fprintf(fp, ",%s time (ns)", phase_name(j));
+    }
+    fprintf(fp, "\n");
+}
+
+
+/* Write one result_t as a line of a CSV results file. */
+void result_write_csv_row(FILE *fp, result_t *result, int experiment) {
+    long double row[METRIC_NUM];
+    int j;
+    for (j = 0; j < METRIC_NUM; j++) {
+        row[j] = result_metric(result, j);
+    }
+    write_csv_row(fp, row, experiment);
+}
+
+
+/* Write a row of metrics as one line of a CSV results file. Wall clock time
+ * is split into whole seconds and nanoseconds, and metrics which were not
+ * recorded are written as -1.
+ */
+static void write_csv_row(FILE *fp, long double *row, int experiment) {
+    long long wall_ns = llroundl(row[METRIC_WALL_CLOCK] * 1000000000);
+    int j;
+    fprintf(fp, "%d,%lld,%lld,%.6Lf,%.6Lf",
+            experiment,
+            wall_ns / 1000000000,
+            wall_ns % 1000000000,
+            row[METRIC_USER_TIME],
+            row[METRIC_SYS_TIME]);
+    for (j = METRIC_MAX_SET_SIZE; j < METRIC_NUM; j++) {
+        fprintf(fp, ",%.0Lf", isnan(row[j]) ? -1 : row[j]);
+    }
+    fprintf(fp, "\n");
+}
+
+
+/* Write out a buffer of results to a JSON file. */
+int result_write_json(results_t *results, char *filename) {
+    long double row[METRIC_NUM];
+    long long wall_ns;
+    int i, j;
+    FILE *fp;
+    fp = fopen(filename, "w+");
+    if (fp == NULL) {
+        return EXIT_FAILURE;
+    }
+    fprintf(fp, "[\n");
+    for (i = 0; i < results->count; i++) {
+        results_row(results, i, row);
+        wall_ns = llroundl(row[METRIC_WALL_CLOCK] * 1000000000);
         fprintf(fp,
-                "%d,%lld,%lld,%lld,%lld,%ld,%ld,%ld,%ld,%ld,%ld,%ld\n",
+                "  {\"experiment\": %d, "
+                "\"wall_clock_s\": %lld, \"wall_clock_ns\": %lld, "
+                "\"user_time_s\": %.6Lf, \"sys_time_s\": %.6Lf",
                 i,
-                result[i]->seconds,
-                result[i]->nanoseconds,
-                (long long int)result[i]->user_time->tv_sec,
-                (long long int)result[i]->sys_time->tv_sec,
-                result[i]->max_set_size,
-                result[i]->soft_fault,
-                result[i]->hard_fault,
-                result[i]->in_block,
-                result[i]->out_block,
-                result[i]->vol_con_switches,
-                result[i]->invol_con_switches);
+                wall_ns / 1000000000,
+                wall_ns % 1000000000,
+                row[METRIC_USER_TIME],
+                row[METRIC_SYS_TIME]);
+        for (j = METRIC_MAX_SET_SIZE; j < METRIC_PERF; j++) {
+            fprintf(fp, ", \"%s\": %.0Lf", metric_key(j), row[j]);
+        }
+        fprintf(fp, ", \"perf\": {");
+        for (j = 0; j < PERF_NUM_COUNTERS; j++) {
+            fprintf(fp, "%s\"%s\": ", j == 0 ? "" : ", ",
+                    perf_counter_name(j));
+            json_number(fp, row[METRIC_PERF + j]);
+        }
+        fprintf(fp, "}, \"phase_ns\": {");
+        for (j = 0; j < PHASE_NUM; j++) {
+            fprintf(fp, "%s\"%s\": ", j == 0 ? "" : ", ", phase_name(j));
+            json_number(fp, row[METRIC_PHASE + j]);
+        }
+        fprintf(fp, "}}%s\n", i + 1 < results->count ? "," : "");
     }
+    fprintf(fp, "]\n");
     fclose(fp);
     return EXIT_SUCCESS;
 }
 
 
-/* Write out an array of result_ts to a JSON file. */
-int result_write_json(result_t **result, char *filename, int num_experiments) {
-    printf("Not implemented.\n");
-    return EXIT_FAILURE;
-}
-
-
-/* Write out an array of result_ts to a LaTeX file. */
-int result_write_latex(result_t **result, char *filename, int num_experiments) {
-    printf("Not implemented.\n");
-    return EXIT_FAILURE;
+/* Write out a buffer of results to a LaTeX file, as a longtable with one
+ * row per measurement. Only the operating system's figures are included;
+ * counters and phases are in the CSV and JSON files.
+ */
+int result_write_latex(results_t *results, char *filename) {
+    long double row[METRIC_NUM];
+    int i, j;
+    FILE *fp;
+    fp = fopen(filename, "w+");
+    if (fp == NULL) {
+        return EXIT_FAILURE;
+    }
+    fprintf(fp, "%% Requires \\usepackage{longtable}.\n");
+    fprintf(fp, "\\begin{longtable}{r|rrr|rrrr}\n\\hline\n");
+    fprintf(fp, "Run & Wall clock (s) & User (s) & System (s) & "
+            "Max. RSS (KB) & Soft faults & "
+            "Vol. switches & Invol. switches \\\\\n\\hline\n\\endhead\n");
+    for (i = 0; i < results->count; i++) {
+        results_row(results, i, row);
+        fprintf(fp, "%d & %.6Lf & %.6Lf & %.6Lf", i,
+                row[METRIC_WALL_CLOCK],
+                row[METRIC_USER_TIME],
+                row[METRIC_SYS_TIME]);
+        for (j = METRIC_MAX_SET_SIZE; j < METRIC_PERF; j++) {
+            if (j == METRIC_MAX_SET_SIZE || j == METRIC_SOFT_FAULT ||
+                j == METRIC_VOL_CON_SWITCHES ||
+                j == METRIC_INVOL_CON_SWITCHES) {
+                fprintf(fp, " & %.0Lf", row[j]);
+            }
+        }
+        fprintf(fp, " \\\\\n");
+    }
+    fprintf(fp, "\\hline\n\\end{longtable}\n");
+    fclose(fp);
+    return EXIT_SUCCESS;
 }
 
 
 /* Allocate memory for a statistics_t type. */
 statistics_t * statistics_new() {
-    statistics_t *statistics = (statistics_t*)malloc(sizeof(statistics_t));
+    statistics_t *statistics = (statistics_t*)calloc(1, sizeof(statistics_t));
     return statistics;
 }
 
@@ -139,46 +458,138 @@ void hrule() {
 }
 
 
-/* Print summary of statistics. */
+/* Lookup table of the fields of a summary_t, for writing them all out. */
+typedef struct summary_field_t {
+    const char *name, *key;
+    size_t offset;
+} summary_field_t;
+
+static const summary_field_t summary_fields[] = {
+    { "Mean",              "mean",         offsetof(summary_t, mean) },
+    { "Std. dev.",         "stdev",        offsetof(summary_t, stdev) },
+    { "Minimum",           "min",          offsetof(summary_t, min) },
+    { "Median",            "median",       offsetof(summary_t, median) },
+    { "90th percentile",   "p90",          offsetof(summary_t, p90) },
+    { "99th percentile",   "p99",          offsetof(summary_t, p99) },
+    { "99.9th percentile", "p99_9",        offsetof(summary_t, p999) },
+    { "Maximum",           "max",          offsetof(summary_t, max) },
+    { "MAD",               "mad",          offsetof(summary_t, mad) },
+    { "Trimmed mean",      "trimmed_mean", offsetof(summary_t, trimmed_mean) },
+    { "Mean CI low",       "mean_low",     offsetof(summary_t, mean_low) },
+    { "Mean CI high",      "mean_high",    offsetof(summary_t, mean_high) },
+    { "Median CI low",     "median_low",   offsetof(summary_t, median_low) },
+    { "Median CI high",    "median_high",  offsetof(summary_t, median_high) }
+};
+
+#define NUM_SUMMARY_FIELDS \
+    (int)(sizeof(summary_fields) / sizeof(summary_fields[0]))
+
+
+/* Value of field f of a summary. */
+static long double summary_field(summary_t *summary, int f) {
+    return *(long double*)((char*)summary + summary_fields[f].offset);
+}
+
+
+/* Print the name of a metric, capitalised, at the start of a table row. */
+static void print_metric_name(statistics_t *stats, int metric) {
+    const char *name = metric_name(metric, stats->perf_fallback);
+    printf(" %c%-31s |", toupper(name[0]), name + 1);
+}
+
+
+/* Print a table row for one summarised metric. */
+static void print_metric(statistics_t *stats, int metric) {
+    print_metric_name(stats, metric);
+    printf(" %-15Lf | %-20Lf \n",
+           stats->metric[metric].mean, stats->metric[metric].stdev);
+}
+
+
+/* Print a table row of the distribution of one metric. */
+static void print_distribution(statistics_t *stats, int metric) {
+    summary_t *s = &stats->metric[metric];
+    print_metric_name(stats, metric);
+    printf(" %-11.5Lg %-11.5Lg %-11.5Lg %-11.5Lg %-11.5Lg %-11.5Lg "
+           "%-11.5Lg %-11.5Lg\n",
+           s->min, s->median, s->p90, s->p99, s->p999, s->max,
+           s->mad, s->trimmed_mean);
+}
+
+
+/* Print summary of statistics. Metrics which were never recorded, such as
+ * unavailable performance counters, are left out.
+ */
 void print_statistics(statistics_t *stats) {
+    int i;
     printf("\n");
     hrule();
-    printf(" %-30s | %-15s | %-20s \n",
+    printf(" %d experiments, %d warm-up runs discarded.\n",
+           stats->num_experiments, stats->num_warmup);
+    printf(" Wall clock time 95%% confidence interval: +/- %.2Lf%% of mean.\n",
+           stats->wall_clock_precision * 100);
+    hrule();
+    printf(" %-32s | %-15s | %-20s \n",
            "Measurement", "Mean", "Std. deviation");
     hrule();
-    printf(" %-30s | %-15Lf | %-20Lf \n",
-           "Wall clock time (s)",
-           stats->seconds_mean, stats->seconds_stdev);
-    printf(" %-30s | %-15Lf | %-20Lf \n",
-           "Wall clock time (ns)",
-           stats->nanoseconds_mean, stats->nanoseconds_stdev);
-    printf(" %-30s | %-15Lf | %-20Lf \n",
-           "User time (s)",
-           stats->user_time_seconds_mean, stats->user_time_seconds_stdev);
-    printf(" %-30s | %-15Lf | %-20Lf \n",
-           "System time (us)",
-           stats->sys_time_seconds_mean, stats->sys_time_seconds_stdev);
-    printf(" %-30s | %-15Lf | %-20Lf \n",
-           "Maximum resident size (KB)",
-           stats->max_set_size_mean, stats->max_set_size_stdev);
-    printf(" %-30s | %-15Lf | %-20Lf \n",
-           "Soft page faults", stats->soft_fault_mean, stats->soft_fault_stdev);
-    printf(" %-30s | %-15Lf | %-20Lf \n",
-           "Hard page faults",
-           stats->hard_fault_mean, stats->hard_fault_stdev);
-    printf(" %-30s | %-15Lf | %-20Lf \n",
-           "Number of input operations",
-           stats->in_block_mean, stats->in_block_stdev);
-    printf(" %-30s | %-15Lf | %-20Lf \n",
-           "Number of output operations",
-           stats->out_block_mean, stats->out_block_stdev);
-    printf(" %-30s | %-15Lf | %-20Lf \n",
-           "Voluntary context switches",
-           stats->vol_con_switches_mean, stats->vol_con_switches_stdev);
-    printf(" %-30s | %-15Lf | %-20Lf \n",
-           "Involuntary context switches",
-           stats->invol_con_switches_mean, stats->invol_con_switches_stdev);
+    for (i = 0; i < METRIC_NUM; i++) {
+        if (i < METRIC_PERF || !isnan(stats->metric[i].mean)) {
+            print_metric(stats, i);
+        }
+    }
     hrule();
+    printf(" %-32s | %-11s %-11s %-11s %-11s %-11s %-11s %-11s %-11s\n",
+           "Distribution", "Minimum", "Median", "90%", "99%", "99.9%",
+           "Maximum", "MAD", "Trim. mean");
+    hrule();
+    for (i = 0; i < METRIC_NUM; i++) {
+        if (i < METRIC_PERF || !isnan(stats->metric[i].mean)) {
+            print_distribution(stats, i);
+        }
+    }
+    hrule();
+    printf(" %-32s | %-23s | %-23s\n", "95% confidence interval",
+           "Mean", "Median");
+    hrule();
+    for (i = 0; i < METRIC_NUM; i++) {
+        if (i < METRIC_PERF || !isnan(stats->metric[i].mean)) {
+            print_metric_name(stats, i);
+            printf(" %-11.5Lg %-11.5Lg | %-11.5Lg %-11.5Lg\n",
+                   stats->metric[i].mean_low, stats->metric[i].mean_high,
+                   stats->metric[i].median_low, stats->metric[i].median_high);
+        }
+    }
+    hrule();
+    if (stats->resamples > 0) {
+        printf(" Intervals bootstrapped from %d resamples.\n",
+               stats->resamples);
+    } else {
+        printf(" Intervals from Student's t and the ranks of the median.\n");
+    }
+    if (stats->approximate) {
+        printf(" Percentiles and MAD estimated from histograms, "
+               "to within %.1f%%.\n", 100.0 / HISTOGRAM_SUB_BUCKETS);
+    }
+    if (stats->perf_fallback & (1 << PERF_USER_ONLY)) {
+        printf(" Performance counters counted user space only.\n");
+    }
+    if (!isnan(statistics_ipc(stats))) {
+        printf(" Instructions per cycle: %.3Lf\n", statistics_ipc(stats));
+    }
+    if (stats->hops > 0) {
+        printf(" %s time per hop: %.1Lf ns\n",
+               isnan(stats->metric[METRIC_PHASE + PHASE_STEADY].mean) ?
+               "Wall clock" : "Steady-state",
+               statistics_per_hop(stats, -1));
+        if (!isnan(stats->metric[METRIC_PERF + PERF_CACHE_MISSES].mean)) {
+            printf(" Cache misses per hop: %.3Lf\n",
+                   statistics_per_hop(stats, PERF_CACHE_MISSES));
+        }
+        if (!isnan(stats->metric[METRIC_PERF + PERF_INSTRUCTIONS].mean)) {
+            printf(" Instructions per hop: %.1Lf\n",
+                   statistics_per_hop(stats, PERF_INSTRUCTIONS));
+        }
+    }
     return;
 }
 
@@ -187,187 +598,862 @@ void print_statistics(statistics_t *stats) {
 int statistics_write_csv(statistics_t *stats, char *filename, int num_experiments) {
     FILE *fp;
     fp = fopen(filename,"w+");
-    /* Write header. */
-    fprintf(fp,
-            "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n",
-/*            "Number of experiments", */
-            "Mean wall clock time (s)",
-            "Std. dev. wall clock time (s)",
-            "Mean wall clock time (ns)",
-            "Std. dev. wall clock time (ns)",
-            "Mean user time (s)",
-            "Std. dev. user time (s)",
-            "Mean system time (s)",
-            "Std. dev. system time (s)",
-            "Mean maximum resident set size (KB)",
-            "Std. dev. maximum resident set size (KB)",
-            "Mean page reclaims (soft page faults)",
-            "Std. dev. page reclaims (soft page faults)",
-            "Mean page faults (hard page faults)",
-            "Std. dev. page faults (hard page faults)",
-            "Mean block input operations",
-            "Std. dev. block input operations",
-            "Mean block output operations",
-            "Std. dev. block output operations",
-            "Mean voluntary context switches",
-            "Std. dev. voluntary context switches",
-            "Mean involuntary context switches",
-            "Std. dev. involuntary context switches");
-    /* Write data. */
-    fprintf(fp,
-            "%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf\n",
-            stats->seconds_mean,
-            stats->seconds_stdev,
-            stats->nanoseconds_mean,
-            stats->nanoseconds_stdev,
-            stats->user_time_seconds_mean,
-            stats->user_time_seconds_stdev,
-            stats->sys_time_seconds_mean,
-            stats->sys_time_seconds_stdev,
-            stats->max_set_size_mean,
-            stats->max_set_size_stdev,
-            stats->soft_fault_mean,
-            stats->soft_fault_stdev,
-            stats->hard_fault_mean,
-            stats->hard_fault_stdev,
-            stats->in_block_mean,
-            stats->in_block_stdev,
-            stats->out_block_mean,
-            stats->out_block_stdev,
-            stats->vol_con_switches_mean,
-            stats->vol_con_switches_stdev,
-            stats->invol_con_switches_mean,
-            stats->invol_con_switches_stdev);
-
+    if (fp == NULL) {
+        return EXIT_FAILURE;
+    }
+    statistics_write_csv_header(fp, stats);
+    statistics_write_csv_row(fp, stats);
     fclose(fp);
     return EXIT_SUCCESS;
+}
 
 
-    return EXIT_SUCCESS;
+/* Write the header line of a CSV summary to an open file. */
+void statistics_write_csv_header(FILE *fp, statistics_t *stats) {
+    int i, f;
+    fprintf(fp, "%s,%s,%s",
+            "Number of experiments",
+            "Number of warm-up runs",
+            "Wall clock time 95% CI (relative half-width)");
+    for (i = 0; i < METRIC_NUM; i++) {
+        for (f = 0; f < NUM_SUMMARY_FIELDS; f++) {
+            fprintf(fp, ",%s %s", summary_fields[f].name,
+                    metric_name(i, stats->perf_fallback));
+        }
+    }
+    fprintf(fp, ",%s,%s,%s\n",
+            "Instructions per cycle",
+            "Time per hop (ns)",
+            "Cache misses per hop");
 }
 
 
-/* Write out a statistics_t struct to a CSV file. */
+/* Write a statistics_t struct as one line of a CSV summary. */
+void statistics_write_csv_row(FILE *fp, statistics_t *stats) {
+    int i, f;
+    fprintf(fp, "%d,%d,%Lf",
+            stats->num_experiments,
+            stats->num_warmup,
+            stats->wall_clock_precision);
+    for (i = 0; i < METRIC_NUM; i++) {
+        for (f = 0; f < NUM_SUMMARY_FIELDS; f++) {
+            fprintf(fp, ",%Lf", summary_field(&stats->metric[i], f));
+        }
+    }
+    fprintf(fp, ",%Lf,%Lf,%Lf\n",
+            statistics_ipc(stats),
+            statistics_per_hop(stats, -1),
+            statistics_per_hop(stats, PERF_CACHE_MISSES));
+}
+
+
+/* Write out a statistics_t struct to a JSON file. */
 int statistics_write_json(statistics_t *stats, char *filename, int num_experiments) {
-    printf("Not implemented.\n");
-    return EXIT_FAILURE;
+    int i, f, first;
+    FILE *fp;
+    fp = fopen(filename, "w+");
+    if (fp == NULL) {
+        return EXIT_FAILURE;
+    }
+    fprintf(fp, "{\n  \"num_experiments\": %d,\n  \"num_warmup\": %d,\n",
+            stats->num_experiments, stats->num_warmup);
+    fprintf(fp, "  \"wall_clock_precision\": ");
+    json_number(fp, stats->wall_clock_precision);
+    fprintf(fp, ",\n  \"percentiles_approximate\": %s",
+            stats->approximate ? "true" : "false");
+    fprintf(fp, ",\n  \"confidence\": %g,\n  \"resamples\": %d",
+            BOOTSTRAP_CONFIDENCE, stats->resamples);
+    fprintf(fp, ",\n  \"metrics\": {\n");
+    for (i = 0; i < METRIC_NUM; i++) {
+        fprintf(fp, "    \"%s\": {", metric_key(i));
+        for (f = 0; f < NUM_SUMMARY_FIELDS; f++) {
+            fprintf(fp, "%s\"%s\": ", f == 0 ? "" : ", ",
+                    summary_fields[f].key);
+            json_number(fp, summary_field(&stats->metric[i], f));
+        }
+        fprintf(fp, "},\n");
+    }
+    fprintf(fp, "    \"instructions_per_cycle\": ");
+    json_number(fp, statistics_ipc(stats));
+    fprintf(fp, "\n  },\n  \"perf_fallback\": [");
+    for (i = 0, first = 1; i < PERF_NUM_COUNTERS; i++) {
+        if (stats->perf_fallback & (1 << i)) {
+            fprintf(fp, "%s\"%s\"", first ? "" : ", ", perf_counter_name(i));
+            first = 0;
+        }
+    }
+    fprintf(fp, "],\n  \"perf_user_only\": %s",
+            stats->perf_fallback & (1 << PERF_USER_ONLY) ? "true" : "false");
+    fprintf(fp, ",\n  \"hops\": ");
+    json_number(fp, stats->hops);
+    fprintf(fp, ",\n  \"ns_per_hop\": ");
+    json_number(fp, statistics_per_hop(stats, -1));
+    fprintf(fp, ",\n  \"cache_misses_per_hop\": ");
+    json_number(fp, statistics_per_hop(stats, PERF_CACHE_MISSES));
+    fprintf(fp, "\n}\n");
+    fclose(fp);
+    return EXIT_SUCCESS;
 }
 
 
-/* Write out a statistics_t struct to a CSV file. */
+/* Write out a statistics_t struct to a LaTeX file, as a tabular with one row
+ * per recorded metric.
+ */
 int statistics_write_latex(statistics_t *stats, char *filename, int num_experiments) {
-    printf("Not implemented.\n");
-    return EXIT_FAILURE;
+    const char *name;
+    summary_t *s;
+    int i;
+    FILE *fp;
+    fp = fopen(filename, "w+");
+    if (fp == NULL) {
+        return EXIT_FAILURE;
+    }
+    fprintf(fp, "%% %d experiments, %d warm-up runs discarded.\n",
+            stats->num_experiments, stats->num_warmup);
+    fprintf(fp, "\\begin{tabular}{l|rrr|rrrrr}\n\\hline\n");
+    fprintf(fp, "Measurement & Mean & 95\\%% CI & Std. dev. & Median & "
+            "90\\%% & 99\\%% & 99.9\\%% & Max. \\\\\n\\hline\n");
+    for (i = 0; i < METRIC_NUM; i++) {
+        s = &stats->metric[i];
+        if (isnan(s->mean)) {
+            continue;
+        }
+        name = metric_name(i, stats->perf_fallback);
+        fprintf(fp, "%c%s & %.6Lg & [%.6Lg, %.6Lg] & %.6Lg & %.6Lg & "
+                "%.6Lg & %.6Lg & %.6Lg & %.6Lg \\\\\n",
+                toupper(name[0]), name + 1, s->mean, s->mean_low,
+                s->mean_high, s->stdev, s->median, s->p90, s->p99, s->p999,
+                s->max);
+    }
+    fprintf(fp, "\\hline\n\\end{tabular}\n");
+    fclose(fp);
+    return EXIT_SUCCESS;
 }
 
 
-/* Given an array of results, fill in the averages in a statistics summary.
- *
- * Note that the number of experiments is guaranteed to be >= 1.
+/* Order values from smallest to largest, for qsort(). */
+static int compare_values(const void *a, const void *b) {
+    long double x = *(const long double*)a, y = *(const long double*)b;
+    return (x > y) - (x < y);
+}
+
+
+/* Value at a fraction q of the way through n sorted values, by the
+ * nearest-rank method, as histogram_quantile().
+ */
+static long double sorted_quantile(long double *sorted, int n, long double q) {
+    long long rank = (long long)ceill(q * n);
+    if (rank < 1) {
+        rank = 1;
+    } else if (rank > n) {
+        rank = n;
+    }
+    return sorted[rank - 1];
+}
+
+
+/* Set the confidence interval on a mean from Student's t distribution. */
+static void t_interval(summary_t *summary, const running_t *running) {
+    long double half;
+    if (running->count < 2) {
+        summary->mean_low = summary->mean_high = NAN;
+        return;
+    }
+    half = t_critical_95(running->count - 1) *
+        sqrtl(running->m2 / (running->count - 1)) / sqrtl(running->count);
+    summary->mean_low = running->mean - half;
+    summary->mean_high = running->mean + half;
+}
+
+
+/* Fractions of the way through n values at which the ends of a confidence
+ * interval on their median lie. The rank of each end is binomial, which is
+ * close enough to normal for the sample sizes we see.
+ */
+static void median_rank_interval(long long n, long double q[2]) {
+    long double half = 1.96L * sqrtl(n) / 2;
+    q[0] = (n / 2.0L - half) / n;
+    q[1] = (n / 2.0L + half + 1) / n;
+}
+
+
+/* Fill in the summary of one metric from its n values, which are sorted in
+ * place and then overwritten. Confidence intervals are bootstrapped if
+ * bootstrap asks for any resamples, and otherwise come from Student's t
+ * distribution and the ranks of the median.
  */
-void summarise_statistics(result_t **results,
-                          statistics_t *stats,
-                          int num_experiments) {
-
-    long double seconds_total = 0, /* Temporary total. */
-            nanoseconds_total = 0,
-            user_time_seconds_total = 0,
-            sys_time_seconds_total = 0,
-            max_set_size_total = 0,
-            soft_fault_total = 0,
-            hard_fault_total = 0,
-            in_block_total = 0,
-            out_block_total = 0,
-            vol_con_switches_total = 0,
-            invol_con_switches_total = 0,
-            /* Temporary variances. */
-            seconds_nvar = 0,
-            nanoseconds_nvar = 0,
-            user_time_seconds_nvar = 0,
-            sys_time_seconds_nvar = 0,
-            max_set_size_nvar = 0,
-            soft_fault_nvar = 0,
-            hard_fault_nvar = 0,
-            in_block_nvar = 0,
-            out_block_nvar = 0,
-            vol_con_switches_nvar = 0,
-            invol_con_switches_nvar = 0;
-    int i = 0;
-    const long double recip = 1.0 / (long double)num_experiments;
-
-    /* Calculate totals for all values. */
-    for (i = 0; i < num_experiments; i++) {
-        seconds_total            += results[i]->seconds;
-        nanoseconds_total        += results[i]->nanoseconds;
-        user_time_seconds_total  += results[i]->user_time->tv_sec;
-        sys_time_seconds_total   += results[i]->sys_time->tv_sec;
-        max_set_size_total       += results[i]->max_set_size;
-        soft_fault_total         += results[i]->soft_fault;
-        hard_fault_total         += results[i]->hard_fault;
-        in_block_total           += results[i]->in_block;
-        out_block_total          += results[i]->out_block;
-        vol_con_switches_total   += results[i]->vol_con_switches;
-        invol_con_switches_total += results[i]->invol_con_switches;
-    }
-
-    /* Set means for all values. */
-    stats->seconds_mean = (long double) seconds_total / num_experiments;
-    stats->nanoseconds_mean = (long double) nanoseconds_total / num_experiments;
-    stats->user_time_seconds_mean = (long double) (user_time_seconds_total /
-                                                   num_experiments);
-    stats->sys_time_seconds_mean = (long double) (sys_time_seconds_total /
-                                                  num_experiments);
-    stats->max_set_size_mean = (long double) (max_set_size_total /
-                                              num_experiments);
-    stats->soft_fault_mean = (long double) soft_fault_total / num_experiments;
-    stats->hard_fault_mean = (long double) hard_fault_total / num_experiments;
-    stats->in_block_mean = (long double) in_block_total / num_experiments;
-    stats->out_block_mean = (long double) out_block_total / num_experiments;
-    stats->vol_con_switches_mean = (long double) (vol_con_switches_total /
-                                                  num_experiments);
-    stats->invol_con_switches_mean = (long double) (invol_con_switches_total /
-                                                    num_experiments);
-
-    /* Calculate n * variance for all values. */
-    for (i = 0; i < num_experiments; i++) {
-        seconds_nvar            += pow(results[i]->seconds -
-                                       stats->seconds_mean, 2);
-        nanoseconds_nvar        += pow(results[i]->nanoseconds -
-                                       stats->nanoseconds_mean, 2);
-        user_time_seconds_nvar  += pow(results[i]->user_time->tv_sec -
-                                       stats->user_time_seconds_mean, 2);
-        sys_time_seconds_nvar   += pow(results[i]->sys_time->tv_sec -
-                                       stats->sys_time_seconds_mean, 2);
-        max_set_size_nvar       += pow(results[i]->max_set_size -
-                                       stats->max_set_size_mean, 2);
-        soft_fault_nvar         += pow(results[i]->soft_fault -
-                                       stats->soft_fault_mean, 2);
-        hard_fault_nvar         += pow(results[i]->hard_fault -
-                                       stats->hard_fault_mean, 2);
-        in_block_nvar           += pow(results[i]->in_block -
-                                       stats->in_block_mean, 2);
-        out_block_nvar          += pow(results[i]->out_block -
-                                       stats->out_block_mean, 2);
-        vol_con_switches_nvar   += pow(results[i]->vol_con_switches -
-                                       stats->vol_con_switches_mean, 2);
-        invol_con_switches_nvar += pow(results[i]->invol_con_switches -
-                                       stats->invol_con_switches_mean, 2);
-    }
-
-    /* Set standard deviations for all values. */
-    stats->seconds_stdev            = sqrt(recip * seconds_nvar);
-    stats->nanoseconds_stdev        = sqrt(recip * nanoseconds_nvar);
-    stats->user_time_seconds_stdev  = sqrt(recip * user_time_seconds_nvar);
-    stats->sys_time_seconds_stdev   = sqrt(recip * sys_time_seconds_nvar);
-    stats->max_set_size_stdev       = sqrt(recip * max_set_size_nvar);
-    stats->soft_fault_stdev         = sqrt(recip * soft_fault_nvar);
-    stats->hard_fault_stdev         = sqrt(recip * hard_fault_nvar);
-    stats->in_block_stdev           = sqrt(recip * in_block_nvar);
-    stats->out_block_stdev          = sqrt(recip * out_block_nvar);
-    stats->vol_con_switches_stdev   = sqrt(recip * vol_con_switches_nvar);
-    stats->invol_con_switches_stdev = sqrt(recip * invol_con_switches_nvar);
+static void summarise_values(summary_t *summary, long double *values, int n,
+                             const bootstrap_t *bootstrap) {
+    long double q[2];
+    long double low = TRIMMED_MEAN_FRACTION * n;
+    long double high = (1 - TRIMMED_MEAN_FRACTION) * n;
+    long double sum = 0, weight = 0, from, to;
+    running_t running;
+    int i;
+
+    if (n == 0) {
+        summary->mean = summary->stdev = NAN;
+        summary->min = summary->median = summary->max = NAN;
+        summary->p90 = summary->p99 = summary->p999 = NAN;
+        summary->mad = summary->trimmed_mean = NAN;
+        summary->mean_low = summary->mean_high = NAN;
+        summary->median_low = summary->median_high = NAN;
+        return;
+    }
 
+    running_init(&running);
+    for (i = 0; i < n; i++) {
+        running_update(&running, values[i]);
+    }
+    summary->mean = running.mean;
+    summary->stdev = running_stdev(&running);
+
+    qsort(values, n, sizeof(long double), compare_values);
+    summary->min = values[0];
+    summary->median = sorted_quantile(values, n, 0.5);
+    summary->p90 = sorted_quantile(values, n, 0.9);
+    summary->p99 = sorted_quantile(values, n, 0.99);
+    summary->p999 = sorted_quantile(values, n, 0.999);
+    summary->max = values[n - 1];
+
+    /* Value i covers ranks [i, i + 1), of which [low, high) are kept. */
+    for (i = 0; i < n; i++) {
+        from = (i > low) ? i : low;
+        to = (i + 1 < high) ? i + 1 : high;
+        if (to > from) {
+            sum += (to - from) * values[i];
+            weight += to - from;
+        }
+    }
+    summary->trimmed_mean = (weight > 0) ? sum / weight : summary->median;
+
+    if (bootstrap != NULL && bootstrap->resamples > 0) {
+        long double mean_ci[2], median_ci[2];
+        bootstrap_ci(bootstrap, values, n, mean_ci, median_ci);
+        summary->mean_low = mean_ci[0];
+        summary->mean_high = mean_ci[1];
+        summary->median_low = median_ci[0];
+        summary->median_high = median_ci[1];
+    } else {
+        t_interval(summary, &running);
+        median_rank_interval(n, q);
+        summary->median_low = sorted_quantile(values, n, q[0]);
+        summary->median_high = sorted_quantile(values, n, q[1]);
+    }
+
+    for (i = 0; i < n; i++) {
+        values[i] = fabsl(values[i] - summary->median);
+    }
+    qsort(values, n, sizeof(long double), compare_values);
+    summary->mad = sorted_quantile(values, n, 0.5);
+}
+
+
+/* Given a buffer of results, fill in the averages, exact percentiles and
+ * confidence intervals in a statistics summary. Each metric is copied out
+ * of its column, skipping runs which did not record it, and sorted.
+ */
+void summarise_statistics(results_t *results, statistics_t *stats,
+                          const bootstrap_t *bootstrap) {
+    long double *values, *column;
+    running_t running;
+    int i, j, n;
+
+    values = malloc(sizeof(long double) * (results->count + 1));
+    for (i = 0; i < METRIC_NUM; i++) {
+        column = results_column(results, i);
+        for (j = 0, n = 0; j < results->count; j++) {
+            if (!isnan(column[j])) {
+                values[n++] = column[j];
+            }
+        }
+        if (i == METRIC_WALL_CLOCK) {
+            running_init(&running);
+            for (j = 0; j < n; j++) {
+                running_update(&running, values[j]);
+            }
+            stats->wall_clock_precision = running_precision(&running);
+        }
+        summarise_values(&stats->metric[i], values, n, bootstrap);
+    }
+    free(values);
+
+    stats->num_experiments = results->count;
+    stats->perf_fallback = results->perf_fallback;
+    stats->approximate = 0;
+    stats->resamples = (bootstrap != NULL) ? bootstrap->resamples : 0;
     return;
 }
 
-/* TODO: Implement confidence intervals. */
+
+/* Reset a running summary to hold no values. */
+void running_init(running_t *running) {
+    running->count = 0;
+    running->mean = 0;
+    running->m2 = 0;
+    running->min = INFINITY;
+    running->max = -INFINITY;
+}
+
+
+/* Add one value to a running summary, with Welford's method. */
+void running_update(running_t *running, long double value) {
+    long double delta = value - running->mean;
+    running->count++;
+    running->mean += delta / running->count;
+    running->m2 += delta * (value - running->mean);
+    if (value < running->min) {
+        running->min = value;
+    }
+    if (value > running->max) {
+        running->max = value;
+    }
+}
+
+
+/* Combine the values summarised in from into into, with the pairwise
+ * update of Chan, Golub and LeVeque.
+ */
+void running_merge(running_t *into, const running_t *from) {
+    long double delta = from->mean - into->mean;
+    long long count = into->count + from->count;
+
+    if (from->count == 0) {
+        return;
+    }
+    if (into->count == 0) {
+        *into = *from;
+        return;
+    }
+    into->mean += delta * from->count / count;
+    into->m2 += from->m2 +
+        delta * delta * into->count * from->count / count;
+    into->count = count;
+    if (from->min < into->min) {
+        into->min = from->min;
+    }
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+}
+
+
+/* Population standard deviation of the values in a running summary. */
+long double running_stdev(const running_t *running) {
+    if (running->count == 0) {
+        return NAN;
+    }
+    return sqrtl(running->m2 / running->count);
+}
+
+
+/* Relative half-width of the 95% confidence interval on the mean of the
+ * values in a running summary. With fewer than two values there is no
+ * estimate of the variance, so the interval is infinitely wide.
+ */
+long double running_precision(const running_t *running) {
+    long double stdev;
+
+    if (running->count < 2 || running->mean <= 0) {
+        return INFINITY;
+    }
+
+    /* Sample (n - 1) standard deviation. */
+    stdev = sqrtl(running->m2 / (running->count - 1));
+    return (t_critical_95(running->count - 1) * stdev /
+            sqrtl(running->count)) / running->mean;
+}
+
+
+/* Reset an accumulator to hold no results. */
+void accumulator_init(accumulator_t *acc) {
+    int i;
+    for (i = 0; i < METRIC_NUM; i++) {
+        running_init(&acc->metric[i]);
+        acc->hist[i] = NULL;
+    }
+    acc->perf_fallback = 0;
+}
+
+
+/* Free the histograms of an accumulator. */
+void accumulator_free(accumulator_t *acc) {
+    int i;
+    for (i = 0; i < METRIC_NUM; i++) {
+        histogram_free(acc->hist[i]);
+        acc->hist[i] = NULL;
+    }
+}
+
+
+/* Histogram of a metric in an accumulator, allocated on first use. */
+static histogram_t * accumulator_histogram(accumulator_t *acc, int metric) {
+    if (acc->hist[metric] == NULL) {
+        acc->hist[metric] = histogram_new();
+    }
+    return acc->hist[metric];
+}
+
+
+/* Add every metric of one result to an accumulator. Metrics the result did
+ * not record are skipped, so each metric keeps its own count.
+ */
+void accumulator_add(accumulator_t *acc, result_t *result) {
+    long double value;
+    int i;
+    for (i = 0; i < METRIC_NUM; i++) {
+        value = result_metric(result, i);
+        if (!isnan(value)) {
+            running_update(&acc->metric[i], value);
+            value = roundl(value * metric_scale(i));
+            histogram_record(accumulator_histogram(acc, i),
+                             value > 0 ? (unsigned long long)value : 0);
+        }
+    }
+    acc->perf_fallback |= result->perf_fallback;
+}
+
+
+/* Combine the results summarised in from into into. */
+void accumulator_merge(accumulator_t *into, const accumulator_t *from) {
+    int i;
+    for (i = 0; i < METRIC_NUM; i++) {
+        running_merge(&into->metric[i], &from->metric[i]);
+        if (from->hist[i] != NULL) {
+            histogram_merge(accumulator_histogram(into, i), from->hist[i]);
+        }
+    }
+    into->perf_fallback |= from->perf_fallback;
+}
+
+
+/* First line of every state file. */
+#define STATE_HEADER "Metric,Count,Mean,M2,Minimum,Maximum\n"
+
+
+/* Write the state of an accumulator to a CSV file, for merging later. The
+ * values are printed in hexadecimal floating point so nothing is lost.
+ * Non-empty histogram buckets follow, one per line, keyed by the smallest
+ * value they hold.
+ */
+int accumulator_write_csv(accumulator_t *acc, char *filename) {
+    running_t *r;
+    FILE *fp;
+    int i, j;
+    fp = fopen(filename, "w+");
+    if (fp == NULL) {
+        return EXIT_FAILURE;
+    }
+    fprintf(fp, "%s", STATE_HEADER);
+    for (i = 0; i < METRIC_NUM; i++) {
+        r = &acc->metric[i];
+        fprintf(fp, "%s,%lld,%La,%La,%La,%La\n",
+                metric_key(i), r->count, r->mean, r->m2, r->min, r->max);
+    }
+    /* Not a metric, but needed to label the cycles counter correctly. */
+    fprintf(fp, "perf_fallback,%d,0,0,0,0\n", acc->perf_fallback);
+    for (i = 0; i < METRIC_NUM; i++) {
+        if (acc->hist[i] == NULL) {
+            continue;
+        }
+        for (j = 0; j < HISTOGRAM_BUCKETS; j++) {
+            if (acc->hist[i]->counts[j] > 0) {
+                fprintf(fp, "bucket,%s,%llu,%lld\n", metric_key(i),
+                        histogram_lowest(j), acc->hist[i]->counts[j]);
+            }
+        }
+    }
+    fclose(fp);
+    return EXIT_SUCCESS;
+}
+
+
+/* The metric with a key, or -1 if there is none. */
+static int metric_by_key(const char *key) {
+    int i;
+    for (i = 0; i < METRIC_NUM; i++) {
+        if (strcmp(key, metric_key(i)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/* Merge the state saved by accumulator_write_csv() into an accumulator.
+ * The whole file is checked before anything is merged, so a truncated or
+ * foreign file is refused rather than merged as no experiments. Rows of
+ * metrics this build does not know are skipped, as stores skip them.
+ */
+int accumulator_read_csv(accumulator_t *acc, char *filename) {
+    char line[256], key[64];
+    unsigned long long lowest;
+    long long count;
+    accumulator_t saved;
+    running_t r;
+    FILE *fp;
+    int metrics = 0, failed = 0, i;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) {
+        return EXIT_FAILURE;
+    }
+    if (fgets(line, sizeof(line), fp) == NULL ||
+        strcmp(line, STATE_HEADER) != 0) {
+        fclose(fp);
+        return EXIT_FAILURE;
+    }
+    accumulator_init(&saved);
+    while (!failed && fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "bucket,%63[^,],%llu,%lld",
+                   key, &lowest, &count) == 3) {
+            i = metric_by_key(key);
+            if (i < 0 || count < 0) {
+                failed = 1;
+            } else {
+                histogram_record_count(accumulator_histogram(&saved, i),
+                                       lowest, count);
+            }
+            continue;
+        }
+        if (sscanf(line, "%63[^,],%lld,%La,%La,%La,%La", key, &r.count,
+                   &r.mean, &r.m2, &r.min, &r.max) != 6 || r.count < 0) {
+            failed = 1;
+            continue;
+        }
+        if (strcmp(key, "perf_fallback") == 0) {
+            saved.perf_fallback = (int)r.count;
+            continue;
+        }
+        i = metric_by_key(key);
+        if (i >= 0) {
+            saved.metric[i] = r;
+            metrics++;
+        }
+    }
+    fclose(fp);
+    if (!failed && metrics > 0) {
+        accumulator_merge(acc, &saved);
+    }
+    accumulator_free(&saved);
+    return failed || metrics == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/* Estimate a quantile of a metric from its histogram. The middle of a
+ * bucket may lie beyond the values actually seen, so it is clamped to them.
+ */
+static long double running_quantile(running_t *running, histogram_t *hist,
+                                    long double scale, long double q) {
+    long double value = histogram_quantile(hist, q) / scale;
+    if (value < running->min) {
+        return running->min;
+    } else if (value > running->max) {
+        return running->max;
+    }
+    return value;
+}
+
+
+/* Fill in a statistics summary from an accumulator. The mean, standard
+ * deviation and range are exact; percentiles, MAD and trimmed mean come
+ * from the histograms.
+ */
+void statistics_from_accumulator(statistics_t *stats, accumulator_t *acc) {
+    histogram_t *hist;
+    summary_t *s;
+    long double scale, q[2];
+    int i;
+    for (i = 0; i < METRIC_NUM; i++) {
+        s = &stats->metric[i];
+        hist = acc->hist[i];
+        if (acc->metric[i].count == 0 || hist == NULL) {
+            summarise_values(s, NULL, 0, NULL);
+            continue;
+        }
+        scale = metric_scale(i);
+        s->mean = acc->metric[i].mean;
+        s->stdev = running_stdev(&acc->metric[i]);
+        s->min = acc->metric[i].min;
+        s->max = acc->metric[i].max;
+        s->median = running_quantile(&acc->metric[i], hist, scale, 0.5);
+        s->p90 = running_quantile(&acc->metric[i], hist, scale, 0.9);
+        s->p99 = running_quantile(&acc->metric[i], hist, scale, 0.99);
+        s->p999 = running_quantile(&acc->metric[i], hist, scale, 0.999);
+        s->mad = histogram_mad(hist) / scale;
+        s->trimmed_mean =
+            histogram_trimmed_mean(hist, TRIMMED_MEAN_FRACTION) / scale;
+        /* Without the values there is nothing to resample. */
+        t_interval(s, &acc->metric[i]);
+        median_rank_interval(acc->metric[i].count, q);
+        s->median_low = running_quantile(&acc->metric[i], hist, scale, q[0]);
+        s->median_high = running_quantile(&acc->metric[i], hist, scale, q[1]);
+    }
+    stats->num_experiments = (int)acc->metric[METRIC_WALL_CLOCK].count;
+    stats->wall_clock_precision =
+        running_precision(&acc->metric[METRIC_WALL_CLOCK]);
+    stats->perf_fallback = acc->perf_fallback;
+    stats->approximate = 1;
+    stats->resamples = 0;
+}
+
+
+/* Two-sided 95% critical values of Student's t distribution, indexed by
+ * degrees of freedom. Larger df fall back on the coarser rows below.
+ */
+static const long double t_table_95[] = {
+    0,      12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+    2.228,  2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+    2.086,  2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+    2.042
+};
+
+
+/* Two-sided 95% critical value of Student's t distribution. */
+long double t_critical_95(int df) {
+    if (df < 1) {
+        return INFINITY;
+    } else if (df <= 30) {
+        return t_table_95[df];
+    } else if (df <= 40) {
+        return 2.021;
+    } else if (df <= 60) {
+        return 2.000;
+    } else if (df <= 120) {
+        return 1.980;
+    }
+    return 1.960;
+}
+
+
+/* Mean instructions per cycle, or NAN if either counter is unavailable or
+ * cycles were only approximated by a software clock.
+ */
+long double statistics_ipc(statistics_t *stats) {
+    long double instructions = stats->metric[METRIC_PERF +
+                                             PERF_INSTRUCTIONS].mean;
+    long double cycles = stats->metric[METRIC_PERF + PERF_CYCLES].mean;
+    if (isnan(instructions) || isnan(cycles) || cycles == 0 ||
+        (stats->perf_fallback & (1 << PERF_CYCLES))) {
+        return NAN;
+    }
+    return instructions / cycles;
+}
+
+
+/* Mean of a counter per token hop, or of time in nanoseconds if counter is
+ * -1. Time is steady-state time if that was recorded, otherwise wall clock
+ * time. NAN if the number of hops is not known.
+ */
+long double statistics_per_hop(statistics_t *stats, int counter) {
+    long double steady = stats->metric[METRIC_PHASE + PHASE_STEADY].mean;
+    if (stats->hops <= 0) {
+        return NAN;
+    }
+    if (counter < 0 && !isnan(steady)) {
+        return steady / stats->hops;
+    }
+    if (counter < 0) {
+        return stats->metric[METRIC_WALL_CLOCK].mean * 1000000000 /
+            stats->hops;
+    }
+    return stats->metric[METRIC_PERF + counter].mean / stats->hops;
+}
+
+
+/* The values of a metric which were recorded, sorted. Returns how many. */
+static int sorted_column(results_t *results, int metric, long double *values) {
+    long double *column = results_column(results, metric);
+    int i, n;
+    for (i = 0, n = 0; i < results->count; i++) {
+        if (!isnan(column[i])) {
+            values[n++] = column[i];
+        }
+    }
+    qsort(values, n, sizeof(long double), compare_values);
+    return n;
+}
+
+
+/* Mann-Whitney U test of two sorted samples, by the normal approximation
+ * with a correction for ties. Sets the two-sided p-value and Cliff's delta
+ * of the candidate against the baseline.
+ */
+static void mann_whitney(const long double *baseline, int n_baseline,
+                         const long double *candidate, int n_candidate,
+                         change_t *change) {
+    long double rank_sum = 0, ties = 0, rank = 0, u, z, sigma, value;
+    long double n = (long double)n_baseline + n_candidate;
+    long double pairs = (long double)n_baseline * n_candidate;
+    int i = 0, j = 0, in_baseline, in_candidate;
+
+    /* Walk both samples in order, one group of tied values at a time. */
+    while (i < n_baseline || j < n_candidate) {
+        if (j == n_candidate ||
+            (i < n_baseline && baseline[i] <= candidate[j])) {
+            value = baseline[i];
+        } else {
+            value = candidate[j];
+        }
+        for (in_baseline = 0; i < n_baseline && baseline[i] == value; i++) {
+            in_baseline++;
+        }
+        for (in_candidate = 0; j < n_candidate && candidate[j] == value;
+             j++) {
+            in_candidate++;
+        }
+        rank_sum += in_candidate *
+            (rank + (in_baseline + in_candidate + 1) / 2.0L);
+        ties += powl(in_baseline + in_candidate, 3) -
+            (in_baseline + in_candidate);
+        rank += in_baseline + in_candidate;
+    }
+
+    u = rank_sum - (long double)n_candidate * (n_candidate + 1) / 2;
+    change->cliffs_delta = 2 * u / pairs - 1;
+    sigma = sqrtl(pairs / 12 * ((n + 1) - ties / (n * (n - 1))));
+    if (sigma == 0) {
+        change->p_value = 1;
+        return;
+    }
+    z = (fabsl(u - pairs / 2) - 0.5L) / sigma;
+    change->p_value = z > 0 ? erfcl(z / sqrtl(2)) : 1;
+}
+
+
+/* Summarise two sets of results and test every metric for a change. The
+ * change in median is bootstrapped if bootstrap asks for resamples, and
+ * otherwise bounded by the ends of the two median intervals, which is
+ * conservative.
+ */
+void compare_results(results_t *baseline, results_t *candidate,
+                     comparison_t *comparison, const bootstrap_t *bootstrap) {
+    long double *base_values, *cand_values, ci[2];
+    summary_t *base, *cand;
+    change_t *change;
+    int i, n_base, n_cand;
+
+    summarise_statistics(baseline, &comparison->baseline, bootstrap);
+    summarise_statistics(candidate, &comparison->candidate, bootstrap);
+
+    base_values = malloc(sizeof(long double) * (baseline->count + 1));
+    cand_values = malloc(sizeof(long double) * (candidate->count + 1));
+    for (i = 0; i < METRIC_NUM; i++) {
+        change = &comparison->metric[i];
+        change->change = change->change_low = change->change_high = NAN;
+        change->cliffs_delta = change->p_value = NAN;
+        n_base = sorted_column(baseline, i, base_values);
+        n_cand = sorted_column(candidate, i, cand_values);
+        if (n_base == 0 || n_cand == 0) {
+            continue;
+        }
+        mann_whitney(base_values, n_base, cand_values, n_cand, change);
+
+        base = &comparison->baseline.metric[i];
+        cand = &comparison->candidate.metric[i];
+        if (base->median <= 0) {
+            continue;
+        }
+        change->change = cand->median / base->median - 1;
+        if (bootstrap != NULL && bootstrap->resamples > 0) {
+            bootstrap_median_change(bootstrap, base_values, n_base,
+                                    cand_values, n_cand, ci);
+            change->change_low = ci[0];
+            change->change_high = ci[1];
+        } else if (base->median_low > 0) {
+            change->change_low = cand->median_low / base->median_high - 1;
+            change->change_high = cand->median_high / base->median_low - 1;
+        }
+    }
+    free(cand_values);
+    free(base_values);
+}
+
+
+/* Non-zero if a metric grew significantly by more than threshold. */
+int comparison_regressed(comparison_t *comparison, int metric,
+                         double threshold) {
+    change_t *change = &comparison->metric[metric];
+    return change->p_value < COMPARISON_ALPHA && change->change > threshold;
+}
+
+
+/* Print a comparison. Metrics which either set did not record are left
+ * out, and those which regressed beyond threshold are marked with a *.
+ */
+void print_comparison(comparison_t *comparison, double threshold) {
+    statistics_t *base = &comparison->baseline;
+    change_t *change;
+    int i;
+
+    printf("\n");
+    hrule();
+    printf(" Baseline: %d experiments. Candidate: %d experiments.\n",
+           base->num_experiments, comparison->candidate.num_experiments);
+    hrule();
+    printf(" %-32s | %-11s %-11s | %-8s %-19s | %-7s %-9s\n",
+           "Median", "Baseline", "Candidate", "Change", "95% CI",
+           "Cliff d", "p");
+    hrule();
+    for (i = 0; i < METRIC_NUM; i++) {
+        change = &comparison->metric[i];
+        if (isnan(change->p_value)) {
+            continue;
+        }
+        print_metric_name(base, i);
+        printf(" %-11.5Lg %-11.5Lg | %+7.2Lf%% [%+7.2Lf%%, %+7.2Lf%%] | "
+               "%+-7.3Lf %-9.3Lg%s\n",
+               base->metric[i].median,
+               comparison->candidate.metric[i].median,
+               change->change * 100, change->change_low * 100,
+               change->change_high * 100, change->cliffs_delta,
+               change->p_value,
+               comparison_regressed(comparison, i, threshold) ? " *" : "");
+    }
+    hrule();
+    if (base->resamples > 0) {
+        printf(" Change intervals bootstrapped from %d resamples.\n",
+               base->resamples);
+    } else {
+        printf(" Change intervals bounded by the median intervals.\n");
+    }
+    printf(" p from the Mann-Whitney U test. * marks a significant "
+           "slowdown of over %g%%.\n", threshold * 100);
+}
+
+
+/* Write out a comparison to a CSV file, one line per metric. */
+int comparison_write_csv(comparison_t *comparison, char *filename) {
+    change_t *change;
+    FILE *fp;
+    int i;
+    fp = fopen(filename, "w+");
+    if (fp == NULL) {
+        return EXIT_FAILURE;
+    }
+    fprintf(fp, "Metric,Baseline median,Candidate median,Change,"
+                "Change CI low,Change CI high,Cliff's delta,p-value\n");
+    for (i = 0; i < METRIC_NUM; i++) {
+        change = &comparison->metric[i];
+        if (isnan(change->p_value)) {
+            continue;
+        }
+        fprintf(fp, "%s,%Lf,%Lf,%Lf,%Lf,%Lf,%Lf,%Lg\n", metric_key(i),
+                comparison->baseline.metric[i].median,
+                comparison->candidate.metric[i].median,
+                change->change, change->change_low, change->change_high,
+                change->cliffs_delta, change->p_value);
+    }
+    fclose(fp);
+    return EXIT_SUCCESS;
+}
+
+
+/* Write a number to a JSON file, or null if it is not finite. */
+static void json_number(FILE *fp, long double value) {
+    if (isfinite(value)) {
+        fprintf(fp, "%Lf", value);
+    } else {
+        fprintf(fp, "null");
+    }
+}
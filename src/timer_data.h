@@ -3,37 +3,174 @@
  * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
  */
 
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "timer_bootstrap.h"
+#include "timer_histogram.h"
+#include "timer_perf.h"
+
+/* Phases of a run, delimited by "start" and "end" lines on its stdout. */
+typedef enum phase_t {
+    PHASE_SETUP,    /* From launch to "start". */
+    PHASE_STEADY,   /* From "start" to "end". */
+    PHASE_TEARDOWN, /* From "end" to exit. */
+    PHASE_NUM
+} phase_t;
+
+/* Value recorded for a phase whose markers were not seen. */
+#define PHASE_UNAVAILABLE (-1LL)
+
 /* Results from a single measurement. */
 typedef struct result_t {
     /* Timings from a nanosecond-resolution monotonic clock. */
     long long seconds, nanoseconds;
     /* Time spent in user and system mode, according to rusage. */
-    struct timeval *user_time, *sys_time;
+    struct timeval user_time, sys_time;
     /* Data from the operating system. */
     long int max_set_size, soft_fault, hard_fault, in_block, out_block, \
         vol_con_switches, invol_con_switches;
+    /* Performance counters, or PERF_UNAVAILABLE. Bit i of perf_fallback is
+     * set if counter i was replaced by a software event.
+     */
+    long long perf[PERF_NUM_COUNTERS];
+    int perf_fallback;
+    /* Duration of each phase in nanoseconds, or PHASE_UNAVAILABLE. */
+    long long phase_ns[PHASE_NUM];
 } result_t;
 
 
+/* Every quantity which is summarised over a number of results. Performance
+ * counters and phases occupy PERF_NUM_COUNTERS and PHASE_NUM consecutive
+ * entries, in the order of perf_counter_t and phase_t.
+ */
+typedef enum metric_t {
+    METRIC_WALL_CLOCK,          /* Seconds. */
+    METRIC_USER_TIME,           /* Seconds. */
+    METRIC_SYS_TIME,            /* Seconds. */
+    METRIC_MAX_SET_SIZE,
+    METRIC_SOFT_FAULT,
+    METRIC_HARD_FAULT,
+    METRIC_IN_BLOCK,
+    METRIC_OUT_BLOCK,
+    METRIC_VOL_CON_SWITCHES,
+    METRIC_INVOL_CON_SWITCHES,
+    METRIC_PERF,
+    METRIC_PHASE = METRIC_PERF + PERF_NUM_COUNTERS,
+    METRIC_NUM = METRIC_PHASE + PHASE_NUM
+} metric_t;
+
+
+/* Results from many measurements, stored one metric after another so that
+ * each metric can be scanned and sorted as a single contiguous block.
+ */
+typedef struct results_t {
+    int count, capacity;
+    /* values[metric * capacity + i] is a metric of measurement i, or NAN. */
+    long double *values;
+    /* Bit i is set if counter i was replaced by a software event. */
+    int perf_fallback;
+} results_t;
+
+
+/* Running count, mean, sum of squared deviations and range of one metric,
+ * updated one value at a time with Welford's method.
+ */
+typedef struct running_t {
+    long long count;
+    long double mean, m2, min, max;
+} running_t;
+
+
+/* Running summary of every metric. Uses constant memory however many results
+ * are added, and summaries of separate runs can be merged exactly. Each
+ * metric also has a histogram, allocated once it has a value, from which
+ * percentiles are estimated.
+ */
+typedef struct accumulator_t {
+    running_t metric[METRIC_NUM];
+    histogram_t *hist[METRIC_NUM];
+    /* Bit i is set if counter i was replaced by a software event. */
+    int perf_fallback;
+} accumulator_t;
+
+
+/* Summary of one metric. */
+typedef struct summary_t {
+    long double mean, stdev;
+    long double min, median, p90, p99, p999, max;
+    /* Median absolute deviation from the median. */
+    long double mad;
+    /* Mean of the values left after discarding the lowest and highest
+     * TRIMMED_MEAN_FRACTION of them.
+     */
+    long double trimmed_mean;
+    /* BOOTSTRAP_CONFIDENCE intervals on the mean and median, as low and
+     * high ends. NAN if there were too few values to estimate them.
+     */
+    long double mean_low, mean_high, median_low, median_high;
+} summary_t;
+
+#define TRIMMED_MEAN_FRACTION 0.1
+
+
 /* Summary of results from experiments. */
 typedef struct statistics_t {
-    /* Timings from a nanosecond-resolution monotonic clock. */
-    long double seconds_mean, seconds_stdev, \
-        nanoseconds_mean, nanoseconds_stdev;
-    /* Time spent in user and system mode, according to rusage. */
-    long double user_time_seconds_mean, user_time_seconds_stdev, \
-        sys_time_seconds_mean, sys_time_seconds_stdev; /* TODO: Missing usec. */
-    /* Data from the operating system. */
-    long double max_set_size_mean, max_set_size_stdev, \
-        soft_fault_mean, soft_fault_stdev, \
-        hard_fault_mean, hard_fault_stdev, \
-        in_block_mean, in_block_stdev, \
-        out_block_mean, out_block_stdev, \
-        vol_con_switches_mean, vol_con_switches_stdev, \
-        invol_con_switches_mean, invol_con_switches_stdev;
+    /* Number of measured runs and discarded warm-up runs. */
+    int num_experiments, num_warmup;
+    /* Relative half-width of the 95% confidence interval on wall clock time. */
+    long double wall_clock_precision;
+    /* Every metric, NAN where no run recorded it. */
+    summary_t metric[METRIC_NUM];
+    /* Bit i is set if counter i was replaced by a software event. */
+    int perf_fallback;
+    /* Set if percentiles were estimated from histograms rather than the
+     * results themselves, so are only accurate to the width of a bucket.
+     */
+    int approximate;
+    /* Resamples behind the confidence intervals. Zero if the intervals came
+     * from Student's t distribution and the ranks of the median instead.
+     */
+    int resamples;
+    /* Token hops per run, if known, for per-hop figures. Zero if unknown. */
+    long double hops;
 } statistics_t;
 
 
+/* Change in one metric from a baseline to a candidate set of results. */
+typedef struct change_t {
+    /* Relative change in the median, i.e. candidate / baseline - 1, and its
+     * BOOTSTRAP_CONFIDENCE interval. NAN if it could not be estimated.
+     */
+    long double change, change_low, change_high;
+    /* Cliff's delta, P(candidate > baseline) - P(candidate < baseline). */
+    long double cliffs_delta;
+    /* Two-sided p-value of the Mann-Whitney U test. */
+    long double p_value;
+} change_t;
+
+/* Comparison of every metric of two sets of results. */
+typedef struct comparison_t {
+    statistics_t baseline, candidate;
+    change_t metric[METRIC_NUM];
+} comparison_t;
+
+/* A change is significant if its p-value is below this. */
+#define COMPARISON_ALPHA (1 - BOOTSTRAP_CONFIDENCE)
+
+
+/* Readable name of a phase, e.g. "setup". */
+const char * phase_name(phase_t phase);
+
+
+/* Readable name of a metric, e.g. "wall clock time (s)". */
+const char * metric_name(int metric, int perf_fallback);
+
+
+/* Short name of a metric for JSON keys and state files, e.g. "wall_clock_s". */
+const char * metric_key(int metric);
+
+
 /* Allocate and free result types. */
 result_t * result_new();
 void result_free (result_t* result);
@@ -43,6 +180,33 @@ void result_free (result_t* result);
 void print_result(result_t *result);
 
 
+/* Wall clock time of a single measurement in seconds. */
+long double result_wall_clock(result_t *result);
+
+
+/* Value of a metric in a single measurement, or NAN if it was not recorded. */
+long double result_metric(result_t *result, int metric);
+
+
+/* Allocate a buffer for capacity results, and free one. */
+results_t * results_new(int capacity);
+void results_free(results_t *results);
+
+
+/* Copy the metrics of one measurement into a buffer. Returns 0 on success,
+ * or 1 if the buffer is full.
+ */
+int results_add(results_t *results, result_t *result);
+
+
+/* Every value of one metric in a buffer, in the order they were added. */
+long double * results_column(results_t *results, int metric);
+
+
+/* Number of measurements in a buffer which recorded a metric. */
+int results_recorded(results_t *results, int metric);
+
+
 /* Allocate and free statistics types. */
 statistics_t * statistics_new();
 void statistics_free (statistics_t* statistics);
@@ -52,28 +216,120 @@ void statistics_free (statistics_t* statistics);
 void print_statistics(statistics_t *stats);
 
 
-/* Calculate means and standard deviations. */
-void summarise_statistics(result_t **results,
-                          statistics_t *stats,
-                          int num_experiments);
+/* Calculate means, standard deviations, exact percentiles and confidence
+ * intervals, bootstrapped unless bootstrap is NULL or asks for no resamples.
+ */
+void summarise_statistics(results_t *results, statistics_t *stats,
+                          const bootstrap_t *bootstrap);
+
+
+/* Reset a running summary to hold no values. */
+void running_init(running_t *running);
+
+/* Add one value to a running summary. */
+void running_update(running_t *running, long double value);
+
+/* Combine the values summarised in from into into. */
+void running_merge(running_t *into, const running_t *from);
+
+/* Population standard deviation of the values in a running summary. */
+long double running_stdev(const running_t *running);
+
+/* Relative half-width of the 95% confidence interval on the mean of the
+ * values in a running summary. Infinite with fewer than two values.
+ */
+long double running_precision(const running_t *running);
+
+
+/* Reset an accumulator to hold no results. */
+void accumulator_init(accumulator_t *acc);
 
+/* Free the histograms of an accumulator. */
+void accumulator_free(accumulator_t *acc);
 
-/* Write out an array of result_ts to a CSV file. */
-int result_write_csv(result_t **result, char *filename, int num_experiments);
+/* Add every metric of one result to an accumulator. */
+void accumulator_add(accumulator_t *acc, result_t *result);
 
-/* Write out an array of result_ts to a JSON file. */
-int result_write_json(result_t **result, char *filename, int num_experiments);
+/* Combine the results summarised in from into into. */
+void accumulator_merge(accumulator_t *into, const accumulator_t *from);
 
-/* Write out an array of result_ts to a LaTeX file. */
-int result_write_latex(result_t **result, char *filename, int num_experiments);
+/* Write the state of an accumulator to a CSV file, for merging later. */
+int accumulator_write_csv(accumulator_t *acc, char *filename);
+
+/* Merge the state saved by accumulator_write_csv() into an accumulator.
+ * Returns 0 on success, or 1 if the file is not a state file, has a line
+ * which cannot be parsed, or holds no metrics, leaving acc untouched.
+ */
+int accumulator_read_csv(accumulator_t *acc, char *filename);
+
+/* Fill in a statistics summary from an accumulator, with percentiles and
+ * median confidence intervals estimated from its histograms.
+ */
+void statistics_from_accumulator(statistics_t *stats, accumulator_t *acc);
+
+
+/* Two-sided 95% critical value of Student's t distribution. */
+long double t_critical_95(int df);
+
+
+/* Mean instructions per cycle, or NAN if it cannot be calculated. */
+long double statistics_ipc(statistics_t *stats);
+
+
+/* Mean of a performance counter per token hop, or of time in nanoseconds if
+ * counter is -1. NAN if the number of hops is not known.
+ */
+long double statistics_per_hop(statistics_t *stats, int counter);
+
+
+/* Summarise two sets of results as summarise_statistics() would, and test
+ * every metric recorded by both for a change from baseline to candidate.
+ */
+void compare_results(results_t *baseline, results_t *candidate,
+                     comparison_t *comparison, const bootstrap_t *bootstrap);
+
+
+/* Non-zero if a metric grew by more than threshold (e.g. 0.05 for 5%) and
+ * the change is significant.
+ */
+int comparison_regressed(comparison_t *comparison, int metric,
+                         double threshold);
+
+
+/* Print a comparison, marking metrics which regressed beyond threshold. */
+void print_comparison(comparison_t *comparison, double threshold);
+
+
+/* Write out a comparison to a CSV file. */
+int comparison_write_csv(comparison_t *comparison, char *filename);
+
+
+/* Write out a buffer of results to a CSV file. */
+int result_write_csv(results_t *results, char *filename);
+
+/* Write the header line of a CSV results file to an open file. */
+void result_write_csv_header(FILE *fp);
+
+/* Write one result_t as a line of a CSV results file. */
+void result_write_csv_row(FILE *fp, result_t *result, int experiment);
+
+/* Write out a buffer of results to a JSON file. */
+int result_write_json(results_t *results, char *filename);
+
+/* Write out a buffer of results to a LaTeX file. */
+int result_write_latex(results_t *results, char *filename);
 
 /* Write out a statistics_t struct to a CSV file. */
 int statistics_write_csv(statistics_t *stats, char *filename, int num_experiments);
 
-/* Write out a statistics_t struct to a CSV file. */
+/* Write the header line of a CSV summary to an open file. */
+void statistics_write_csv_header(FILE *fp, statistics_t *stats);
+
+/* Write a statistics_t struct as one line of a CSV summary. */
+void statistics_write_csv_row(FILE *fp, statistics_t *stats);
+
+/* Write out a statistics_t struct to a JSON file. */
 int statistics_write_json(statistics_t *stats, char *filename, int num_experiments);
 
-/* Write out a statistics_t struct to a CSV file. */
+/* Write out a statistics_t struct to a LaTeX file. */
 int statistics_write_latex(statistics_t *stats, char *filename, int num_experiments);
-
-/* TODO: Confidence intervals. */
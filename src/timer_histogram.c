@@ -0,0 +1,194 @@
+/* Log-bucketed histograms of non-negative integers, in the style of
+ * HdrHistogram.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "timer_histogram.h"
+
+#define HALF_BUCKETS (HISTOGRAM_SUB_BUCKETS / 2)
+
+/* A bucket's distance from the median, for histogram_mad(). */
+typedef struct deviation_t {
+    long double deviation;
+    long long count;
+} deviation_t;
+
+
+/* Allocate an empty histogram. */
+histogram_t * histogram_new() {
+    return (histogram_t*)calloc(1, sizeof(histogram_t));
+}
+
+
+/* Free the memory allocated to a histogram. */
+void histogram_free(histogram_t *hist) {
+    free(hist);
+}
+
+
+/* Index of the bucket holding value. Small values have a bucket each. Above
+ * that, the top HISTOGRAM_SUB_BUCKET_BITS bits of a value pick its bucket
+ * within its power of two.
+ */
+int histogram_index(unsigned long long value) {
+    int shift;
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (int)value;
+    }
+    shift = 63 - __builtin_clzll(value) - (HISTOGRAM_SUB_BUCKET_BITS - 1);
+    return HISTOGRAM_SUB_BUCKETS + (shift - 1) * HALF_BUCKETS +
+        (int)(value >> shift) - HALF_BUCKETS;
+}
+
+
+/* Smallest value held by a bucket. */
+unsigned long long histogram_lowest(int index) {
+    int offset = index - HISTOGRAM_SUB_BUCKETS;
+    if (offset < 0) {
+        return (unsigned long long)index;
+    }
+    return (unsigned long long)(offset % HALF_BUCKETS + HALF_BUCKETS) <<
+        (offset / HALF_BUCKETS + 1);
+}
+
+
+/* Number of values held by a bucket. */
+unsigned long long histogram_width(int index) {
+    int offset = index - HISTOGRAM_SUB_BUCKETS;
+    if (offset < 0) {
+        return 1;
+    }
+    return 1ULL << (offset / HALF_BUCKETS + 1);
+}
+
+
+/* Value which stands for every value in a bucket. */
+static long double bucket_middle(int index) {
+    return (long double)histogram_lowest(index) +
+        (long double)(histogram_width(index) - 1) / 2;
+}
+
+
+/* Count one value. */
+void histogram_record(histogram_t *hist, unsigned long long value) {
+    histogram_record_count(hist, value, 1);
+}
+
+
+/* Count occurrences of one value, e.g. when reloading a saved histogram. */
+void histogram_record_count(histogram_t *hist, unsigned long long value,
+                            long long count) {
+    hist->counts[histogram_index(value)] += count;
+    hist->total += count;
+}
+
+
+/* Add the counts of from to into. */
+void histogram_merge(histogram_t *into, const histogram_t *from) {
+    int i;
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        into->counts[i] += from->counts[i];
+    }
+    into->total += from->total;
+}
+
+
+/* Value at a fraction q of the way through the recorded values, by the
+ * nearest-rank method.
+ */
+long double histogram_quantile(const histogram_t *hist, long double q) {
+    long long rank, seen = 0;
+    int i;
+
+    if (hist->total == 0) {
+        return NAN;
+    }
+    rank = (long long)ceill(q * hist->total);
+    if (rank < 1) {
+        rank = 1;
+    }
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            return bucket_middle(i);
+        }
+    }
+    return bucket_middle(HISTOGRAM_BUCKETS - 1);
+}
+
+
+/* Mean of the values ranked between trim and 1 - trim of the way through
+ * the recorded values. Buckets which straddle either end contribute in
+ * proportion to their overlap.
+ */
+long double histogram_trimmed_mean(const histogram_t *hist, long double trim) {
+    long double low = trim * hist->total, high = (1 - trim) * hist->total;
+    long double sum = 0, weight = 0, from, to;
+    long long seen = 0;
+    int i;
+
+    if (hist->total == 0) {
+        return NAN;
+    }
+    for (i = 0; i < HISTOGRAM_BUCKETS && seen < high; i++) {
+        if (hist->counts[i] == 0) {
+            continue;
+        }
+        from = (seen > low) ? seen : low;
+        to = (seen + hist->counts[i] < high) ? seen + hist->counts[i] : high;
+        if (to > from) {
+            sum += (to - from) * bucket_middle(i);
+            weight += to - from;
+        }
+        seen += hist->counts[i];
+    }
+    return (weight > 0) ? sum / weight : histogram_quantile(hist, 0.5);
+}
+
+
+/* Order deviations from smallest to largest, for qsort(). */
+static int compare_deviations(const void *a, const void *b) {
+    long double x = ((const deviation_t*)a)->deviation;
+    long double y = ((const deviation_t*)b)->deviation;
+    return (x > y) - (x < y);
+}
+
+
+/* Median absolute deviation from the median. Each bucket contributes its
+ * count at the distance of its middle from the median.
+ */
+long double histogram_mad(const histogram_t *hist) {
+    deviation_t *deviations;
+    long double median, mad = NAN;
+    long long rank, seen = 0;
+    int i, n = 0;
+
+    if (hist->total == 0) {
+        return NAN;
+    }
+    median = histogram_quantile(hist, 0.5);
+    deviations = malloc(sizeof(deviation_t) * HISTOGRAM_BUCKETS);
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (hist->counts[i] > 0) {
+            deviations[n].deviation = fabsl(bucket_middle(i) - median);
+            deviations[n].count = hist->counts[i];
+            n++;
+        }
+    }
+    qsort(deviations, n, sizeof(deviation_t), compare_deviations);
+
+    rank = (hist->total + 1) / 2;
+    for (i = 0; i < n; i++) {
+        seen += deviations[i].count;
+        if (seen >= rank) {
+            mad = deviations[i].deviation;
+            break;
+        }
+    }
+    free(deviations);
+    return mad;
+}
@@ -0,0 +1,69 @@
+/* Log-bucketed histograms of non-negative integers, in the style of
+ * HdrHistogram. Every value is recorded to within 1 part in
+ * HISTOGRAM_SUB_BUCKETS / 2, whatever its magnitude, and a histogram takes
+ * the same space and time however many values it holds.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#ifndef TIMER_HISTOGRAM_H
+#define TIMER_HISTOGRAM_H
+
+/* Values below HISTOGRAM_SUB_BUCKETS are counted exactly. Above that, each
+ * power of two is split into HISTOGRAM_SUB_BUCKETS / 2 buckets.
+ */
+#define HISTOGRAM_SUB_BUCKET_BITS 8
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS \
+    (HISTOGRAM_SUB_BUCKETS + \
+     (64 - HISTOGRAM_SUB_BUCKET_BITS) * (HISTOGRAM_SUB_BUCKETS / 2))
+
+typedef struct histogram_t {
+    long long total;
+    long long counts[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+
+/* Allocate an empty histogram, and free one. */
+histogram_t * histogram_new();
+void histogram_free(histogram_t *hist);
+
+
+/* Index of the bucket holding value. */
+int histogram_index(unsigned long long value);
+
+
+/* Smallest value, and number of values, held by a bucket. */
+unsigned long long histogram_lowest(int index);
+unsigned long long histogram_width(int index);
+
+
+/* Count one value, or count occurrences of it. */
+void histogram_record(histogram_t *hist, unsigned long long value);
+void histogram_record_count(histogram_t *hist, unsigned long long value,
+                            long long count);
+
+
+/* Add the counts of from to into. */
+void histogram_merge(histogram_t *into, const histogram_t *from);
+
+
+/* Value at a fraction q (0 <= q <= 1) of the way through the recorded values,
+ * taken as the middle of the bucket it falls in. NAN if the histogram is
+ * empty.
+ */
+long double histogram_quantile(const histogram_t *hist, long double q);
+
+
+/* Mean of the values left after the lowest and highest fraction trim of
+ * them are discarded. NAN if the histogram is empty.
+ */
+long double histogram_trimmed_mean(const histogram_t *hist, long double trim);
+
+
+/* Median absolute deviation from the median. NAN if the histogram is
+ * empty.
+ */
+long double histogram_mad(const histogram_t *hist);
+
+#endif /* TIMER_HISTOGRAM_H */
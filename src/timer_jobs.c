@@ -0,0 +1,206 @@
+/* Run a campaign of commands concurrently on disjoint sets of CPUs.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "timer_jobs.h"
+
+/* Longest line accepted in a job file. */
+#define MAX_JOB_LINE 4096
+
+/* Length of an output file prefix such as "job12-". */
+#define MAX_PREFIX 32
+
+
+/* Read commands from filename, one per line. */
+int jobs_read(const char *filename, char ***commands) {
+    char line[MAX_JOB_LINE], *start;
+    int num_jobs = 0, capacity = 16;
+    size_t len;
+    FILE *fp;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    *commands = malloc(sizeof(char*) * capacity);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        /* Strip leading whitespace and the trailing newline. */
+        for (start = line; *start == ' ' || *start == '\t'; start++)
+            ;
+        len = strlen(start);
+        while (len > 0 && (start[len - 1] == '\n' || start[len - 1] == '\r' ||
+                           start[len - 1] == ' ' || start[len - 1] == '\t')) {
+            start[--len] = '\0';
+        }
+        if (len == 0 || *start == '#') {
+            continue;
+        }
+        if (num_jobs == capacity) {
+            capacity *= 2;
+            *commands = realloc(*commands, sizeof(char*) * capacity);
+        }
+        (*commands)[num_jobs++] = strdup(start);
+    }
+
+    fclose(fp);
+    return num_jobs;
+}
+
+
+/* Free an array of commands returned by jobs_read(). */
+void jobs_free(char **commands, int num_jobs) {
+    int i;
+    for (i = 0; i < num_jobs; i++) {
+        free(commands[i]);
+    }
+    free(commands);
+}
+
+
+/* Start job number job in a process pinned to CPUs cpus[0..cores_per_job). */
+static pid_t start_job(char *command, int job, const int *cpus,
+                       int cores_per_job, job_runner_t run) {
+    char prefix[MAX_PREFIX];
+    cpu_set_t set;
+    pid_t pid;
+    int i;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid != 0) { /* Parent process, or fork() failed. */
+        return pid;
+    }
+
+    /* Child process. Anything it launches inherits this affinity. */
+    CPU_ZERO(&set);
+    for (i = 0; i < cores_per_job; i++) {
+        CPU_SET(cpus[i], &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("Could not set CPU affinity of job");
+        _exit(EXIT_FAILURE);
+    }
+    snprintf(prefix, sizeof(prefix), "job%d-", job);
+    exit(run(command, prefix) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+
+/* List the CPUs this process may run on. */
+int jobs_cpus(int **cpus) {
+    cpu_set_t allowed;
+    int num_cpus = 0, i;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return -1;
+    }
+    *cpus = malloc(sizeof(int) * CPU_SETSIZE);
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &allowed)) {
+            (*cpus)[num_cpus++] = i;
+        }
+    }
+    return num_cpus;
+}
+
+
+/* Run every command with run(), as many at a time as will fit. */
+int jobs_run(char **commands, int num_jobs, int cores_per_job,
+             job_runner_t run, int verbose) {
+    int *cpus, *slot_job, num_cpus, num_slots, running = 0;
+    int next_job = 0, failed = 0, slot, status;
+    pid_t *slot_pid, pid;
+
+    if (cores_per_job < 1) {
+        return -1;
+    }
+
+    /* Only CPUs this process may use can be handed out to jobs. */
+    num_cpus = jobs_cpus(&cpus);
+    if (num_cpus < 0) {
+        return -1;
+    }
+    num_slots = num_cpus / cores_per_job;
+    if (num_slots == 0) {
+        free(cpus);
+        return -1;
+    }
+    if (num_slots > num_jobs) {
+        num_slots = num_jobs;
+    }
+    if (verbose) {
+        printf("Running %d jobs, %d at a time on %d CPUs each.\n",
+               num_jobs, num_slots, cores_per_job);
+    }
+
+    slot_pid = calloc(num_slots, sizeof(pid_t));
+    slot_job = calloc(num_slots, sizeof(int));
+
+    while (next_job < num_jobs || running > 0) {
+        /* Fill every free slot with the next job. */
+        for (slot = 0; slot < num_slots && next_job < num_jobs; slot++) {
+            if (slot_pid[slot] != 0) {
+                continue;
+            }
+            if (verbose) {
+                printf("Starting job %d on CPUs %d-%d: %s\n", next_job,
+                       cpus[slot * cores_per_job],
+                       cpus[slot * cores_per_job + cores_per_job - 1],
+                       commands[next_job]);
+            }
+            pid = start_job(commands[next_job], next_job,
+                            cpus + slot * cores_per_job, cores_per_job, run);
+            if (pid < 0) {
+                perror("Could not fork job");
+                failed++;
+            } else {
+                slot_pid[slot] = pid;
+                slot_job[slot] = next_job;
+                running++;
+            }
+            next_job++;
+        }
+
+        if (running == 0) {
+            continue;
+        }
+
+        /* Wait for any job to finish, freeing its CPUs. */
+        pid = wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (slot = 0; slot < num_slots; slot++) {
+            if (slot_pid[slot] == pid) {
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                    fprintf(stderr, "Job %d ( %s ) failed.\n",
+                            slot_job[slot], commands[slot_job[slot]]);
+                    failed++;
+                } else if (verbose) {
+                    printf("Finished job %d.\n", slot_job[slot]);
+                }
+                slot_pid[slot] = 0;
+                running--;
+            }
+        }
+    }
+
+    free(slot_job);
+    free(slot_pid);
+    free(cpus);
+    return failed;
+}
@@ -0,0 +1,41 @@
+/* Run a campaign of commands concurrently on disjoint sets of CPUs.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+/* Measure one command, writing output files whose names start with prefix.
+ * Returns 0 on success.
+ */
+typedef int (*job_runner_t)(char *command, const char *prefix);
+
+
+/* Read commands from filename, one per line. Blank lines and lines starting
+ * with '#' are ignored.
+ *
+ * Returns the number of commands read into a newly allocated array, or -1 if
+ * the file could not be read.
+ */
+int jobs_read(const char *filename, char ***commands);
+
+
+/* Free an array of commands returned by jobs_read(). */
+void jobs_free(char **commands, int num_jobs);
+
+
+/* List the CPUs this process may run on into a newly allocated array.
+ * Returns how many there are, or -1 if they could not be found.
+ */
+int jobs_cpus(int **cpus);
+
+
+/* Run every command with run(), as many at a time as there are disjoint sets
+ * of cores_per_job CPUs available to this process.
+ *
+ * Each job runs in its own process pinned with sched_setaffinity(), so the
+ * children it launches inherit the same CPUs and each job keeps its own
+ * series of results. Output files for job N are prefixed with "jobN-".
+ *
+ * Returns the number of jobs which failed, or -1 if no job could be placed.
+ */
+int jobs_run(char **commands, int num_jobs, int cores_per_job,
+             job_runner_t run, int verbose);
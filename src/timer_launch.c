@@ -0,0 +1,222 @@
+/* Start child processes with as little harness overhead as possible.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "timer_launch.h"
+
+extern char **environ;
+
+/* Lookup table containing launch methods and readable names. */
+typedef struct launch_lut_t {
+    launch_method_t method;
+    const char *name;
+} launch_lut_t;
+
+static const launch_lut_t launch_methods[] = {
+    { LAUNCH_FORK,  "fork" },
+    { LAUNCH_VFORK, "vfork" },
+    { LAUNCH_SPAWN, "spawn" },
+    { LAUNCH_FORK,  NULL }
+};
+
+
+/* Parse the name of a launch method. Returns 0 on success. */
+int launch_parse_method(const char *name, launch_method_t *method) {
+    const launch_lut_t *p;
+    for (p = launch_methods; p->name != NULL; ++p) {
+        if (strcmp(p->name, name) == 0) {
+            *method = p->method;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/* Readable name of a launch method. */
+const char * launch_method_name(launch_method_t method) {
+    const launch_lut_t *p;
+    for (p = launch_methods; p->name != NULL; ++p) {
+        if (p->method == method) {
+            return p->name;
+        }
+    }
+    return "unknown";
+}
+
+
+/* Is path a regular file we are allowed to execute? */
+static int is_executable(const char *path) {
+    struct stat sb;
+    return (stat(path, &sb) == 0 && S_ISREG(sb.st_mode) &&
+            access(path, X_OK) == 0);
+}
+
+
+/* Resolve a command name against PATH, as execvp() would. */
+char * launch_resolve(const char *file) {
+    const char *path, *start, *end;
+    char *candidate;
+    size_t dir_len, file_len = strlen(file);
+
+    /* Names containing a slash are never looked up in PATH. */
+    if (strchr(file, '/') != NULL) {
+        return is_executable(file) ? strdup(file) : NULL;
+    }
+
+    path = getenv("PATH");
+    if (path == NULL) {
+        path = "/bin:/usr/bin";
+    }
+
+    for (start = path; ; start = end + 1) {
+        end = strchrnul(start, ':');
+        dir_len = end - start;
+        candidate = malloc(dir_len + file_len + 3);
+        if (dir_len == 0) { /* An empty entry means the current directory. */
+            sprintf(candidate, "./%s", file);
+        } else {
+            sprintf(candidate, "%.*s/%s", (int)dir_len, start, file);
+        }
+        if (is_executable(candidate)) {
+            return candidate;
+        }
+        free(candidate);
+        if (*end == '\0') {
+            break;
+        }
+    }
+    return NULL;
+}
+
+
+/* Open a closed gate. Returns 0 on success. */
+int launch_gate_open(launch_gate_t *gate) {
+    return pipe2(gate->fds, O_CLOEXEC);
+}
+
+
+/* Let every child waiting behind a gate exec. Children read until EOF, so
+ * closing the only remaining write end releases them all together.
+ */
+void launch_gate_release(launch_gate_t *gate) {
+    close(gate->fds[1]);
+    close(gate->fds[0]);
+}
+
+
+/* Block in a gated child until the parent releases the gate. */
+static void wait_at_gate(launch_gate_t *gate) {
+    char c;
+    ssize_t n;
+    close(gate->fds[1]);
+    do {
+        n = read(gate->fds[0], &c, 1);
+    } while (n > 0 || (n < 0 && errno == EINTR));
+}
+
+
+/* Wait until a child started by launch_start() has successfully exec'd. The
+ * write end of the pipe is close-on-exec, so a successful exec shows up as
+ * EOF. A failed exec sends errno instead.
+ */
+int launch_await_exec(int exec_fd) {
+    int child_errno = 0;
+    ssize_t n;
+    do {
+        n = read(exec_fd, &child_errno, sizeof(child_errno));
+    } while (n < 0 && errno == EINTR);
+    close(exec_fd);
+    if (n == sizeof(child_errno)) {
+        return child_errno;
+    }
+    return 0;
+}
+
+
+/* Start path with arguments argv in a child process. */
+pid_t launch_start(launch_method_t method, const char *path, char **argv,
+                   int stdout_fd, int stderr_fd,
+                   launch_gate_t *gate, int *exec_fd) {
+    posix_spawn_file_actions_t actions;
+    int fds[2] = { -1, -1 };
+    int err;
+    pid_t pid = -1;
+
+    if (exec_fd != NULL && pipe2(fds, O_CLOEXEC) != 0) {
+        return -1;
+    }
+    if (gate != NULL) {
+        method = LAUNCH_FORK;
+    }
+
+    switch (method) {
+        case LAUNCH_SPAWN:
+            posix_spawn_file_actions_init(&actions);
+            if (stdout_fd != -1) {
+                posix_spawn_file_actions_adddup2(&actions, stdout_fd,
+                                                 STDOUT_FILENO);
+            }
+            if (stderr_fd != -1) {
+                posix_spawn_file_actions_adddup2(&actions, stderr_fd,
+                                                 STDERR_FILENO);
+            }
+            /* posix_spawn() reports exec failures itself. */
+            err = posix_spawn(&pid, path, &actions, NULL, argv, environ);
+            posix_spawn_file_actions_destroy(&actions);
+            if (err != 0) {
+                pid = -1;
+            }
+            break;
+        case LAUNCH_VFORK:
+        case LAUNCH_FORK:
+            pid = (method == LAUNCH_VFORK) ? vfork() : fork();
+            err = errno;
+            if (pid == 0) { /* Child process. */
+                if (gate != NULL) {
+                    wait_at_gate(gate);
+                }
+                if (stdout_fd != -1) {
+                    dup2(stdout_fd, STDOUT_FILENO);
+                }
+                if (stderr_fd != -1) {
+                    dup2(stderr_fd, STDERR_FILENO);
+                }
+                execv(path, argv);
+                err = errno;
+                if (exec_fd != NULL) {
+                    if (write(fds[1], &err, sizeof(err)) < 0) {
+                        /* Nothing more we can do, the exit status will do. */
+                    }
+                }
+                _exit(127);
+            }
+            break;
+    }
+
+    /* Parent process. */
+    if (exec_fd != NULL) {
+        close(fds[1]);
+        if (pid < 0) {
+            close(fds[0]);
+        } else {
+            *exec_fd = fds[0];
+        }
+    }
+    if (pid < 0) {
+        errno = err;
+    }
+    return pid;
+}
@@ -0,0 +1,75 @@
+/* Start child processes with as little harness overhead as possible.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#include <sys/types.h>
+
+/* Ways of starting the command being measured. */
+typedef enum launch_method_t {
+    LAUNCH_FORK,  /* fork() then execv(), copies the parent's page tables. */
+    LAUNCH_VFORK, /* vfork() then execv(), parent is suspended until exec. */
+    LAUNCH_SPAWN  /* posix_spawn(), which uses vfork-like clone() on Linux. */
+} launch_method_t;
+
+
+/* Parse the name of a launch method. Returns 0 on success. */
+int launch_parse_method(const char *name, launch_method_t *method);
+
+
+/* Readable name of a launch method. */
+const char * launch_method_name(launch_method_t method);
+
+
+/* Resolve a command name against PATH, as execvp() would, so that the
+ * search happens once rather than inside every measurement.
+ *
+ * Returns a newly allocated absolute or relative path, or NULL if no
+ * executable file could be found.
+ */
+char * launch_resolve(const char *file);
+
+
+/* A gate that children wait behind before they exec, so that the parent can
+ * prepare (e.g. attach counters) or release several children at once.
+ */
+typedef struct launch_gate_t {
+    int fds[2];
+} launch_gate_t;
+
+
+/* Open a closed gate. Returns 0 on success. */
+int launch_gate_open(launch_gate_t *gate);
+
+
+/* Let every child waiting behind a gate exec. */
+void launch_gate_release(launch_gate_t *gate);
+
+
+/* Start path with arguments argv in a child process.
+ *
+ * If stdout_fd or stderr_fd is not -1, the child's stdout or stderr is
+ * redirected to it.
+ *
+ * If gate is not NULL the child waits for launch_gate_release() before it
+ * execs. Only fork() can leave a child waiting without also stopping the
+ * parent, so gated children are always started with LAUNCH_FORK.
+ *
+ * If exec_fd is not NULL it receives a file descriptor to pass to
+ * launch_await_exec(), which detects the exec via a close-on-exec pipe.
+ *
+ * Returns the pid of the child, or -1 with errno set if the child could not
+ * be created (or, for LAUNCH_SPAWN, could not exec).
+ */
+pid_t launch_start(launch_method_t method, const char *path, char **argv,
+                   int stdout_fd, int stderr_fd,
+                   launch_gate_t *gate, int *exec_fd);
+
+
+/* Wait until a child started by launch_start() has successfully called exec,
+ * so that a clock read immediately afterwards excludes process creation.
+ *
+ * Closes exec_fd. Returns 0 if the exec succeeded, otherwise the errno with
+ * which it failed.
+ */
+int launch_await_exec(int exec_fd);
@@ -0,0 +1,163 @@
+/* Hardware and software performance counters for a child process, using
+ * perf_event_open(2). Linux only.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "timer_perf.h"
+
+/* Lookup table describing each counter and what to use if the preferred
+ * event is not supported. A fallback type of -1 means there is no fallback.
+ */
+typedef struct perf_lut_t {
+    perf_counter_t counter;
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    int32_t fallback_type;
+    uint64_t fallback_config;
+} perf_lut_t;
+
+static const perf_lut_t perf_counters[PERF_NUM_COUNTERS] = {
+    { PERF_CYCLES, "cycles",
+      PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK },
+    { PERF_INSTRUCTIONS, "instructions",
+      PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1, 0 },
+    { PERF_CACHE_MISSES, "cache-misses",
+      PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1, 0 },
+    { PERF_BRANCH_MISSES, "branch-misses",
+      PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1, 0 },
+    { PERF_CONTEXT_SWITCHES, "context-switches",
+      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, -1, 0 },
+    { PERF_CPU_MIGRATIONS, "cpu-migrations",
+      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, -1, 0 },
+    { PERF_TASK_CLOCK, "task-clock",
+      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, -1, 0 }
+};
+
+
+/* Readable name of a counter, e.g. "cycles". */
+const char * perf_counter_name(perf_counter_t counter) {
+    return perf_counters[counter].name;
+}
+
+
+/* glibc provides no wrapper for this system call. */
+static int perf_event_open(struct perf_event_attr *attr, pid_t pid,
+                           int cpu, int group_fd, unsigned long flags) {
+    return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+
+/* Open one counter on pid, optionally as a member of group leader. If the
+ * kernel may not be counted, count user space only from then on.
+ */
+static int open_counter(perf_group_t *group, uint32_t type, uint64_t config,
+                        pid_t pid, int leader) {
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (leader == -1);
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = group->user_only;
+    attr.exclude_hv = 1;
+    /* PERF_FORMAT_GROUP cannot be combined with inherit, so each counter is
+     * read on its own, with the times needed to scale multiplexed counts.
+     */
+    attr.read_format = (PERF_FORMAT_TOTAL_TIME_ENABLED |
+                        PERF_FORMAT_TOTAL_TIME_RUNNING);
+    fd = perf_event_open(&attr, pid, -1, leader, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0 && !group->user_only && (errno == EACCES || errno == EPERM)) {
+        group->user_only = 1;
+        attr.exclude_kernel = 1;
+        fd = perf_event_open(&attr, pid, -1, leader, PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+}
+
+
+/* Attach counters to pid, which must not yet have called exec. */
+int perf_open(perf_group_t *group, pid_t pid) {
+    const perf_lut_t *p;
+    int leader = -1, opened = 0, i;
+
+    group->user_only = 0;
+    for (i = 0; i < PERF_NUM_COUNTERS; i++) {
+        p = &perf_counters[i];
+        group->fallback[i] = 0;
+
+        /* Hardware counters are scheduled onto the PMU together, so that
+         * ratios such as instructions per cycle come from the same interval.
+         */
+        if (p->type == PERF_TYPE_HARDWARE) {
+            group->fd[i] = open_counter(group, p->type, p->config, pid, leader);
+            if (group->fd[i] >= 0 && leader == -1) {
+                leader = group->fd[i];
+            }
+        } else {
+            group->fd[i] = open_counter(group, p->type, p->config, pid, -1);
+        }
+
+        if (group->fd[i] < 0 && p->fallback_type >= 0) {
+            group->fd[i] = open_counter(group, p->fallback_type,
+                                        p->fallback_config, pid, -1);
+            group->fallback[i] = (group->fd[i] >= 0);
+        }
+        if (group->fd[i] >= 0) {
+            opened++;
+        }
+    }
+    return opened;
+}
+
+
+/* Read every counter into values, scaling for time lost to multiplexing. */
+void perf_read(perf_group_t *group, long long *values) {
+    /* value, time enabled, time running. */
+    uint64_t buffer[3];
+    int i;
+
+    for (i = 0; i < PERF_NUM_COUNTERS; i++) {
+        values[i] = PERF_UNAVAILABLE;
+        if (group->fd[i] < 0 ||
+            read(group->fd[i], buffer, sizeof(buffer)) != sizeof(buffer)) {
+            continue;
+        }
+        if (buffer[2] == 0) { /* Never scheduled onto the PMU. */
+            values[i] = (buffer[1] == 0) ? 0 : PERF_UNAVAILABLE;
+        } else if (buffer[2] < buffer[1]) {
+            values[i] = (long long)((long double)buffer[0] *
+                                    buffer[1] / buffer[2]);
+        } else {
+            values[i] = (long long)buffer[0];
+        }
+    }
+}
+
+
+/* Close all counters in a group. */
+void perf_close(perf_group_t *group) {
+    int i;
+    for (i = 0; i < PERF_NUM_COUNTERS; i++) {
+        if (group->fd[i] >= 0) {
+            close(group->fd[i]);
+            group->fd[i] = -1;
+        }
+    }
+}
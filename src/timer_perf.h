@@ -0,0 +1,69 @@
+/* Hardware and software performance counters for a child process, using
+ * perf_event_open(2). Linux only.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#ifndef TIMER_PERF_H
+#define TIMER_PERF_H
+
+#include <sys/types.h>
+
+/* Counters attached to every measured child. */
+typedef enum perf_counter_t {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_CONTEXT_SWITCHES,
+    PERF_CPU_MIGRATIONS,
+    PERF_TASK_CLOCK,
+    PERF_NUM_COUNTERS
+} perf_counter_t;
+
+/* Bit set in a mask of fallback counters, after the bit of every counter,
+ * when counters only counted user space because perf_event_paranoid
+ * forbade counting the kernel.
+ */
+#define PERF_USER_ONLY PERF_NUM_COUNTERS
+
+/* Value recorded for a counter which could not be opened. */
+#define PERF_UNAVAILABLE (-1LL)
+
+/* Open counters for one child process. */
+typedef struct perf_group_t {
+    int fd[PERF_NUM_COUNTERS];
+    /* Non-zero if a hardware counter was replaced by a software one. */
+    int fallback[PERF_NUM_COUNTERS];
+    /* Non-zero if counters exclude the kernel, as they may not count it. */
+    int user_only;
+} perf_group_t;
+
+
+/* Readable name of a counter, e.g. "cycles". */
+const char * perf_counter_name(perf_counter_t counter);
+
+
+/* Attach counters to pid, which must not yet have called exec. Counters are
+ * inherited by every thread and process the child creates, and only start
+ * counting once the child execs.
+ *
+ * Hardware counters which are not available (as in many VMs) fall back to a
+ * software equivalent where one exists, otherwise they are left unopened.
+ * If the kernel may not be counted, as at the default perf_event_paranoid
+ * for unprivileged users, counters count user space only.
+ * Returns the number of counters opened.
+ */
+int perf_open(perf_group_t *group, pid_t pid);
+
+
+/* Read every counter into values, scaling for time lost to multiplexing.
+ * Counters which are not open read as PERF_UNAVAILABLE.
+ */
+void perf_read(perf_group_t *group, long long *values);
+
+
+/* Close all counters in a group. */
+void perf_close(perf_group_t *group);
+
+#endif /* TIMER_PERF_H */
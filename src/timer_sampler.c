@@ -0,0 +1,253 @@
+/* Sample the resource use of a child process over time, from a thread which
+ * polls /proc while the child runs. Linux only.
+ *
+ * Each sample reads /proc/<pid>/stat and /proc/<pid>/status for the whole
+ * process, then /proc/<pid>/task/<tid>/status and schedstat for every
+ * thread, since the kernel only reports context switches and run-queue
+ * delay per thread. A child with many threads therefore takes longer to
+ * sample, and the interval stretches rather than samples piling up.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "timer_sampler.h"
+
+/* Largest /proc file read, which is plenty for status and stat. */
+#define PROC_BUFFER 4096
+
+/* Sample the child at least this many times before growing the buffer. */
+#define INITIAL_SAMPLES 1024
+
+
+/* Read a small file into buf as a string. Returns the length read, or -1. */
+static int read_file(const char *path, char *buf, int size) {
+    int fd, len;
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    len = (int)read(fd, buf, size - 1);
+    close(fd);
+    if (len < 0) {
+        return -1;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+
+/* Value of a "Name:  value" line of a status file, or -1 if it is absent.
+ * The tag includes the leading newline, so that e.g. voluntary_ctxt_switches
+ * does not match nonvoluntary_ctxt_switches.
+ */
+static long long status_field(const char *buf, const char *tag) {
+    const char *p = strstr(buf, tag);
+    if (p == NULL) {
+        return -1;
+    }
+    return strtoll(p + strlen(tag), NULL, 10);
+}
+
+
+/* Add the switches and run-queue delay of every thread of the child to a
+ * sample. Threads which exit while being read are skipped.
+ */
+static void sample_tasks(pid_t pid, sample_t *sample) {
+    char path[64], buf[PROC_BUFFER];
+    unsigned long long cpu, delay;
+    long long vol, invol;
+    struct dirent *entry;
+    DIR *dir;
+    int tid;
+
+    snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+    dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        tid = atoi(entry->d_name);
+        if (tid <= 0) {
+            continue; /* . and .. */
+        }
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/schedstat",
+                 (int)pid, tid);
+        if (read_file(path, buf, sizeof(buf)) > 0 &&
+            sscanf(buf, "%llu %llu", &cpu, &delay) == 2) {
+            sample->run_delay_ns += (long long)delay;
+        }
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/status",
+                 (int)pid, tid);
+        if (read_file(path, buf, sizeof(buf)) > 0) {
+            vol = status_field(buf, "\nvoluntary_ctxt_switches:");
+            invol = status_field(buf, "\nnonvoluntary_ctxt_switches:");
+            if (vol >= 0 && invol >= 0) {
+                sample->vol_switches += vol;
+                sample->invol_switches += invol;
+            }
+        }
+    }
+    closedir(dir);
+}
+
+
+/* Take one sample of the child. Returns 0 on success, or -1 once the child
+ * has exited, when its memory and threads are no longer reported.
+ */
+static int sample_child(pid_t pid, sample_t *sample) {
+    char path[64], buf[PROC_BUFFER], *p;
+    unsigned long long minflt, utime, stime;
+    static long ticks_per_second;
+
+    if (ticks_per_second == 0) {
+        ticks_per_second = sysconf(_SC_CLK_TCK);
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    if (read_file(path, buf, sizeof(buf)) < 0) {
+        return -1;
+    }
+    sample->rss_kb = (long)status_field(buf, "\nVmRSS:");
+    sample->threads = (int)status_field(buf, "\nThreads:");
+    if (sample->rss_kb < 0) {
+        return -1; /* A zombie. */
+    }
+
+    /* The command name may contain spaces, so skip past its parenthesis. */
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    if (read_file(path, buf, sizeof(buf)) < 0 ||
+        (p = strrchr(buf, ')')) == NULL ||
+        sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %llu %*u %*u %*u %llu %llu",
+               &minflt, &utime, &stime) != 3) {
+        return -1;
+    }
+    sample->soft_faults = (long long)minflt;
+    sample->cpu_ns =
+        (long long)(utime + stime) * (1000000000LL / ticks_per_second);
+
+    sample->vol_switches = sample->invol_switches = sample->run_delay_ns = 0;
+    sample_tasks(pid, sample);
+    return 0;
+}
+
+
+/* Body of the sampler thread. Samples are taken on a fixed schedule, and
+ * any which fall due while the previous one is still being taken are
+ * dropped rather than taken late in a burst.
+ */
+static void * sampler_main(void *arg) {
+    sampler_t *sampler = (sampler_t*)arg;
+    struct timespec next, now;
+    sample_t sample, *grown;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!sampler->stop) {
+        clock_gettime(sampler->clock, &now);
+        if (sample_child(sampler->pid, &sample) != 0) {
+            break;
+        }
+        sample.time_ns = (now.tv_sec - sampler->origin.tv_sec) * 1000000000LL +
+                         (now.tv_nsec - sampler->origin.tv_nsec);
+        if (sampler->count == sampler->capacity) {
+            grown = realloc(sampler->samples,
+                            sizeof(sample_t) * sampler->capacity * 2);
+            if (grown == NULL) {
+                break;
+            }
+            sampler->samples = grown;
+            sampler->capacity *= 2;
+        }
+        sampler->samples[sampler->count++] = sample;
+
+        next.tv_nsec += sampler->interval_us * 1000;
+        next.tv_sec += next.tv_nsec / 1000000000;
+        next.tv_nsec %= 1000000000;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > next.tv_sec ||
+            (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec)) {
+            next = now;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    return NULL;
+}
+
+
+/* Start sampling pid every interval_us microseconds. */
+int sampler_start(sampler_t *sampler, pid_t pid, long interval_us,
+                  clockid_t clock, const struct timespec *origin) {
+    if (sampler->samples == NULL) {
+        sampler->samples = malloc(sizeof(sample_t) * INITIAL_SAMPLES);
+        if (sampler->samples == NULL) {
+            return -1;
+        }
+        sampler->capacity = INITIAL_SAMPLES;
+    }
+    sampler->pid = pid;
+    sampler->interval_us =
+        interval_us < SAMPLER_MIN_INTERVAL ? SAMPLER_MIN_INTERVAL : interval_us;
+    sampler->clock = clock;
+    sampler->origin = *origin;
+    sampler->count = 0;
+    sampler->stop = 0;
+    sampler->running =
+        (pthread_create(&sampler->thread, NULL, sampler_main, sampler) == 0);
+    return sampler->running ? 0 : -1;
+}
+
+
+/* Stop sampling and wait for the sampler thread. */
+void sampler_stop(sampler_t *sampler) {
+    if (sampler->running) {
+        sampler->stop = 1;
+        pthread_join(sampler->thread, NULL);
+        sampler->running = 0;
+    }
+}
+
+
+/* Free the samples held by a sampler. */
+void sampler_free(sampler_t *sampler) {
+    sampler_stop(sampler);
+    free(sampler->samples);
+    sampler->samples = NULL;
+    sampler->count = sampler->capacity = 0;
+}
+
+
+/* Write the column names of a time series to a CSV file. */
+void sampler_write_csv_header(FILE *fp) {
+    fprintf(fp, "%s,%s,%s,%s,%s,%s,%s,%s,%s\n",
+            "Experiment",
+            "Time (ns)",
+            "Resident set size (KB)",
+            "Threads",
+            "Voluntary context switches",
+            "Involuntary context switches",
+            "Run-queue delay (ns)",
+            "CPU time (ns)",
+            "Page reclaims (soft page faults)");
+}
+
+
+/* Write the samples of one experiment to a CSV file. */
+void sampler_write_csv_rows(FILE *fp, const sampler_t *sampler,
+                            int experiment) {
+    const sample_t *s;
+    int i;
+    for (i = 0; i < sampler->count; i++) {
+        s = &sampler->samples[i];
+        fprintf(fp, "%d,%lld,%ld,%d,%lld,%lld,%lld,%lld,%lld\n",
+                experiment, s->time_ns, s->rss_kb, s->threads,
+                s->vol_switches, s->invol_switches, s->run_delay_ns,
+                s->cpu_ns, s->soft_faults);
+    }
+}
@@ -0,0 +1,72 @@
+/* Sample the resource use of a child process over time, from a thread which
+ * polls /proc while the child runs. Linux only.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#ifndef TIMER_SAMPLER_H
+#define TIMER_SAMPLER_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* Shortest interval between samples, in microseconds. */
+#define SAMPLER_MIN_INTERVAL 1000
+
+/* One reading of the child. Switches and run-queue delay are summed over
+ * every thread the child has at the time.
+ */
+typedef struct sample_t {
+    long long time_ns;       /* Since the clock was started. */
+    long rss_kb;
+    int threads;
+    long long vol_switches;
+    long long invol_switches;
+    long long run_delay_ns;  /* Time spent runnable but waiting for a CPU. */
+    long long cpu_ns;        /* User plus system time. */
+    long long soft_faults;
+} sample_t;
+
+/* A sampler thread and the time series it has recorded. */
+typedef struct sampler_t {
+    pid_t pid;
+    long interval_us;
+    clockid_t clock;
+    struct timespec origin;
+    pthread_t thread;
+    int running;
+    volatile int stop;
+    sample_t *samples;
+    int count, capacity;
+} sampler_t;
+
+
+/* Start sampling pid every interval_us microseconds, with times measured
+ * from origin on the given clock. Any earlier samples are discarded.
+ * Returns 0 on success.
+ */
+int sampler_start(sampler_t *sampler, pid_t pid, long interval_us,
+                  clockid_t clock, const struct timespec *origin);
+
+
+/* Stop sampling and wait for the sampler thread to finish. The samples are
+ * kept until the next sampler_start().
+ */
+void sampler_stop(sampler_t *sampler);
+
+
+/* Free the samples held by a sampler. */
+void sampler_free(sampler_t *sampler);
+
+
+/* Write the column names of a time series to a CSV file. */
+void sampler_write_csv_header(FILE *fp);
+
+
+/* Write the samples of one experiment to a CSV file. */
+void sampler_write_csv_rows(FILE *fp, const sampler_t *sampler,
+                            int experiment);
+
+#endif /* TIMER_SAMPLER_H */
@@ -0,0 +1,332 @@
+/* An append-only store of benchmark results, laid out so that it can be
+ * memory mapped and read without parsing.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timer_data.h"
+#include "timer_store.h"
+
+/* Longest host name stored. */
+#define MAX_HOST 256
+
+/* Round a size up to the next multiple of 8 bytes. */
+#define PAD8(n) (((n) + 7) & ~(size_t)7)
+
+
+/* Bytes taken by the strings of a run, including padding. */
+static size_t strings_size(const store_run_t *run) {
+    return PAD8((size_t)run->command_length + run->parameters_length +
+                run->host_length);
+}
+
+
+/* The keys of every metric of a run, STORE_KEY_LENGTH bytes apart. */
+static const char * run_keys(const store_run_t *run) {
+    return (const char*)run + sizeof(store_run_t) + strings_size(run);
+}
+
+
+/* Append a run of results to a store. The run is built in memory and
+ * written with one call under an exclusive lock, so concurrent jobs
+ * appending to the same store never interleave.
+ */
+int store_append(const char *filename, const store_info_t *info,
+                 results_t *results) {
+    char host[MAX_HOST] = "", *buf, *p;
+    const char *parameters = info->parameters ? info->parameters : "";
+    store_run_t run;
+    size_t keys_size, written;
+    ssize_t n;
+    double *column;
+    int fd, i, j;
+
+    gethostname(host, sizeof(host) - 1);
+
+    memset(&run, 0, sizeof(run));
+    memcpy(run.magic, STORE_MAGIC, sizeof(run.magic));
+    run.version = STORE_VERSION;
+    run.timestamp = (int64_t)time(NULL);
+    run.experiments = (uint32_t)results->count;
+    run.metrics = METRIC_NUM;
+    run.warmup = (uint32_t)info->warmup;
+    run.perf_fallback = (uint32_t)results->perf_fallback;
+    run.hops = info->hops;
+    run.command_length = (uint32_t)strlen(info->command) + 1;
+    run.parameters_length = (uint32_t)strlen(parameters) + 1;
+    run.host_length = (uint32_t)strlen(host) + 1;
+    keys_size = (size_t)METRIC_NUM * STORE_KEY_LENGTH;
+    run.header_size =
+        (uint32_t)(sizeof(run) + strings_size(&run) + keys_size);
+    run.run_size = run.header_size +
+        (uint64_t)METRIC_NUM * results->count * sizeof(double);
+
+    buf = calloc(1, run.run_size);
+    if (buf == NULL) {
+        return EXIT_FAILURE;
+    }
+    memcpy(buf, &run, sizeof(run));
+    p = buf + sizeof(run);
+    memcpy(p, info->command, run.command_length);
+    p += run.command_length;
+    memcpy(p, parameters, run.parameters_length);
+    p += run.parameters_length;
+    memcpy(p, host, run.host_length);
+    p = buf + sizeof(run) + strings_size(&run);
+    for (i = 0; i < METRIC_NUM; i++) {
+        strncpy(p + i * STORE_KEY_LENGTH, metric_key(i),
+                STORE_KEY_LENGTH - 1);
+    }
+    column = (double*)(buf + run.header_size);
+    for (i = 0; i < METRIC_NUM; i++) {
+        for (j = 0; j < results->count; j++) {
+            column[j] = (double)results_column(results, i)[j];
+        }
+        column += results->count;
+    }
+
+    fd = open(filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        free(buf);
+        return EXIT_FAILURE;
+    }
+    flock(fd, LOCK_EX);
+    for (written = 0; written < run.run_size; written += (size_t)n) {
+        n = write(fd, buf + written, run.run_size - written);
+        if (n <= 0) {
+            break;
+        }
+    }
+    close(fd); /* Releases the lock. */
+    free(buf);
+    return written == run.run_size ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* Map a store into memory. An empty store maps to no runs. */
+int store_open(store_t *store, const char *filename) {
+    struct stat st;
+    void *base;
+    int fd;
+
+    store->base = NULL;
+    store->size = 0;
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    if (st.st_size > 0) {
+        base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        store->base = base;
+        store->size = (size_t)st.st_size;
+    }
+    close(fd);
+    return EXIT_SUCCESS;
+}
+
+
+/* Unmap a store. */
+void store_close(store_t *store) {
+    if (store->base != NULL) {
+        munmap((void*)store->base, store->size);
+    }
+    store->base = NULL;
+    store->size = 0;
+}
+
+
+/* The run after run, or the first run. A run is only returned if all of it
+ * lies within the store and its strings are terminated, so a run still being
+ * appended, or cut short by a crash, ends the store.
+ */
+const store_run_t * store_next(const store_t *store, const store_run_t *run) {
+    const store_run_t *next;
+    const char *strings;
+    size_t offset;
+
+    if (store->base == NULL) {
+        return NULL;
+    }
+    offset = run == NULL ? 0 :
+        (size_t)((const char*)run - store->base) + run->run_size;
+    if (offset + sizeof(store_run_t) > store->size) {
+        return NULL;
+    }
+    next = (const store_run_t*)(store->base + offset);
+    if (memcmp(next->magic, STORE_MAGIC, sizeof(next->magic)) != 0 ||
+        next->version != STORE_VERSION ||
+        next->run_size > store->size - offset ||
+        next->header_size > next->run_size ||
+        next->header_size < sizeof(store_run_t) + strings_size(next) +
+                            (size_t)next->metrics * STORE_KEY_LENGTH ||
+        next->run_size - next->header_size <
+            (uint64_t)next->metrics * next->experiments * sizeof(double) ||
+        next->command_length == 0 || next->parameters_length == 0 ||
+        next->host_length == 0) {
+        return NULL;
+    }
+    strings = (const char*)next + sizeof(store_run_t);
+    if (strings[next->command_length - 1] != '\0' ||
+        strings[next->command_length + next->parameters_length - 1] != '\0' ||
+        strings[next->command_length + next->parameters_length +
+                next->host_length - 1] != '\0') {
+        return NULL;
+    }
+    return next;
+}
+
+
+/* The command which was timed. */
+const char * store_command(const store_run_t *run) {
+    return (const char*)run + sizeof(store_run_t);
+}
+
+
+/* The swept parameters, or an empty string. */
+const char * store_parameters(const store_run_t *run) {
+    return store_command(run) + run->command_length;
+}
+
+
+/* The name of the machine which ran the experiments. */
+const char * store_host(const store_run_t *run) {
+    return store_parameters(run) + run->parameters_length;
+}
+
+
+/* The value of one swept parameter of a run. */
+char * store_parameter(const store_run_t *run, const char *name) {
+    const char *p = store_parameters(run), *end;
+    size_t len = strlen(name);
+
+    while (*p != '\0') {
+        end = strchr(p, ',');
+        if (end == NULL) {
+            end = p + strlen(p);
+        }
+        if (strncmp(p, name, len) == 0 && p[len] == '=') {
+            return strndup(p + len + 1, (size_t)(end - p - len - 1));
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return NULL;
+}
+
+
+/* The column of a run for one metric. */
+const double * store_column(const store_run_t *run, const char *key) {
+    const char *keys = run_keys(run);
+    uint32_t i;
+    for (i = 0; i < run->metrics; i++) {
+        if (strncmp(keys + (size_t)i * STORE_KEY_LENGTH, key,
+                    STORE_KEY_LENGTH) == 0) {
+            return (const double*)((const char*)run + run->header_size) +
+                   (size_t)i * run->experiments;
+        }
+    }
+    return NULL;
+}
+
+
+/* Append the experiments of a run to a buffer of results. Columns are found
+ * by key, so stores written before a metric was added still load.
+ */
+int store_copy_results(const store_run_t *run, results_t *results) {
+    const double *column;
+    long double *into;
+    uint32_t j;
+    int i;
+
+    if (results->count + (long long)run->experiments > results->capacity) {
+        return 1;
+    }
+    for (i = 0; i < METRIC_NUM; i++) {
+        column = store_column(run, metric_key(i));
+        into = results_column(results, i) + results->count;
+        for (j = 0; j < run->experiments; j++) {
+            into[j] = column != NULL ? column[j] : NAN;
+        }
+    }
+    results->count += (int)run->experiments;
+    results->perf_fallback |= (int)run->perf_fallback;
+    return 0;
+}
+
+
+/* Add a run to the group with the same command and parameters, creating
+ * the group if there is none. Returns the group.
+ */
+store_group_t * store_group_add(store_group_t **groups, int *num_groups,
+                                const store_run_t *run) {
+    store_group_t *group = NULL;
+    int i;
+
+    for (i = 0; i < *num_groups; i++) {
+        if (strcmp(store_command((*groups)[i].runs[0]),
+                   store_command(run)) == 0 &&
+            strcmp(store_parameters((*groups)[i].runs[0]),
+                   store_parameters(run)) == 0) {
+            group = &(*groups)[i];
+            break;
+        }
+    }
+    if (group == NULL) {
+        *groups = realloc(*groups, sizeof(store_group_t) * (*num_groups + 1));
+        group = &(*groups)[(*num_groups)++];
+        memset(group, 0, sizeof(store_group_t));
+    }
+    if (group->num_runs == group->capacity) {
+        group->capacity = group->capacity == 0 ? 4 : group->capacity * 2;
+        group->runs = realloc(group->runs,
+                              sizeof(store_run_t*) * group->capacity);
+    }
+    group->runs[group->num_runs++] = run;
+    group->experiments += run->experiments;
+    return group;
+}
+
+
+/* Every experiment of every run in a group. */
+results_t * store_group_results(const store_group_t *group) {
+    results_t *results;
+    int i;
+
+    if (group->experiments > 0x7fffffff) {
+        return NULL;
+    }
+    results = results_new((int)group->experiments);
+    for (i = 0; i < group->num_runs; i++) {
+        store_copy_results(group->runs[i], results);
+    }
+    return results;
+}
+
+
+/* Free an array of groups. */
+void store_groups_free(store_group_t *groups, int num_groups) {
+    int i;
+    for (i = 0; i < num_groups; i++) {
+        free(groups[i].runs);
+    }
+    free(groups);
+}
@@ -0,0 +1,136 @@
+/* An append-only store of benchmark results, laid out so that it can be
+ * memory mapped and read without parsing.
+ *
+ * A store is a sequence of runs, one per campaign of experiments. Each run
+ * is a store_run_t, then the command, parameters and host as strings, then
+ * the key of every metric, then one column of doubles per metric with a
+ * value for each experiment. Every part starts on an 8 byte boundary. Runs
+ * are only ever appended, each with a single write, so several timers may
+ * share one store.
+ *
+ * All fields are in the byte order of the machine which wrote the store.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#ifndef TIMER_STORE_H
+#define TIMER_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STORE_MAGIC "TIMERST1"
+#define STORE_VERSION 1
+
+/* Length of a metric key, including the terminating NUL. */
+#define STORE_KEY_LENGTH 32
+
+/* Header of one run. */
+typedef struct store_run_t {
+    char magic[8];
+    uint32_t version;
+    /* Bytes from the start of the run to its first column. */
+    uint32_t header_size;
+    /* Bytes from the start of the run to the start of the next. */
+    uint64_t run_size;
+    /* When the run was stored, in seconds since the epoch. */
+    int64_t timestamp;
+    uint32_t experiments, metrics;
+    uint32_t warmup;
+    /* Bit i is set if counter i was replaced by a software event. */
+    uint32_t perf_fallback;
+    /* Token hops per experiment, or zero if unknown. */
+    double hops;
+    /* String lengths, each including its NUL. */
+    uint32_t command_length, parameters_length, host_length;
+    uint32_t reserved;
+} store_run_t;
+
+/* Description of a run, besides its results. */
+typedef struct store_info_t {
+    const char *command;
+    /* Swept parameters as NAME=VALUE pairs separated by commas. */
+    const char *parameters;
+    int warmup;
+    double hops;
+} store_info_t;
+
+/* A store mapped into memory for reading. */
+typedef struct store_t {
+    const char *base;
+    size_t size;
+} store_t;
+
+/* Runs of one command with one set of parameters, e.g. one point of a
+ * parameter sweep, in the order they were appended.
+ */
+typedef struct store_group_t {
+    const store_run_t **runs;
+    int num_runs, capacity;
+    long long experiments;
+} store_group_t;
+
+
+/* Append a run of results to the store in filename, creating it if need
+ * be. The host and timestamp are filled in here. Returns 0 on success.
+ */
+int store_append(const char *filename, const store_info_t *info,
+                 struct results_t *results);
+
+
+/* Map a store into memory. Returns 0 on success. */
+int store_open(store_t *store, const char *filename);
+
+
+/* Unmap a store. */
+void store_close(store_t *store);
+
+
+/* The run after run, or the first run if run is NULL. Returns NULL at the
+ * end of the store, or at the first run which is truncated or corrupt.
+ */
+const store_run_t * store_next(const store_t *store, const store_run_t *run);
+
+
+/* The strings describing a run. */
+const char * store_command(const store_run_t *run);
+const char * store_parameters(const store_run_t *run);
+const char * store_host(const store_run_t *run);
+
+
+/* The value of a swept parameter of a run, as a newly allocated string, or
+ * NULL if the parameter was not swept.
+ */
+char * store_parameter(const store_run_t *run, const char *name);
+
+
+/* The column of a run for the metric with the given key, or NULL if the run
+ * did not record that metric.
+ */
+const double * store_column(const store_run_t *run, const char *key);
+
+
+/* Append the experiments of a run to a buffer of results. Metrics which the
+ * run did not record are NAN. Returns 0 on success, or 1 if the buffer is
+ * too small.
+ */
+int store_copy_results(const store_run_t *run, struct results_t *results);
+
+
+/* Add a run to the group of runs with the same command and parameters,
+ * creating the group if there is none. Returns the group.
+ */
+store_group_t * store_group_add(store_group_t **groups, int *num_groups,
+                                const store_run_t *run);
+
+
+/* Every experiment of every run in a group, as a newly allocated buffer of
+ * results, or NULL if the group has too many experiments.
+ */
+struct results_t * store_group_results(const store_group_t *group);
+
+
+/* Free an array of groups, but not the runs they point into. */
+void store_groups_free(store_group_t *groups, int num_groups);
+
+#endif /* TIMER_STORE_H */
@@ -0,0 +1,180 @@
+/* Expand parameter sweeps, such as cycles and tokens, into command lines.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timer_sweep.h"
+
+/* Most values on a single axis, to catch mistyped ranges. */
+#define MAX_SWEEP_VALUES 4096
+
+/* Longest printed value, e.g. of a long long. */
+#define MAX_VALUE_LEN 32
+
+
+/* Append a copy of value to an axis. Returns 0 on success. */
+static int axis_append(sweep_axis_t *axis, const char *value, size_t len) {
+    if (len == 0 || axis->num_values == MAX_SWEEP_VALUES) {
+        return 1;
+    }
+    axis->values = realloc(axis->values,
+                           sizeof(char*) * (axis->num_values + 1));
+    axis->values[axis->num_values] = strndup(value, len);
+    axis->num_values++;
+    return 0;
+}
+
+
+/* Expand start:stop[:xF|:+S] into values. Returns 0 on success. */
+static int axis_range(sweep_axis_t *axis, const char *range) {
+    char value[MAX_VALUE_LEN], op = '+';
+    long long start, stop, step = 1, v;
+    int fields;
+
+    fields = sscanf(range, "%lld:%lld:%c%lld", &start, &stop, &op, &step);
+    if (fields == 3 && op >= '0' && op <= '9') { /* start:stop:S */
+        fields = sscanf(range, "%lld:%lld:%lld", &start, &stop, &step);
+        op = '+';
+        fields = (fields == 3) ? 4 : fields;
+    }
+    if ((fields != 2 && fields != 4) || start > stop) {
+        return 1;
+    }
+    if ((op == 'x' && (step < 2 || start < 1)) ||
+        (op == '+' && step < 1) || (op != 'x' && op != '+')) {
+        return 1;
+    }
+
+    for (v = start; v <= stop; v = (op == 'x') ? v * step : v + step) {
+        snprintf(value, sizeof(value), "%lld", v);
+        if (axis_append(axis, value, strlen(value)) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/* Add an axis described by spec. Returns 0 on success. */
+int sweep_add_axis(sweep_t *sweep, const char *spec) {
+    const char *values = strchr(spec, '='), *start, *end;
+    sweep_axis_t *axis;
+    int err = 0;
+
+    if (values == NULL || values == spec ||
+        sweep->num_axes == MAX_SWEEP_AXES) {
+        return 1;
+    }
+    axis = &sweep->axes[sweep->num_axes];
+    axis->name = strndup(spec, values - spec);
+    axis->num_values = 0;
+    axis->values = NULL;
+    values++;
+
+    if (strchr(values, ':') != NULL) {
+        err = axis_range(axis, values);
+    } else {
+        for (start = values; !err; start = end + 1) {
+            end = strchr(start, ',');
+            if (end == NULL) {
+                end = start + strlen(start);
+            }
+            err = axis_append(axis, start, end - start);
+            if (*end == '\0') {
+                break;
+            }
+        }
+    }
+
+    sweep->num_axes++;
+    return err;
+}
+
+
+/* Number of points in the sweep, i.e. the product of the axis lengths. */
+int sweep_num_points(sweep_t *sweep) {
+    int i, points = 1;
+    for (i = 0; i < sweep->num_axes; i++) {
+        points *= sweep->axes[i].num_values;
+    }
+    return points;
+}
+
+
+/* Value of an axis at a point of the sweep. The last axis varies fastest. */
+const char * sweep_value(sweep_t *sweep, int axis, int point) {
+    int i;
+    for (i = sweep->num_axes - 1; i > axis; i--) {
+        point /= sweep->axes[i].num_values;
+    }
+    return sweep->axes[axis].values[point % sweep->axes[axis].num_values];
+}
+
+
+/* Substitute the values at a point of the sweep for every {NAME}. */
+char * sweep_command(sweep_t *sweep, const char *template, int point) {
+    const char *p, *close;
+    char *command;
+    size_t len, used = 0, name_len, longest = 0;
+    int i, j, found, seen = 0;
+
+    /* Every {NAME} is at least three characters long, which bounds how many
+     * values can be substituted.
+     */
+    for (i = 0; i < sweep->num_axes; i++) {
+        for (j = 0; j < sweep->axes[i].num_values; j++) {
+            if (strlen(sweep->axes[i].values[j]) > longest) {
+                longest = strlen(sweep->axes[i].values[j]);
+            }
+        }
+    }
+    len = strlen(template) + 1 + (strlen(template) / 3 + 1) * longest;
+    command = malloc(len);
+
+    for (p = template; *p != '\0'; ) {
+        found = 0;
+        close = (*p == '{') ? strchr(p, '}') : NULL;
+        if (close != NULL) {
+            name_len = close - p - 1;
+            for (i = 0; i < sweep->num_axes; i++) {
+                if (strlen(sweep->axes[i].name) == name_len &&
+                    strncmp(sweep->axes[i].name, p + 1, name_len) == 0) {
+                    used += snprintf(command + used, len - used, "%s",
+                                     sweep_value(sweep, i, point));
+                    seen |= 1 << i;
+                    found = 1;
+                    p = close + 1;
+                    break;
+                }
+            }
+        }
+        if (!found) {
+            command[used++] = *p++;
+        }
+    }
+    command[used] = '\0';
+
+    if (seen != (1 << sweep->num_axes) - 1) {
+        free(command);
+        return NULL;
+    }
+    return command;
+}
+
+
+/* Free the axes of a sweep. */
+void sweep_free(sweep_t *sweep) {
+    int i, j;
+    for (i = 0; i < sweep->num_axes; i++) {
+        for (j = 0; j < sweep->axes[i].num_values; j++) {
+            free(sweep->axes[i].values[j]);
+        }
+        free(sweep->axes[i].values);
+        free(sweep->axes[i].name);
+    }
+    sweep->num_axes = 0;
+}
@@ -0,0 +1,51 @@
+/* Expand parameter sweeps, such as cycles and tokens, into command lines.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+/* Most axes in a single sweep. */
+#define MAX_SWEEP_AXES 8
+
+/* One parameter and the values it takes. */
+typedef struct sweep_axis_t {
+    char *name;
+    int num_values;
+    char **values;
+} sweep_axis_t;
+
+/* The cartesian product of several axes. */
+typedef struct sweep_t {
+    int num_axes;
+    sweep_axis_t axes[MAX_SWEEP_AXES];
+} sweep_t;
+
+
+/* Add an axis described by spec, which is NAME=VALUES where VALUES is one of:
+ *
+ *   a,b,c             a list of values
+ *   start:stop:xF     start, start * F, ... up to and including stop
+ *   start:stop:+S     start, start + S, ... up to and including stop
+ *   start:stop        as start:stop:+1
+ *
+ * Returns 0 on success.
+ */
+int sweep_add_axis(sweep_t *sweep, const char *spec);
+
+
+/* Number of points in the sweep, i.e. the product of the axis lengths. */
+int sweep_num_points(sweep_t *sweep);
+
+
+/* Value of an axis at a point of the sweep. The last axis varies fastest. */
+const char * sweep_value(sweep_t *sweep, int axis, int point);
+
+
+/* Substitute the values at a point of the sweep for every {NAME} in
+ * template. Returns a newly allocated command line, or NULL if some axis
+ * does not appear in template.
+ */
+char * sweep_command(sweep_t *sweep, const char *template, int point);
+
+
+/* Free the axes of a sweep. */
+void sweep_free(sweep_t *sweep);
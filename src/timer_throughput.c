@@ -0,0 +1,144 @@
+/* Run several identical copies of a command at once, to measure how they
+ * share the machine rather than how fast one of them runs alone.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "timer_data.h"
+#include "timer_launch.h"
+#include "timer_throughput.h"
+
+
+/* Nanoseconds from start to end. */
+static long long elapsed_ns(const struct timespec *start,
+                            const struct timespec *end) {
+    return (long long)(end->tv_sec - start->tv_sec) * 1000000000LL +
+           (end->tv_nsec - start->tv_nsec);
+}
+
+
+/* Copy the resource use of one copy into its result. */
+static void copy_result(result_t *result, long long wall_ns,
+                        const struct rusage *ru) {
+    int i;
+    memset(result, 0, sizeof(*result));
+    result->seconds = wall_ns / 1000000000LL;
+    result->nanoseconds = wall_ns % 1000000000LL;
+    result->user_time = ru->ru_utime;
+    result->sys_time = ru->ru_stime;
+    result->max_set_size = ru->ru_maxrss;
+    result->soft_fault = ru->ru_minflt;
+    result->hard_fault = ru->ru_majflt;
+    result->in_block = ru->ru_inblock;
+    result->out_block = ru->ru_oublock;
+    result->vol_con_switches = ru->ru_nvcsw;
+    result->invol_con_switches = ru->ru_nivcsw;
+    for (i = 0; i < PERF_NUM_COUNTERS; i++) {
+        result->perf[i] = PERF_UNAVAILABLE;
+    }
+    for (i = 0; i < PHASE_NUM; i++) {
+        result->phase_ns[i] = PHASE_UNAVAILABLE;
+    }
+}
+
+
+/* Start copies behind one gate, release them together and wait for all. A
+ * forked child inherits the affinity of its parent, so each copy is pinned
+ * by pinning this process just before it is created.
+ */
+int throughput_run(const throughput_t *throughput, int copies,
+                   result_t *results, long long *makespan_ns) {
+    struct timespec start, end;
+    struct rusage ru;
+    cpu_set_t original, set;
+    launch_gate_t gate;
+    pid_t *pids, pid;
+    int started, remaining, failed = 0, null_fd = -1, status, i, j;
+
+    if (launch_gate_open(&gate) != 0) {
+        return -1;
+    }
+    if (throughput->quiet) {
+        null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    }
+    pids = malloc(sizeof(pid_t) * copies);
+    sched_getaffinity(0, sizeof(original), &original);
+
+    for (started = 0; started < copies; started++) {
+        if (throughput->cores_per_copy > 0) {
+            CPU_ZERO(&set);
+            for (j = 0; j < throughput->cores_per_copy; j++) {
+                CPU_SET(throughput->cpus[started * throughput->cores_per_copy
+                                         + j], &set);
+            }
+            if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+                break;
+            }
+        }
+        pids[started] = launch_start(LAUNCH_FORK, throughput->path,
+                                     throughput->argv, null_fd, null_fd,
+                                     &gate, NULL);
+        if (pids[started] < 0) {
+            break;
+        }
+    }
+    if (throughput->cores_per_copy > 0) {
+        sched_setaffinity(0, sizeof(original), &original);
+    }
+    if (null_fd != -1) {
+        close(null_fd);
+    }
+
+    /* Copies which did start must not run on unmeasured. */
+    if (started < copies) {
+        for (i = 0; i < started; i++) {
+            kill(pids[i], SIGKILL);
+        }
+        launch_gate_release(&gate);
+        for (i = 0; i < started; i++) {
+            waitpid(pids[i], &status, 0);
+        }
+        free(pids);
+        return -1;
+    }
+
+    clock_gettime(throughput->clock, &start);
+    launch_gate_release(&gate);
+
+    /* Reap the copies in the order they finish, each at its own time. */
+    for (remaining = copies; remaining > 0; ) {
+        pid = wait4(-1, &status, 0, &ru);
+        clock_gettime(throughput->clock, &end);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (i = 0; i < copies; i++) {
+            if (pids[i] == pid) {
+                copy_result(&results[i], elapsed_ns(&start, &end), &ru);
+                if (status != 0) {
+                    failed++;
+                }
+                remaining--;
+                break;
+            }
+        }
+    }
+    *makespan_ns = elapsed_ns(&start, &end);
+    free(pids);
+    return failed + remaining;
+}
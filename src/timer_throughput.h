@@ -0,0 +1,44 @@
+/* Run several identical copies of a command at once, to measure how they
+ * share the machine rather than how fast one of them runs alone.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#ifndef TIMER_THROUGHPUT_H
+#define TIMER_THROUGHPUT_H
+
+#include <time.h>
+
+/* How to run the copies. */
+typedef struct throughput_t {
+    /* Resolved command and its arguments, as for launch_start(). */
+    const char *path;
+    char **argv;
+    /* CPUs to pin copies to, cores_per_copy at a time in order. Copies are
+     * not pinned if cores_per_copy is zero.
+     */
+    const int *cpus;
+    int cores_per_copy;
+    /* Discard the output of the copies. */
+    int quiet;
+    /* Clock to time with. */
+    clockid_t clock;
+} throughput_t;
+
+
+/* Start copies of a command, each behind the same launch gate so that none
+ * can exec until all of them have been created, then release them together
+ * and wait for every one to exit.
+ *
+ * results[i] receives the wall clock time of copy i from the release of the
+ * gate until it exited, and its resource use. Performance counters and
+ * phases are unavailable. makespan_ns receives the time until the last copy
+ * exited.
+ *
+ * Returns the number of copies which failed, or -1 if they could not all be
+ * started, in which case any which were started are killed.
+ */
+int throughput_run(const throughput_t *throughput, int copies,
+                   struct result_t *results, long long *makespan_ns);
+
+#endif /* TIMER_THROUGHPUT_H */
@@ -0,0 +1,393 @@
+/* Query, aggregate and export the result stores written by timer -D.
+ *
+ * Usage: timerstore options STORE...
+ * -h --help Display this usage information.
+ * -b --benchmark TEXT Only use runs whose command contains TEXT.
+ * -p --param NAME=VALUE Only use runs where the swept parameter NAME took
+ *                       VALUE. May be given more than once.
+ * -H --host NAME Only use runs on the machine NAME.
+ * -m --metric KEY Metric to tabulate (default wall_clock_s).
+ * -L --list List the matching runs rather than aggregating them.
+ * -B --bootstrap Number of bootstrap resamples behind each confidence
+ *                interval, or 0 (the default) for intervals from Student's t.
+ * -l --latex Export each group as results.tex and summary.tex.
+ * -j --json Export each group as results.json and summary.json.
+ * -s --csv Export each group as results.csv and summary.csv.
+ * -v --verbose Print the full statistics of every group.
+ *
+ * Runs of the same command with the same parameters form a group, and all
+ * the experiments of a group are summarised together. The stores are mapped
+ * into memory and their columns copied straight out, so nothing is parsed.
+ * When there is more than one group, exported files are prefixed groupN-.
+ *
+ * (c) Sarah Mount <s.mount@wlv.ac.uk> 2014
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timer_data.h"
+#include "timer_store.h"
+
+/* Most parameter filters. */
+#define MAX_FILTERS 16
+
+/* Filenames. */
+#define CSV_RESULTS   "results.csv"
+#define JSON_RESULTS  "results.json"
+#define LATEX_RESULTS "results.tex"
+#define CSV_SUMMARY   "summary.csv"
+#define JSON_SUMMARY  "summary.json"
+#define LATEX_SUMMARY "summary.tex"
+
+/* The name of this program. */
+const char *program_name;
+
+/* Which runs to use. */
+const char *benchmark, *host;
+char *filters[MAX_FILTERS];
+int num_filters;
+
+/* Output types. */
+int latex, csv, json, verbose;
+
+/* Prints usage information for this program exit. */
+void print_usage (FILE *stream, int exit_code);
+
+/* Non-zero if a run passes every filter. */
+int run_matches(const store_run_t *run);
+
+/* Print one line describing a run. */
+void print_run(const char *filename, int index, const store_run_t *run);
+
+/* Summarise a group, print it and export it. Returns 0 on success. */
+int report_group(store_group_t *group, int index, int num_groups,
+                 int metric, bootstrap_t *bootstrap);
+
+
+int main(int argc, char **argv) {
+    const char *metric_key_name = "wall_clock_s";
+    bootstrap_t bootstrap = { 0, 0, 0x5eedULL };
+    store_t *stores;
+    const store_run_t *run;
+    store_group_t *groups = NULL;
+    int num_stores, num_groups = 0, list = 0, metric, failed = 0, i, n;
+
+    /* Valid short options. */
+    const char *short_options = "hb:p:H:m:LB:ljsv";
+    int next_opt;
+
+    /* Valid long options. */
+    const struct option long_options[] = {
+        { "help",      0, NULL, 'h' },
+        { "benchmark", 1, NULL, 'b' },
+        { "param",     1, NULL, 'p' },
+        { "host",      1, NULL, 'H' },
+        { "metric",    1, NULL, 'm' },
+        { "list",      0, NULL, 'L' },
+        { "bootstrap", 1, NULL, 'B' },
+        { "latex",     0, NULL, 'l' },
+        { "json",      0, NULL, 'j' },
+        { "csv",       0, NULL, 's' },
+        { "verbose",   0, NULL, 'v' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    program_name = argv[0]; /* Global. */
+
+    do {
+        next_opt = getopt_long(argc, argv, short_options, long_options, NULL);
+        switch (next_opt) {
+            case 'h': /* -h or --help */
+               print_usage (stdout, 0);
+               break;
+            case 'b': /* -b or --benchmark */
+               benchmark = optarg; /* Global. */
+               break;
+            case 'p': /* -p or --param */
+               if (num_filters == MAX_FILTERS || strchr(optarg, '=') == NULL) {
+                   print_usage (stderr, 1);
+               }
+               filters[num_filters++] = optarg; /* Global. */
+               break;
+            case 'H': /* -H or --host */
+               host = optarg; /* Global. */
+               break;
+            case 'm': /* -m or --metric */
+               metric_key_name = optarg;
+               break;
+            case 'L': /* -L or --list */
+               list = 1;
+               break;
+            case 'B': /* -B or --bootstrap */
+               bootstrap.resamples = atoi(optarg);
+               break;
+            case 'l': /* -l or --latex */
+               latex = 1; /* Global. */
+               break;
+            case 'j': /* -j or --json */
+               json = 1; /* Global. */
+               break;
+            case 's': /* -s or --csv */
+               csv = 1; /* Global. */
+               break;
+            case 'v': /* -v or --verbose */
+               verbose = 1; /* Global. */
+               break;
+            case -1:
+                break;
+            default:
+                print_usage (stderr, 1);
+                return 1;
+        }
+    } while (next_opt != -1);
+
+    if (optind >= argc) {
+        print_usage (stderr, 1);
+    }
+
+    for (metric = 0; metric < METRIC_NUM; metric++) {
+        if (strcmp(metric_key(metric), metric_key_name) == 0) {
+            break;
+        }
+    }
+    if (metric == METRIC_NUM) {
+        fprintf(stderr, "Unknown metric %s. Metrics are:", metric_key_name);
+        for (i = 0; i < METRIC_NUM; i++) {
+            fprintf(stderr, " %s", metric_key(i));
+        }
+        fprintf(stderr, "\n");
+        exit(EXIT_FAILURE);
+        return 1;
+    }
+    if (bootstrap.resamples < 0) {
+        errno = EINVAL;
+        perror("Resamples must not be negative");
+        exit(EXIT_FAILURE);
+        return 1;
+    }
+    bootstrap.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* Map every store, and sort the runs which match into groups. */
+    num_stores = argc - optind;
+    stores = calloc(num_stores, sizeof(store_t));
+    for (i = 0; i < num_stores; i++) {
+        if (store_open(&stores[i], argv[optind + i]) != 0) {
+            perror(argv[optind + i]);
+            exit(EXIT_FAILURE);
+            return 1;
+        }
+        for (run = store_next(&stores[i], NULL), n = 0; run != NULL;
+             run = store_next(&stores[i], run), n++) {
+            if (!run_matches(run)) {
+                continue;
+            }
+            if (list) {
+                print_run(argv[optind + i], n, run);
+            } else {
+                store_group_add(&groups, &num_groups, run);
+            }
+        }
+    }
+
+    if (!list) {
+        if (num_groups == 0) {
+            fprintf(stderr, "No runs match.\n");
+            failed = 1;
+        } else if (!verbose) {
+            printf("%-5s %5s %8s %14s %14s %14s %14s  %s\n",
+                   "Group", "Runs", "N", "Mean", "Std. dev.", "Median",
+                   "99th", "Command [parameters]");
+        }
+        for (i = 0; i < num_groups; i++) {
+            failed |= report_group(&groups[i], i, num_groups, metric,
+                                   &bootstrap);
+        }
+        store_groups_free(groups, num_groups);
+    }
+
+    for (i = 0; i < num_stores; i++) {
+        store_close(&stores[i]);
+    }
+    free(stores);
+    return failed;
+}
+
+
+/* Non-zero if a run passes the benchmark, host and parameter filters. */
+int run_matches(const store_run_t *run) {
+    char *name, *value, *equals;
+    int i, match;
+
+    if (benchmark != NULL && strstr(store_command(run), benchmark) == NULL) {
+        return 0;
+    }
+    if (host != NULL && strcmp(store_host(run), host) != 0) {
+        return 0;
+    }
+    for (i = 0; i < num_filters; i++) {
+        equals = strchr(filters[i], '=');
+        name = strndup(filters[i], (size_t)(equals - filters[i]));
+        value = store_parameter(run, name);
+        match = value != NULL && strcmp(value, equals + 1) == 0;
+        free(value);
+        free(name);
+        if (!match) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/* Print one line describing a run: where it is, when and where it ran, how
+ * many experiments it holds and what was timed.
+ */
+void print_run(const char *filename, int index, const store_run_t *run) {
+    char date[32];
+    time_t timestamp = (time_t)run->timestamp;
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&timestamp));
+    printf("%s:%d  %s  %s  %u runs  %s", filename, index, date,
+           store_host(run), run->experiments, store_command(run));
+    if (store_parameters(run)[0] != '\0') {
+        printf(" [%s]", store_parameters(run));
+    }
+    printf("\n");
+}
+
+
+/* Build the name of an exported file, e.g. "group3-" + "results.csv". */
+static char * output_filename(const char *prefix, const char *name) {
+    char *filename = malloc(strlen(prefix) + strlen(name) + 1);
+    sprintf(filename, "%s%s", prefix, name);
+    return filename;
+}
+
+
+/* Export a group with the writers timer itself uses. */
+static void export_group(results_t *results, statistics_t *stats,
+                         const char *prefix) {
+    char *filename;
+    int runs = results->count;
+
+    if (csv) {
+        filename = output_filename(prefix, CSV_RESULTS);
+        if (0 != result_write_csv(results, filename)) {
+            fprintf(stderr, "Could not write to file %s\n.", filename);
+        }
+        free(filename);
+        filename = output_filename(prefix, CSV_SUMMARY);
+        if (0 != statistics_write_csv(stats, filename, runs)) {
+            fprintf(stderr, "Could not write to file %s\n.", filename);
+        }
+        free(filename);
+    }
+    if (json) {
+        filename = output_filename(prefix, JSON_RESULTS);
+        if (0 != result_write_json(results, filename)) {
+            fprintf(stderr, "Could not write to file %s\n.", filename);
+        }
+        free(filename);
+        filename = output_filename(prefix, JSON_SUMMARY);
+        if (0 != statistics_write_json(stats, filename, runs)) {
+            fprintf(stderr, "Could not write to file %s\n.", filename);
+        }
+        free(filename);
+    }
+    if (latex) {
+        filename = output_filename(prefix, LATEX_RESULTS);
+        if (0 != result_write_latex(results, filename)) {
+            fprintf(stderr, "Could not write to file %s\n.", filename);
+        }
+        free(filename);
+        filename = output_filename(prefix, LATEX_SUMMARY);
+        if (0 != statistics_write_latex(stats, filename, runs)) {
+            fprintf(stderr, "Could not write to file %s\n.", filename);
+        }
+        free(filename);
+    }
+}
+
+
+/* Summarise every experiment in a group, print the summary and export it. */
+int report_group(store_group_t *group, int index, int num_groups,
+                 int metric, bootstrap_t *bootstrap) {
+    const store_run_t *first = group->runs[0];
+    statistics_t *stats;
+    results_t *results;
+    summary_t *s;
+    char prefix[32] = "";
+
+    results = store_group_results(group);
+    if (results == NULL) {
+        fprintf(stderr, "Group %d has too many experiments.\n", index);
+        return 1;
+    }
+
+    stats = statistics_new();
+    summarise_statistics(results, stats, bootstrap);
+    stats->num_warmup = (int)first->warmup;
+    stats->hops = first->hops;
+
+    if (verbose) {
+        printf("\nGroup %d: %s", index, store_command(first));
+        if (store_parameters(first)[0] != '\0') {
+            printf(" [%s]", store_parameters(first));
+        }
+        printf(" (%d runs)\n", group->num_runs);
+        print_statistics(stats);
+    } else {
+        s = &stats->metric[metric];
+        printf("%-5d %5d %8d %14.6Lg %14.6Lg %14.6Lg %14.6Lg  %s",
+               index, group->num_runs, results->count, s->mean, s->stdev,
+               s->median, s->p99, store_command(first));
+        if (store_parameters(first)[0] != '\0') {
+            printf(" [%s]", store_parameters(first));
+        }
+        printf("\n");
+    }
+
+    if (num_groups > 1) {
+        snprintf(prefix, sizeof(prefix), "group%d-", index);
+    }
+    export_group(results, stats, prefix);
+
+    statistics_free(stats);
+    results_free(results);
+    return 0;
+}
+
+
+/* Prints usage information for this program exit. */
+void print_usage (FILE *stream, int exit_code) {
+    fprintf (stream, "Usage: %s options STORE...\n", program_name);
+    fprintf (stream,
+             " -h --help Display this usage information.\n"
+             " -b --benchmark TEXT Only use runs whose command contains TEXT.\n"
+             " -p --param NAME=VALUE Only use runs where the swept parameter\n"
+             "            NAME took VALUE. May be given up to %d times.\n"
+             " -H --host NAME Only use runs on the machine NAME.\n"
+             " -m --metric KEY Metric to tabulate (default wall_clock_s).\n"
+             " -L --list List the matching runs rather than aggregating them.\n"
+             " -B --bootstrap Resamples behind each confidence interval\n"
+             "                (default 0, for intervals from Student's t).\n"
+             " -l --latex Export each group as %s and %s.\n"
+             " -j --json Export each group as %s and %s.\n"
+             " -s --csv Export each group as %s and %s.\n"
+             " -v --verbose Print the full statistics of every group.\n\n"
+             "Runs of the same command with the same parameters are grouped,\n"
+             "and exported files are prefixed groupN- if there are several.\n\n"
+             "Example: Keep every nightly run, then summarise the 8 token rings:\n"
+             "   timer -D nightly.store -X tokens=1,8,64 -c 'tokenring 1000 {tokens}'\n"
+             "   timerstore -b tokenring -p tokens=8 nightly.store\n",
+             MAX_FILTERS, LATEX_RESULTS, LATEX_SUMMARY, JSON_RESULTS,
+             JSON_SUMMARY, CSV_RESULTS, CSV_SUMMARY);
+    exit (exit_code);
+}